@@ -1,14 +1,32 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <algorithm>
+#include <bit>
+#include <condition_variable>
+#include <cstdio>
 #include <cstring>
+#include <exception>
 #include <memory>
+#include <mutex>
+#include <new>
 #include <numeric>
 #include <sstream>
 #include <string>
 #include <utility>
 
 #include "../include/arr2d.hpp"
+#include "../include/cstr.hpp"
+#include "../include/on-scope-exit.hpp"
 #include "../include/pgm8.hpp"
 
-using pgm8::Format, pgm8::Image;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PGM8_SSE2 1
+#else
+#define PGM8_SSE2 0
+#endif
+
+using pgm8::Format, pgm8::Image, pgm8::Order;
 
 static
 bool string_starts_with(
@@ -30,8 +48,618 @@ bool string_starts_with(
   return true;
 }
 
-Image::Image() noexcept
-: m_width{0}, m_height{0}, m_maxval{0}, m_pixels{nullptr}
+namespace {
+
+class NewDeleteAllocator : public pgm8::Allocator {
+public:
+  uint8_t *allocate(size_t const size) override {
+    return new uint8_t[size];
+  }
+  void deallocate(uint8_t *const buffer, size_t) noexcept override {
+    delete[] buffer;
+  }
+};
+
+} // namespace
+
+pgm8::Allocator *pgm8::default_allocator() noexcept {
+  static NewDeleteAllocator s_allocator{};
+  return &s_allocator;
+}
+
+// Returns the index of the smallest size class with room for `size` bytes, which may be past the last class.
+static
+size_t size_class(size_t const size) noexcept {
+  size_t constexpr MIN_CLASS_BITS = std::countr_zero(pgm8::BufferPool::MIN_CLASS_SIZE);
+  if (size <= pgm8::BufferPool::MIN_CLASS_SIZE) {
+    return 0;
+  }
+  // computed rather than found by doubling a class size, which would overflow for sizes above 2^63
+  return static_cast<size_t>(std::bit_width(size - 1)) - MIN_CLASS_BITS;
+}
+
+pgm8::BufferPool::~BufferPool() {
+  release();
+}
+
+uint8_t *pgm8::BufferPool::allocate(size_t const size) {
+  size_t const idx = size_class(size);
+  if (idx >= NUM_CLASSES) {
+    throw std::bad_alloc();
+  }
+
+  {
+    std::scoped_lock const lock(m_mutex);
+    auto &freeList = m_freeLists[idx];
+    if (!freeList.empty()) {
+      uint8_t *const buffer = freeList.back();
+      freeList.pop_back();
+      return buffer;
+    }
+    ++m_heapAllocations;
+  }
+
+  return static_cast<uint8_t *>(::operator new(
+    MIN_CLASS_SIZE << idx,
+    std::align_val_t{ALIGNMENT}
+  ));
+}
+
+void pgm8::BufferPool::deallocate(
+  uint8_t *const buffer,
+  size_t const size
+) noexcept {
+  if (buffer == nullptr) {
+    return;
+  }
+
+  size_t const idx = size_class(size);
+
+  try {
+    std::scoped_lock const lock(m_mutex);
+    m_freeLists[idx].push_back(buffer);
+  } catch (...) {
+    // couldn't grow the free list, give the buffer back to the heap instead
+    ::operator delete(buffer, std::align_val_t{ALIGNMENT});
+  }
+}
+
+void pgm8::BufferPool::release() noexcept {
+  std::scoped_lock const lock(m_mutex);
+  for (auto &freeList : m_freeLists) {
+    for (uint8_t *const buffer : freeList) {
+      ::operator delete(buffer, std::align_val_t{ALIGNMENT});
+    }
+    freeList.clear();
+  }
+}
+
+size_t pgm8::BufferPool::cached() const noexcept {
+  std::scoped_lock const lock(m_mutex);
+  size_t count = 0;
+  for (auto const &freeList : m_freeLists) {
+    count += freeList.size();
+  }
+  return count;
+}
+
+size_t pgm8::BufferPool::heap_allocations() const noexcept {
+  std::scoped_lock const lock(m_mutex);
+  return m_heapAllocations;
+}
+
+// Compressed format (`Format::COMPRESSED`)
+//
+// After the usual header (with magic number "PZ") comes:
+//   u16 tile width, u16 tile height
+//   u64 offset of each tile's payload (relative to the first payload), plus
+//       one more for the end of the last payload
+//   the tile payloads
+// Integers are little-endian. Tiles are ordered left-to-right, top-to-bottom,
+// tiles on the right and bottom edges are cut off at the image boundary. Each
+// payload begins with a byte identifying its encoding:
+//   TILE_STORED: pixels row by row, as-is
+//   TILE_UP_LZ:  the first row as-is followed by each row minus the row above
+//                it (so vertically smooth areas become runs of zeros),
+//                compressed with the LZ77 scheme below
+// Tiles are independent of each other, so any region can be decoded without
+// touching the tiles outside of it.
+//
+// LZ77 scheme (similar to LZ4 blocks):
+// A sequence of [token][literal length ext][literals][offset][match length ext]
+// where the token's high nibble is the literal count and its low nibble is the
+// match length minus LZ_MIN_MATCH. A nibble of 15 is followed by extension
+// bytes which are added to it, until one which isn't 255. The offset is a u16
+// distance back from the current position to copy the match from. The final
+// sequence ends after its literals, once the output is full.
+
+static constexpr uint8_t TILE_STORED = 0;
+static constexpr uint8_t TILE_UP_LZ = 1;
+
+static constexpr size_t LZ_MIN_MATCH = 4;
+static constexpr size_t LZ_MAX_OFFSET = UINT16_MAX;
+static constexpr size_t LZ_HASH_BITS = 12;
+static constexpr size_t LZ_NO_POS = SIZE_MAX;
+
+static
+void put_le(std::vector<uint8_t> &out, uint64_t const value, size_t const bytes) {
+  for (size_t i = 0; i < bytes; ++i) {
+    out.push_back(static_cast<uint8_t>(value >> (i * 8)));
+  }
+}
+
+static
+uint64_t get_le(uint8_t const *const in, size_t const bytes) noexcept {
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; ++i) {
+    value |= uint64_t{in[i]} << (i * 8);
+  }
+  return value;
+}
+
+static
+void lz_put_length(std::vector<uint8_t> &out, size_t len) {
+  // `len` excludes the 15 already stored in the token
+  while (len >= 255) {
+    out.push_back(255);
+    len -= 255;
+  }
+  out.push_back(static_cast<uint8_t>(len));
+}
+
+static
+void lz_put_sequence(
+  std::vector<uint8_t> &out,
+  uint8_t const *const literals,
+  size_t const numLiterals,
+  size_t const matchLen, // 0 for the final sequence
+  size_t const offset
+) {
+  size_t const litNibble = std::min<size_t>(numLiterals, 15);
+  size_t const matchNibble =
+    matchLen == 0 ? 0 : std::min<size_t>(matchLen - LZ_MIN_MATCH, 15);
+
+  out.push_back(static_cast<uint8_t>((litNibble << 4) | matchNibble));
+  if (litNibble == 15) {
+    lz_put_length(out, numLiterals - 15);
+  }
+  out.insert(out.end(), literals, literals + numLiterals);
+
+  if (matchLen != 0) {
+    put_le(out, offset, 2);
+    if (matchNibble == 15) {
+      lz_put_length(out, matchLen - LZ_MIN_MATCH - 15);
+    }
+  }
+}
+
+// Appends the compressed form of `src` to `out`. `hashTable` is scratch space.
+static
+void lz_compress(
+  uint8_t const *const src,
+  size_t const size,
+  std::vector<size_t> &hashTable,
+  std::vector<uint8_t> &out
+) {
+  hashTable.assign(size_t{1} << LZ_HASH_BITS, LZ_NO_POS);
+
+  size_t anchor = 0, pos = 0;
+
+  while (pos + LZ_MIN_MATCH <= size) {
+    uint32_t seq;
+    std::memcpy(&seq, src + pos, sizeof(seq));
+    size_t const hash = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+    size_t const candidate = hashTable[hash];
+    hashTable[hash] = pos;
+
+    if (
+      candidate == LZ_NO_POS ||
+      pos - candidate > LZ_MAX_OFFSET ||
+      std::memcmp(src + candidate, src + pos, LZ_MIN_MATCH) != 0
+    ) {
+      ++pos;
+      continue;
+    }
+
+    size_t matchLen = LZ_MIN_MATCH;
+    while (pos + matchLen < size && src[candidate + matchLen] == src[pos + matchLen]) {
+      ++matchLen;
+    }
+
+    lz_put_sequence(out, src + anchor, pos - anchor, matchLen, pos - candidate);
+    pos += matchLen;
+    anchor = pos;
+  }
+
+  if (anchor < size) {
+    lz_put_sequence(out, src + anchor, size - anchor, 0, 0);
+  }
+}
+
+// Decompresses `src` into exactly `dstSize` bytes at `dst`, throws if `src` is corrupt.
+static
+void lz_decompress(
+  uint8_t const *const src,
+  size_t const srcSize,
+  uint8_t *const dst,
+  size_t const dstSize
+) {
+  uint8_t const *ip = src;
+  uint8_t const *const iend = src + srcSize;
+  uint8_t *op = dst;
+  uint8_t *const oend = dst + dstSize;
+
+  auto const corrupt = []() {
+    return std::runtime_error("corrupt compressed tile");
+  };
+
+  auto const getLength = [&](size_t len) {
+    if (len == 15) {
+      uint8_t ext;
+      do {
+        if (ip == iend) {
+          throw corrupt();
+        }
+        ext = *ip++;
+        len += ext;
+      } while (ext == 255);
+    }
+    return len;
+  };
+
+  while (op < oend) {
+    if (ip == iend) {
+      throw corrupt();
+    }
+    uint8_t const token = *ip++;
+
+    size_t const numLiterals = getLength(token >> 4);
+    if (
+      numLiterals > static_cast<size_t>(iend - ip) ||
+      numLiterals > static_cast<size_t>(oend - op)
+    ) {
+      throw corrupt();
+    }
+    if (
+      numLiterals <= 16 &&
+      iend - ip >= 16 &&
+      oend - op >= 16
+    ) {
+      // a fixed size copy is much cheaper than a call to memcpy, it's fine to
+      // write past the literals since whatever follows overwrites it
+      std::memcpy(op, ip, 16);
+    } else {
+      std::memcpy(op, ip, numLiterals);
+    }
+    op += numLiterals;
+    ip += numLiterals;
+
+    if (op == oend) {
+      break;
+    }
+
+    if (iend - ip < 2) {
+      throw corrupt();
+    }
+    size_t const offset = static_cast<size_t>(get_le(ip, 2));
+    ip += 2;
+    size_t const matchLen = getLength(token & 15u) + LZ_MIN_MATCH;
+    if (
+      offset == 0 ||
+      offset > static_cast<size_t>(op - dst) ||
+      matchLen > static_cast<size_t>(oend - op)
+    ) {
+      throw corrupt();
+    }
+
+    uint8_t const *const match = op - offset;
+    if (offset == 1) {
+      // runs are very common after filtering
+      std::memset(op, *match, matchLen);
+    } else if (offset >= 16 && static_cast<size_t>(oend - op) >= matchLen + 15) {
+      // copy in chunks, may write past the match but that gets overwritten by
+      // what follows
+      for (size_t i = 0; i < matchLen; i += 16) {
+        std::memcpy(op + i, match + i, 16);
+      }
+    } else if (static_cast<size_t>(oend - op) >= matchLen + 7) {
+      // repeating patterns, copy byte by byte until the pattern repeats at
+      // least every 8 bytes, then in chunks from that far back
+      size_t const period = offset * ((8 + offset - 1) / offset);
+      size_t i = 0;
+      for (; i < std::min(period, matchLen); ++i) {
+        op[i] = match[i];
+      }
+      for (; i < matchLen; i += 8) {
+        std::memcpy(op + i, op + i - period, 8);
+      }
+    } else {
+      for (size_t i = 0; i < matchLen; ++i) {
+        op[i] = match[i];
+      }
+    }
+    op += matchLen;
+  }
+}
+
+// Sets `out` to `residuals` plus `above` bytewise (mod 256), undoing the up filter.
+static
+void add_rows(
+  uint8_t *const out,
+  uint8_t const *const residuals,
+  uint8_t const *const above,
+  size_t const count
+) noexcept {
+  size_t c = 0;
+
+#if PGM8_SSE2
+  for (; c + 16 <= count; c += 16) {
+    __m128i const r = _mm_loadu_si128(reinterpret_cast<__m128i const *>(residuals + c));
+    __m128i const a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(above + c));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + c), _mm_add_epi8(r, a));
+  }
+#endif
+
+  for (; c < count; ++c) {
+    out[c] = static_cast<uint8_t>(residuals[c] + above[c]);
+  }
+}
+
+// Appends the payload of the `w` x `h` tile `pixels` (stored contiguously) to `out`.
+static
+void encode_tile(
+  uint8_t const *const pixels,
+  size_t const w,
+  size_t const h,
+  std::vector<uint8_t> &filtered,
+  std::vector<size_t> &hashTable,
+  std::vector<uint8_t> &out
+) {
+  size_t const count = w * h;
+
+  filtered.resize(count);
+  std::memcpy(filtered.data(), pixels, w);
+  for (size_t i = w; i < count; ++i) {
+    filtered[i] = static_cast<uint8_t>(pixels[i] - pixels[i - w]);
+  }
+
+  size_t const start = out.size();
+  out.push_back(TILE_UP_LZ);
+  lz_compress(filtered.data(), count, hashTable, out);
+
+  // incompressible, store as-is
+  if (out.size() - start > count + 1) {
+    out.resize(start);
+    out.push_back(TILE_STORED);
+    out.insert(out.end(), pixels, pixels + count);
+  }
+}
+
+// Decodes the payload of a `w` x `h` tile into `pixels`, whose rows are `stride` apart. `scratch` is scratch space.
+static
+void decode_tile(
+  uint8_t const *const payload,
+  size_t const size,
+  size_t const w,
+  size_t const h,
+  uint8_t *const pixels,
+  size_t const stride,
+  std::vector<uint8_t> &scratch
+) {
+  size_t const count = w * h;
+
+  if (size < 1) {
+    throw std::runtime_error("corrupt compressed tile");
+  }
+
+  switch (payload[0]) {
+    case TILE_STORED:
+      if (size - 1 != count) {
+        throw std::runtime_error("corrupt compressed tile");
+      }
+      for (size_t r = 0; r < h; ++r) {
+        std::memcpy(pixels + r * stride, payload + 1 + r * w, w);
+      }
+      break;
+
+    case TILE_UP_LZ: {
+      scratch.resize(count);
+      uint8_t *const residuals = scratch.data();
+      lz_decompress(payload + 1, size - 1, residuals, count);
+
+      // unfilter straight into the destination
+      std::memcpy(pixels, residuals, w);
+      for (size_t r = 1; r < h; ++r) {
+        add_rows(
+          pixels + r * stride,
+          residuals + r * w,
+          pixels + (r - 1) * stride,
+          w
+        );
+      }
+      break;
+    }
+
+    default: throw std::runtime_error("unknown tile encoding");
+  }
+}
+
+struct TileRect {
+  size_t x, y, w, h;
+};
+
+// The tile dimensions and payload offsets which precede the tile payloads.
+struct TileTable {
+  size_t imgW, imgH, tileW, tileH, across, down;
+  std::vector<uint64_t> offsets;
+
+  TileTable(
+    size_t const imgW_,
+    size_t const imgH_,
+    size_t const tileW_,
+    size_t const tileH_
+  )
+  : imgW{imgW_}, imgH{imgH_}, tileW{tileW_}, tileH{tileH_},
+    across{(imgW_ + tileW_ - 1) / tileW_},
+    down{(imgH_ + tileH_ - 1) / tileH_},
+    offsets{}
+  {}
+
+  // Reads the table from `file`, which must be positioned at the start of it. Everything is checked against the size
+  // of the file before anything is allocated, so a corrupt table throws `std::runtime_error` rather than `bad_alloc`.
+  TileTable(std::istream &file, size_t const imgW_, size_t const imgH_)
+  : TileTable(imgW_, imgH_, 1, 1)
+  {
+    std::streamoff const start = file.tellg();
+    file.seekg(0, std::ios::end);
+    std::streamoff const end = file.tellg();
+    file.seekg(start);
+    if (start < 0 || end < start + 4) {
+      throw std::runtime_error("unexpected end of file");
+    }
+    // bytes after the tile dimensions
+    uint64_t remaining = static_cast<uint64_t>(end - start) - 4;
+
+    uint8_t dims[4];
+    file.read(reinterpret_cast<char *>(dims), sizeof(dims));
+    tileW = static_cast<size_t>(get_le(dims, 2));
+    tileH = static_cast<size_t>(get_le(dims + 2, 2));
+    if (!file || tileW < 1 || tileH < 1) {
+      throw std::runtime_error("invalid tile dimensions");
+    }
+    across = (imgW + tileW - 1) / tileW;
+    down = (imgH + tileH - 1) / tileH;
+
+    if (count() + 1 > remaining / 8) {
+      throw std::runtime_error("unexpected end of file");
+    }
+    remaining -= (count() + 1) * 8;
+
+    std::vector<uint8_t> raw((count() + 1) * 8);
+    file.read(
+      reinterpret_cast<char *>(raw.data()),
+      static_cast<std::streamsize>(raw.size())
+    );
+    if (!file) {
+      throw std::runtime_error("unexpected end of file");
+    }
+
+    offsets.resize(count() + 1);
+    for (size_t i = 0; i < offsets.size(); ++i) {
+      offsets[i] = get_le(raw.data() + i * 8, 8);
+      if (i > 0 && offsets[i] < offsets[i - 1]) {
+        throw std::runtime_error("invalid tile offsets");
+      }
+    }
+    // the payloads are back to back, and must fit in the rest of the file
+    if (offsets[0] != 0 || offsets.back() > remaining) {
+      throw std::runtime_error("invalid tile offsets");
+    }
+  }
+
+  size_t count() const noexcept {
+    return across * down;
+  }
+
+  TileRect rect(size_t const tx, size_t const ty) const noexcept {
+    size_t const x = tx * tileW, y = ty * tileH;
+    return { x, y, std::min(tileW, imgW - x), std::min(tileH, imgH - y) };
+  }
+};
+
+static
+void write_compressed_raster(
+  std::ofstream &file,
+  size_t const width,
+  size_t const height,
+  uint8_t const *const pixels,
+  size_t const tileWidth,
+  size_t const tileHeight
+) {
+  TileTable table(width, height, tileWidth, tileHeight);
+
+  std::vector<uint8_t> payloads{}, tile{}, filtered{};
+  std::vector<size_t> hashTable{};
+  table.offsets.reserve(table.count() + 1);
+
+  for (size_t ty = 0; ty < table.down; ++ty) {
+    for (size_t tx = 0; tx < table.across; ++tx) {
+      TileRect const rect = table.rect(tx, ty);
+      tile.resize(rect.w * rect.h);
+      for (size_t r = 0; r < rect.h; ++r) {
+        std::memcpy(
+          tile.data() + r * rect.w,
+          pixels + arr2d::get_1d_idx(width, rect.x, rect.y + r),
+          rect.w
+        );
+      }
+
+      table.offsets.push_back(payloads.size());
+      encode_tile(tile.data(), rect.w, rect.h, filtered, hashTable, payloads);
+    }
+  }
+  table.offsets.push_back(payloads.size());
+
+  std::vector<uint8_t> prefix{};
+  put_le(prefix, tileWidth, 2);
+  put_le(prefix, tileHeight, 2);
+  for (uint64_t const offset : table.offsets) {
+    put_le(prefix, offset, 8);
+  }
+
+  file.write(
+    reinterpret_cast<char const *>(prefix.data()),
+    static_cast<std::streamsize>(prefix.size())
+  );
+  file.write(
+    reinterpret_cast<char const *>(payloads.data()),
+    static_cast<std::streamsize>(payloads.size())
+  );
+}
+
+static
+void read_compressed_raster(
+  std::istream &file,
+  size_t const width,
+  size_t const height,
+  uint8_t *const pixels
+) {
+  TileTable const table(file, width, height);
+
+  // payloads are stored in tile order, so each is read (its size checked by `TileTable`) just before it's decoded
+  std::vector<uint8_t> payload{}, scratch{};
+
+  for (size_t ty = 0; ty < table.down; ++ty) {
+    for (size_t tx = 0; tx < table.across; ++tx) {
+      size_t const tileIdx = arr2d::get_1d_idx(table.across, tx, ty);
+      payload.resize(static_cast<size_t>(table.offsets[tileIdx + 1] - table.offsets[tileIdx]));
+      file.read(
+        reinterpret_cast<char *>(payload.data()),
+        static_cast<std::streamsize>(payload.size())
+      );
+      if (!file) {
+        throw std::runtime_error("unexpected end of file");
+      }
+
+      TileRect const rect = table.rect(tx, ty);
+      decode_tile(
+        payload.data(),
+        payload.size(),
+        rect.w,
+        rect.h,
+        pixels + arr2d::get_1d_idx(width, rect.x, rect.y),
+        width,
+        scratch
+      );
+    }
+  }
+}
+
+Image::Image() noexcept : Image::Image(pgm8::default_allocator()) {}
+
+Image::Image(pgm8::Allocator *const allocator) noexcept
+: m_width{0}, m_height{0}, m_maxval{0}, m_pixels{nullptr}, m_capacity{0},
+  m_allocator{allocator != nullptr ? allocator : pgm8::default_allocator()}
 {}
 
 Image::Image(std::ifstream &file, bool const loadPixels)
@@ -40,12 +668,36 @@ Image::Image(std::ifstream &file, bool const loadPixels)
   load(file, loadPixels);
 }
 
+Image::Image(
+  std::ifstream &file,
+  pgm8::Allocator *const allocator,
+  bool const loadPixels
+)
+: Image::Image(allocator)
+{
+  load(file, loadPixels);
+}
+
+Image::Image(
+  uint16_t const width,
+  uint16_t const height,
+  uint8_t const maxval,
+  pgm8::Allocator *const allocator
+)
+: Image::Image(allocator)
+{
+  m_width = width;
+  m_height = height;
+  m_maxval = maxval;
+  reserve(pixel_count());
+}
+
 Image::~Image() {
   clear();
 }
 
 // copy constructor
-Image::Image(Image const &other) : Image::Image() {
+Image::Image(Image const &other) : Image::Image(other.allocator()) {
   *this = other;
 }
 
@@ -56,23 +708,24 @@ Image &Image::operator=(Image const &other) {
     return *this;
   }
 
-  clear();
-
-  m_pixels = new uint8_t[other.pixel_count()];
+  if (other.pixels() == nullptr) {
+    release_pixels();
+  } else {
+    reserve(other.pixel_count());
+    // deep copy
+    std::memcpy(m_pixels, other.pixels(), sizeof(uint8_t) * other.pixel_count());
+  }
 
   // shallow copy
   m_width = other.width();
   m_height = other.height();
   m_maxval = other.maxval();
 
-  // deep copy
-  std::memcpy(m_pixels, other.pixels(), sizeof(uint8_t) * other.pixel_count());
-
   return *this;
 }
 
 // move constructor
-Image::Image(Image &&other) noexcept {
+Image::Image(Image &&other) noexcept : Image::Image() {
   *this = std::move(other);
 }
 
@@ -89,11 +742,14 @@ Image &pgm8::Image::operator=(Image &&other) noexcept {
   m_maxval = other.maxval();
 
   // cleanup
-  delete[] m_pixels;
+  release_pixels();
 
   // move pixels resource
   m_pixels = other.pixels();
+  m_capacity = other.m_capacity;
+  m_allocator = other.allocator();
   other.m_pixels = nullptr;
+  other.m_capacity = 0;
 
   other.m_width = 0;
   other.m_height = 0;
@@ -117,6 +773,26 @@ uint8_t *Image::pixels() const noexcept {
 size_t Image::pixel_count() const noexcept {
   return static_cast<size_t>(m_width) * m_height;
 }
+pgm8::Allocator *Image::allocator() const noexcept {
+  return m_allocator;
+}
+
+void Image::reserve(size_t const pixelCount) {
+  if (pixelCount <= m_capacity) {
+    return;
+  }
+  // allocated before the old buffer is released, so if it throws the image is left as it was
+  uint8_t *const pixels = m_allocator->allocate(pixelCount);
+  release_pixels();
+  m_pixels = pixels;
+  m_capacity = pixelCount;
+}
+
+void Image::release_pixels() noexcept {
+  m_allocator->deallocate(m_pixels, m_capacity);
+  m_pixels = nullptr;
+  m_capacity = 0;
+}
 
 void Image::load(std::ifstream &file, bool const loadPixels) {
   if (!file.is_open()) {
@@ -133,21 +809,24 @@ void Image::load(std::ifstream &file, bool const loadPixels) {
       return Format::RAW;
     } else if (string_starts_with(magicNum, "P2")) {
       return Format::PLAIN;
+    } else if (string_starts_with(magicNum, "PZ")) {
+      return Format::COMPRESSED;
     } else {
       throw std::runtime_error("invalid magic number");
     }
   })();
 
-  clear();
-
-  file >> m_width >> m_height;
-  {
-    int maxval;
-    file >> maxval;
-    m_maxval = static_cast<uint8_t>(maxval);
-  }
+  // parsed into locals, the members are only updated once the pixel buffer is in place, so if `reserve` throws the
+  // image is unchanged
+  uint16_t width = 0, height = 0;
+  int maxval = 0;
+  file >> width >> height >> maxval;
 
   if (!loadPixels) {
+    clear();
+    m_width = width;
+    m_height = height;
+    m_maxval = static_cast<uint8_t>(maxval);
     return;
   }
 
@@ -157,19 +836,41 @@ void Image::load(std::ifstream &file, bool const loadPixels) {
     file.read(&newline, 1);
   }
 
-  size_t const pixelCount = pixel_count();
+  size_t const pixelCount = static_cast<size_t>(width) * height;
+
+  reserve(pixelCount);
+  m_width = width;
+  m_height = height;
+  m_maxval = static_cast<uint8_t>(maxval);
 
   switch (format) {
     case Format::RAW:
-      m_pixels = new uint8_t[pixelCount];
       file.read(reinterpret_cast<char *>(m_pixels), pixelCount);
       break;
+    case Format::COMPRESSED:
+      read_compressed_raster(file, m_width, m_height, m_pixels);
+      break;
     case Format::PLAIN: {
-      m_pixels = new uint8_t[pixelCount];
-      char pixel[4] {};
-      for (size_t i = 0; i < pixelCount; ++i) {
-        file >> pixel;
-        m_pixels[i] = static_cast<uint8_t>(std::stoul(pixel));
+      // read the rest of the file in one go and parse it in place
+      std::streampos const rasterStart = file.tellg();
+      file.seekg(0, std::ios::end);
+      std::string text(static_cast<size_t>(file.tellg() - rasterStart), '\0');
+      file.seekg(rasterStart);
+      file.read(text.data(), static_cast<std::streamsize>(text.size()));
+
+      size_t i = 0;
+      for (std::string_view const token : cstr::tokenize(text, " \t\n\v\f\r")) {
+        if (i == pixelCount) {
+          break;
+        }
+        auto const pixel = cstr::parse_int<uint8_t>(token);
+        if (pixel.error != cstr::ParseError::NONE || pixel.length != token.size()) {
+          throw std::runtime_error("invalid pixel value");
+        }
+        m_pixels[i++] = pixel.value;
+      }
+      if (i < pixelCount) {
+        throw std::runtime_error("unexpected end of file");
       }
       break;
     }
@@ -178,8 +879,7 @@ void Image::load(std::ifstream &file, bool const loadPixels) {
 }
 
 void Image::clear() noexcept {
-  delete[] m_pixels;
-  m_pixels = nullptr;
+  release_pixels();
   m_width = 0;
   m_height = 0;
   m_maxval = 0;
@@ -214,6 +914,137 @@ bool Image::operator!=(Image const &other) const noexcept {
   return !areImagesEqual;
 }
 
+// Whitespace as defined by the Netpbm spec.
+static
+bool is_pgm_space(uint8_t const c) noexcept {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Parses a PGM header from `data` into `out`. Returns false if `data` ended before the header did, throws if the header is invalid.
+static
+bool parse_header(
+  uint8_t const *const data,
+  size_t const size,
+  pgm8::Header &out
+) {
+  if (size < 3) {
+    return false;
+  }
+  switch (data[0] == 'P' ? data[1] : 0) {
+    case '2': out.format = Format::PLAIN; break;
+    case '5': out.format = Format::RAW; break;
+    case 'Z': out.format = Format::COMPRESSED; break;
+    default: throw std::runtime_error("invalid magic number");
+  }
+
+  size_t pos = 2;
+
+  // skips whitespace and comments, returns false if `data` runs out
+  auto const skipSpaceAndComments = [&]() {
+    while (pos < size) {
+      if (is_pgm_space(data[pos])) {
+        ++pos;
+      } else if (data[pos] == '#') {
+        while (pos < size && data[pos] != '\n' && data[pos] != '\r') {
+          ++pos;
+        }
+      } else {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  // reads a decimal number in the range [1, `max`], returns false if `data` runs out
+  auto const readNum = [&](
+    char const *const name,
+    unsigned long const max,
+    unsigned long &num
+  ) {
+    if (!is_pgm_space(data[pos]) && data[pos] != '#') {
+      throw std::runtime_error(std::string("missing whitespace before ") + name);
+    }
+    if (!skipSpaceAndComments()) {
+      return false;
+    }
+    if (data[pos] < '0' || data[pos] > '9') {
+      throw std::runtime_error(std::string("invalid ") + name);
+    }
+    num = 0;
+    while (pos < size && data[pos] >= '0' && data[pos] <= '9') {
+      num = num * 10 + static_cast<unsigned long>(data[pos] - '0');
+      if (num > max) {
+        throw std::runtime_error(std::string(name) + " too large");
+      }
+      ++pos;
+    }
+    if (num == 0) {
+      throw std::runtime_error(std::string(name) + " must be > 0");
+    }
+    return pos < size;
+  };
+
+  unsigned long width, height, maxval;
+  if (
+    !readNum("width", UINT16_MAX, width) ||
+    !readNum("height", UINT16_MAX, height) ||
+    !readNum("maxval", UINT8_MAX, maxval)
+  ) {
+    return false;
+  }
+
+  // exactly one whitespace char separates maxval from the raster
+  if (!is_pgm_space(data[pos])) {
+    throw std::runtime_error("missing whitespace after maxval");
+  }
+
+  out.width = static_cast<uint16_t>(width);
+  out.height = static_cast<uint16_t>(height);
+  out.maxval = static_cast<uint8_t>(maxval);
+  out.rasterOffset = pos + 1;
+
+  return true;
+}
+
+pgm8::Header pgm8::probe(uint8_t const *const data, size_t const size) {
+  Header header{};
+  if (!parse_header(data, size, header)) {
+    throw std::runtime_error("incomplete header");
+  }
+  return header;
+}
+
+pgm8::Header pgm8::probe(char const *const pathname) {
+  std::FILE *const file = std::fopen(pathname, "rb");
+  if (file == nullptr) {
+    throw std::runtime_error(std::string("failed to open `") + pathname + '`');
+  }
+  auto const closeFileOnScopeExit = make_on_scope_exit([file]() {
+    std::fclose(file);
+  });
+
+  // we do our own buffering, this makes each `fread` a single read of the file
+  std::setvbuf(file, nullptr, _IONBF, 0);
+
+  // headers rarely exceed this, but comments can make them arbitrarily long
+  std::vector<uint8_t> buffer(512);
+  size_t size = 0;
+
+  while (true) {
+    size += std::fread(buffer.data() + size, 1, buffer.size() - size, file);
+
+    Header header{};
+    if (parse_header(buffer.data(), size, header)) {
+      return header;
+    }
+    if (size < buffer.size()) {
+      throw std::runtime_error("incomplete header");
+    }
+
+    buffer.resize(buffer.size() * 2);
+  }
+}
+
 void pgm8::write(
   std::ofstream &file,
   uint16_t const width,
@@ -232,6 +1063,7 @@ void pgm8::write(
       switch (format) {
         case Format::PLAIN: return "P2";
         case Format::RAW: return "P5";
+        case Format::COMPRESSED: return "PZ";
         default: throw std::runtime_error("bad `format`");
       }
     }();
@@ -244,13 +1076,16 @@ void pgm8::write(
   // pixels
   switch (format) {
     case Format::PLAIN: {
+      // each row is formatted into a buffer and written at once
+      std::string row(size_t{width} * (cstr::MAX_INT_CHARS<uint8_t> + 1) + 1, '\0');
       for (size_t r = 0; r < height; ++r) {
+        char *out = row.data();
         for (size_t c = 0; c < width; ++c) {
-          file
-            << static_cast<int>(pixels[arr2d::get_1d_idx(width, c, r)])
-            << ' ';
+          out = cstr::format_int(out, row.data() + row.size(), pixels[arr2d::get_1d_idx(width, c, r)]);
+          *out++ = ' ';
         }
-        file << '\n';
+        *out++ = '\n';
+        file.write(row.data(), out - row.data());
       }
       break;
     }
@@ -259,6 +1094,674 @@ void pgm8::write(
       file.write(reinterpret_cast<char const *>(pixels), pixelCount);
       break;
     }
+    case Format::COMPRESSED:
+      write_compressed_raster(file, width, height, pixels, 64, 64);
+      break;
+    default: throw std::runtime_error("bad `format`");
+  }
+}
+
+void pgm8::write_compressed(
+  std::ofstream &file,
+  uint16_t const width,
+  uint16_t const height,
+  uint8_t const maxval,
+  uint8_t const *const pixels,
+  uint16_t const tileWidth,
+  uint16_t const tileHeight
+) {
+  if (maxval < 1) {
+    throw std::runtime_error("`maxval` must be > 0");
+  }
+  if (tileWidth < 1 || tileHeight < 1) {
+    throw std::runtime_error("tile dimensions must be > 0");
+  }
+
+  file << "PZ\n"
+    << std::to_string(width) << ' ' << std::to_string(height) << '\n'
+    << std::to_string(maxval) << '\n';
+
+  write_compressed_raster(file, width, height, pixels, tileWidth, tileHeight);
+}
+
+Image pgm8::load_region(
+  char const *const pathname,
+  uint16_t const x,
+  uint16_t const y,
+  uint16_t const width,
+  uint16_t const height,
+  pgm8::Allocator *const allocator
+) {
+  Header const header = probe(pathname);
+
+  if (width < 1 || height < 1) {
+    throw std::runtime_error("`width` and `height` must be > 0");
+  }
+  if (
+    size_t{x} + width > header.width ||
+    size_t{y} + height > header.height
+  ) {
+    throw std::runtime_error("region out of bounds");
+  }
+
+  std::ifstream file(pathname, std::ios::binary);
+  if (!file.is_open()) {
+    throw std::runtime_error(std::string("failed to open `") + pathname + '`');
+  }
+
+  Image region(width, height, header.maxval, allocator);
+  uint8_t *const dst = region.pixels();
+
+  switch (header.format) {
+    case Format::PLAIN: {
+      // no way to find a pixel without parsing everything before it
+      Image const whole(file, allocator);
+      for (size_t r = 0; r < height; ++r) {
+        std::memcpy(
+          dst + arr2d::get_1d_idx(width, 0, r),
+          whole.pixels() + arr2d::get_1d_idx(header.width, x, y + r),
+          width
+        );
+      }
+      break;
+    }
+
+    case Format::RAW: {
+      for (size_t r = 0; r < height; ++r) {
+        size_t const offset = header.rasterOffset +
+          arr2d::get_1d_idx(header.width, x, y + r);
+        file.seekg(static_cast<std::streamoff>(offset));
+        file.read(
+          reinterpret_cast<char *>(dst + arr2d::get_1d_idx(width, 0, r)),
+          width
+        );
+      }
+      if (!file) {
+        throw std::runtime_error("unexpected end of file");
+      }
+      break;
+    }
+
+    case Format::COMPRESSED: {
+      file.seekg(static_cast<std::streamoff>(header.rasterOffset));
+      TileTable const table(file, header.width, header.height);
+      auto const payloadsStart = file.tellg();
+
+      std::vector<uint8_t> payload{}, tile{}, scratch{};
+
+      size_t const firstTx = x / table.tileW;
+      size_t const lastTx = (x + width - 1u) / table.tileW;
+      size_t const firstTy = y / table.tileH;
+      size_t const lastTy = (y + height - 1u) / table.tileH;
+
+      for (size_t ty = firstTy; ty <= lastTy; ++ty) {
+        for (size_t tx = firstTx; tx <= lastTx; ++tx) {
+          size_t const tileIdx = arr2d::get_1d_idx(table.across, tx, ty);
+          uint64_t const begin = table.offsets[tileIdx];
+          payload.resize(static_cast<size_t>(table.offsets[tileIdx + 1] - begin));
+          file.seekg(payloadsStart + static_cast<std::streamoff>(begin));
+          file.read(
+            reinterpret_cast<char *>(payload.data()),
+            static_cast<std::streamsize>(payload.size())
+          );
+          if (!file) {
+            throw std::runtime_error("unexpected end of file");
+          }
+
+          TileRect const rect = table.rect(tx, ty);
+          tile.resize(rect.w * rect.h);
+          decode_tile(
+            payload.data(), payload.size(),
+            rect.w, rect.h,
+            tile.data(), rect.w,
+            scratch
+          );
+
+          // copy the part of the tile which overlaps the region
+          size_t const left = std::max<size_t>(rect.x, x);
+          size_t const right = std::min<size_t>(rect.x + rect.w, size_t{x} + width);
+          size_t const top = std::max<size_t>(rect.y, y);
+          size_t const bottom = std::min<size_t>(rect.y + rect.h, size_t{y} + height);
+          for (size_t r = top; r < bottom; ++r) {
+            std::memcpy(
+              dst + arr2d::get_1d_idx(width, left - x, r - y),
+              tile.data() + arr2d::get_1d_idx(rect.w, left - rect.x, r - rect.y),
+              right - left
+            );
+          }
+        }
+      }
+      break;
+    }
+
     default: throw std::runtime_error("bad `format`");
   }
+
+  return region;
+}
+
+void pgm8::load_batch(
+  std::vector<std::string> const &pathnames,
+  std::function<void (size_t idx, Image &img)> const &onLoad,
+  Order const order,
+  size_t numThreads,
+  pgm8::Allocator *const allocator
+) {
+  if (numThreads == 0) {
+    numThreads = 1;
+  }
+  numThreads = std::min(numThreads, pathnames.size());
+
+  struct Loaded {
+    size_t idx;
+    Image img;
+    std::exception_ptr err;
+  };
+
+  // max number of images which can be loaded but not yet handed over,
+  // bounds memory usage when the caller is slower than the workers
+  size_t const window = numThreads * 2;
+
+  std::mutex mutex{};
+  std::condition_variable workerCv{}, callerCv{};
+  size_t nextIdx = 0, numHandedOver = 0;
+  bool stop = false;
+  std::vector<Loaded> loaded{};
+  std::vector<Image> recycled{};
+
+  auto const work = [&]() {
+    while (true) {
+      size_t idx;
+      Image img(allocator);
+      {
+        std::unique_lock lock(mutex);
+        workerCv.wait(lock, [&]() {
+          return stop || nextIdx >= pathnames.size() ||
+            nextIdx < numHandedOver + window;
+        });
+        if (stop || nextIdx >= pathnames.size()) {
+          return;
+        }
+        idx = nextIdx++;
+        if (!recycled.empty()) {
+          img = std::move(recycled.back());
+          recycled.pop_back();
+        }
+      }
+
+      std::exception_ptr err = nullptr;
+      try {
+        std::ifstream file(pathnames[idx], std::ios::binary);
+        if (!file.is_open()) {
+          throw std::runtime_error("failed to open `" + pathnames[idx] + '`');
+        }
+        img.load(file);
+      } catch (...) {
+        err = std::current_exception();
+      }
+
+      {
+        std::scoped_lock const lock(mutex);
+        loaded.push_back({ idx, std::move(img), err });
+      }
+      callerCv.notify_one();
+    }
+  };
+
+  std::vector<std::thread> workers{};
+  workers.reserve(numThreads);
+
+  // make sure workers are shut down if `onLoad` or a load throws
+  auto const joinWorkersOnScopeExit = make_on_scope_exit([&]() {
+    {
+      std::scoped_lock const lock(mutex);
+      stop = true;
+    }
+    workerCv.notify_all();
+    for (auto &w : workers) {
+      w.join();
+    }
+  });
+
+  for (size_t i = 0; i < numThreads; ++i) {
+    workers.emplace_back(work);
+  }
+
+  while (numHandedOver < pathnames.size()) {
+    Loaded next{};
+    {
+      std::unique_lock lock(mutex);
+      auto nextIt = loaded.end();
+      callerCv.wait(lock, [&]() {
+        if (order == Order::COMPLETION) {
+          nextIt = loaded.begin();
+        } else {
+          nextIt = std::find_if(
+            loaded.begin(), loaded.end(),
+            [numHandedOver](Loaded const &l) {
+              return l.idx == numHandedOver;
+            }
+          );
+        }
+        return nextIt != loaded.end();
+      });
+      next = std::move(*nextIt);
+      loaded.erase(nextIt);
+    }
+
+    if (next.err != nullptr) {
+      std::rethrow_exception(next.err);
+    }
+
+    onLoad(next.idx, next.img);
+
+    {
+      std::scoped_lock const lock(mutex);
+      recycled.push_back(std::move(next.img));
+      ++numHandedOver;
+    }
+    workerCv.notify_all();
+  }
+}
+
+// Returns how many chunks to split `count` units of work into, so that no chunk is smaller than `minChunk` (unless there is only one).
+static
+size_t num_chunks(
+  size_t const count,
+  size_t const numThreads,
+  size_t const minChunk
+) noexcept {
+  size_t const maxChunks = std::max<size_t>(count / minChunk, 1);
+  return std::clamp<size_t>(numThreads, 1, maxChunks);
+}
+
+// Splits [0, `count`) into `numChunks` contiguous ranges and calls `fn(begin, end, chunkIdx)` for each, all but the last on their own thread.
+template <typename Fn>
+static
+void run_chunks(size_t const count, size_t const numChunks, Fn const &fn) {
+  std::vector<std::thread> threads{};
+  threads.reserve(numChunks - 1);
+
+  auto const joinThreadsOnScopeExit = make_on_scope_exit([&threads]() {
+    for (auto &t : threads) {
+      t.join();
+    }
+  });
+
+  for (size_t i = 0; i < numChunks; ++i) {
+    size_t const begin = count * i / numChunks;
+    size_t const end = count * (i + 1) / numChunks;
+    if (i == numChunks - 1) {
+      fn(begin, end, i);
+    } else {
+      threads.emplace_back(fn, begin, end, i);
+    }
+  }
+}
+
+// Minimum number of pixels worth handing to a separate thread.
+static constexpr size_t MIN_PIXELS_PER_THREAD = 64 * 1024;
+
+static
+void histogram_kernel(
+  uint8_t const *const pixels,
+  size_t const count,
+  std::array<size_t, 256> &out
+) noexcept {
+  // consecutive pixels often have the same value, spreading them over
+  // separate banks avoids stalling on stores to the same counter
+  uint32_t banks[4][256] {};
+
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    ++banks[0][pixels[i]];
+    ++banks[1][pixels[i + 1]];
+    ++banks[2][pixels[i + 2]];
+    ++banks[3][pixels[i + 3]];
+  }
+  for (; i < count; ++i) {
+    ++banks[0][pixels[i]];
+  }
+
+  for (size_t v = 0; v < 256; ++v) {
+    out[v] = size_t{banks[0][v]} + banks[1][v] + banks[2][v] + banks[3][v];
+  }
+}
+
+std::array<size_t, 256> pgm8::histogram(
+  Image const &img,
+  size_t const numThreads
+) {
+  size_t const count = img.pixels() == nullptr ? 0 : img.pixel_count();
+  size_t const numChunks = num_chunks(count, numThreads, MIN_PIXELS_PER_THREAD);
+
+  std::vector<std::array<size_t, 256>> partials(numChunks);
+  run_chunks(count, numChunks, [&](
+    size_t const begin,
+    size_t const end,
+    size_t const chunk
+  ) {
+    histogram_kernel(img.pixels() + begin, end - begin, partials[chunk]);
+  });
+
+  std::array<size_t, 256> hist{};
+  for (auto const &partial : partials) {
+    for (size_t v = 0; v < 256; ++v) {
+      hist[v] += partial[v];
+    }
+  }
+  return hist;
+}
+
+static
+void lut_kernel(
+  uint8_t *const pixels,
+  size_t const count,
+  std::array<uint8_t, 256> const &lut
+) noexcept {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    uint8_t const p0 = lut[pixels[i]];
+    uint8_t const p1 = lut[pixels[i + 1]];
+    uint8_t const p2 = lut[pixels[i + 2]];
+    uint8_t const p3 = lut[pixels[i + 3]];
+    pixels[i] = p0;
+    pixels[i + 1] = p1;
+    pixels[i + 2] = p2;
+    pixels[i + 3] = p3;
+  }
+  for (; i < count; ++i) {
+    pixels[i] = lut[pixels[i]];
+  }
+}
+
+void pgm8::apply_lut(
+  Image &img,
+  std::array<uint8_t, 256> const &lut,
+  size_t const numThreads
+) {
+  size_t const count = img.pixels() == nullptr ? 0 : img.pixel_count();
+  size_t const numChunks = num_chunks(count, numThreads, MIN_PIXELS_PER_THREAD);
+
+  run_chunks(count, numChunks, [&](size_t const begin, size_t const end, size_t) {
+    lut_kernel(img.pixels() + begin, end - begin, lut);
+  });
+}
+
+static
+void threshold_kernel(
+  uint8_t *const pixels,
+  size_t const count,
+  uint8_t const threshold,
+  uint8_t const maxval
+) noexcept {
+  size_t i = 0;
+
+#if PGM8_SSE2
+  // nothing is greater than 255, so the scalar loop handles that case
+  if (threshold < UINT8_MAX) {
+    __m128i const min = _mm_set1_epi8(static_cast<char>(threshold + 1));
+    __m128i const max = _mm_set1_epi8(static_cast<char>(maxval));
+    for (; i + 16 <= count; i += 16) {
+      auto *const chunk = reinterpret_cast<__m128i *>(pixels + i);
+      __m128i const px = _mm_loadu_si128(chunk);
+      // there's no unsigned compare in SSE2, but max(px, min) == px <=> px >= min
+      __m128i const mask = _mm_cmpeq_epi8(_mm_max_epu8(px, min), px);
+      _mm_storeu_si128(chunk, _mm_and_si128(mask, max));
+    }
+  }
+#endif
+
+  for (; i < count; ++i) {
+    pixels[i] = pixels[i] > threshold ? maxval : 0;
+  }
+}
+
+void pgm8::threshold(
+  Image &img,
+  uint8_t const threshold,
+  size_t const numThreads
+) {
+  size_t const count = img.pixels() == nullptr ? 0 : img.pixel_count();
+  size_t const numChunks = num_chunks(count, numThreads, MIN_PIXELS_PER_THREAD);
+  uint8_t const maxval = img.maxval();
+
+  run_chunks(count, numChunks, [&](size_t const begin, size_t const end, size_t) {
+    threshold_kernel(img.pixels() + begin, end - begin, threshold, maxval);
+  });
+}
+
+void pgm8::rescale(
+  Image &img,
+  uint8_t const newMaxval,
+  size_t const numThreads
+) {
+  if (newMaxval < 1) {
+    throw std::runtime_error("`newMaxval` must be > 0");
+  }
+  if (img.maxval() < 1) {
+    throw std::runtime_error("`img` has no maxval");
+  }
+
+  std::array<uint8_t, 256> lut{};
+  unsigned const oldMaxval = img.maxval();
+  for (unsigned v = 0; v < 256; ++v) {
+    // values above the old maxval are invalid, clamp them
+    unsigned const clamped = std::min(v, oldMaxval);
+    lut[v] = static_cast<uint8_t>(
+      (clamped * newMaxval + oldMaxval / 2) / oldMaxval
+    );
+  }
+
+  apply_lut(img, lut, numThreads);
+  img.m_maxval = newMaxval;
+}
+
+// Precomputed sampling positions for one axis of a bilinear resample.
+struct BilinearAxis {
+  std::vector<size_t> lo, hi;
+  // weight of `hi` in 1/256ths
+  std::vector<uint32_t> weight;
+
+  BilinearAxis(size_t const srcLen, size_t const dstLen)
+  : lo(dstLen), hi(dstLen), weight(dstLen)
+  {
+    for (size_t i = 0; i < dstLen; ++i) {
+      // align pixel centers
+      double const scale =
+        static_cast<double>(srcLen) / static_cast<double>(dstLen);
+      double const pos = std::clamp(
+        (static_cast<double>(i) + 0.5) * scale - 0.5,
+        0.0,
+        static_cast<double>(srcLen - 1)
+      );
+      lo[i] = static_cast<size_t>(pos);
+      hi[i] = std::min(lo[i] + 1, srcLen - 1);
+      weight[i] = static_cast<uint32_t>(
+        (pos - static_cast<double>(lo[i])) * 256.0 + 0.5
+      );
+    }
+  }
+};
+
+// The row kernels below take everything by value or raw pointer, otherwise
+// every store to `dst` (which may alias anything) forces reloads of captured
+// state and the inner loops slow to a crawl.
+
+// Adds each of the `count` pixels in `row` to the corresponding element of `sums`.
+static
+void accumulate_row(
+  uint32_t *const sums,
+  uint8_t const *const row,
+  size_t const count
+) noexcept {
+  size_t c = 0;
+
+#if PGM8_SSE2
+  __m128i const zero = _mm_setzero_si128();
+  for (; c + 16 <= count; c += 16) {
+    __m128i const px = _mm_loadu_si128(reinterpret_cast<__m128i const *>(row + c));
+    __m128i const lo16 = _mm_unpacklo_epi8(px, zero);
+    __m128i const hi16 = _mm_unpackhi_epi8(px, zero);
+    __m128i const widened[4] {
+      _mm_unpacklo_epi16(lo16, zero),
+      _mm_unpackhi_epi16(lo16, zero),
+      _mm_unpacklo_epi16(hi16, zero),
+      _mm_unpackhi_epi16(hi16, zero),
+    };
+    for (size_t i = 0; i < 4; ++i) {
+      auto *const sum = reinterpret_cast<__m128i *>(sums + c + (i * 4));
+      _mm_storeu_si128(sum, _mm_add_epi32(_mm_loadu_si128(sum), widened[i]));
+    }
+  }
+#endif
+
+  for (; c < count; ++c) {
+    sums[c] += row[c];
+  }
+}
+
+// Box filters destination rows [`begin`, `end`). Source columns
+// [colStart[x], colStart[x + 1]) make up destination column x, `colSums` is
+// scratch space with room for `srcW` elements.
+static
+void box_rows(
+  uint8_t const *const src,
+  size_t const srcW,
+  size_t const srcH,
+  uint8_t *const dst,
+  size_t const dstW,
+  size_t const dstH,
+  size_t const *const colStart,
+  double const *const colRecip,
+  uint32_t *const colSums,
+  size_t const begin,
+  size_t const end
+) noexcept {
+  for (size_t y = begin; y < end; ++y) {
+    size_t const rowStart = y * srcH / dstH;
+    size_t const rowEnd = (y + 1) * srcH / dstH;
+    size_t const rowsCovered = rowEnd - rowStart;
+    double const rowRecip = 1.0 / static_cast<double>(rowsCovered);
+
+    // sum up the source rows first, then the columns within each row
+    std::fill(colSums, colSums + srcW, 0);
+    for (size_t r = rowStart; r < rowEnd; ++r) {
+      accumulate_row(colSums, src + arr2d::get_1d_idx(srcW, 0, r), srcW);
+    }
+
+    uint8_t *const dstRow = dst + arr2d::get_1d_idx(dstW, 0, y);
+    size_t c = 0;
+    for (size_t x = 0; x < dstW; ++x) {
+      size_t const colEnd = colStart[x + 1];
+      uint64_t const area = rowsCovered * (colEnd - c);
+      uint64_t sum = 0;
+      for (; c < colEnd; ++c) {
+        sum += colSums[c];
+      }
+      // multiplying by reciprocals is much cheaper than dividing, the +0.5
+      // keeps the quotient away from integers so rounding error can't matter
+      double const numer = static_cast<double>(sum + area / 2) + 0.5;
+      dstRow[x] = static_cast<uint8_t>(numer * rowRecip * colRecip[x]);
+    }
+  }
+}
+
+// Bilinearly samples destination rows [`begin`, `end`).
+static
+void bilinear_rows(
+  uint8_t const *const src,
+  size_t const srcW,
+  uint8_t *const dst,
+  size_t const dstW,
+  BilinearAxis const &xs,
+  BilinearAxis const &ys,
+  size_t const begin,
+  size_t const end
+) noexcept {
+  size_t const *const xLo = xs.lo.data();
+  size_t const *const xHi = xs.hi.data();
+  uint32_t const *const xWeight = xs.weight.data();
+
+  for (size_t y = begin; y < end; ++y) {
+    uint8_t const *const rowLo = src + arr2d::get_1d_idx(srcW, 0, ys.lo[y]);
+    uint8_t const *const rowHi = src + arr2d::get_1d_idx(srcW, 0, ys.hi[y]);
+    uint32_t const wy = ys.weight[y];
+    uint8_t *const dstRow = dst + arr2d::get_1d_idx(dstW, 0, y);
+
+    for (size_t x = 0; x < dstW; ++x) {
+      uint32_t const wx = xWeight[x];
+      uint32_t const top = rowLo[xLo[x]] * (256 - wx) + rowLo[xHi[x]] * wx;
+      uint32_t const bottom = rowHi[xLo[x]] * (256 - wx) + rowHi[xHi[x]] * wx;
+      dstRow[x] = static_cast<uint8_t>(
+        (top * (256 - wy) + bottom * wy + (1 << 15)) >> 16
+      );
+    }
+  }
+}
+
+Image pgm8::downsample(
+  Image const &img,
+  uint16_t const width,
+  uint16_t const height,
+  Filter const filter,
+  size_t const numThreads
+) {
+  if (img.pixels() == nullptr) {
+    throw std::runtime_error("`img` has no pixels");
+  }
+  if (width < 1 || height < 1) {
+    throw std::runtime_error("`width` and `height` must be > 0");
+  }
+  if (width > img.width() || height > img.height()) {
+    throw std::runtime_error("can't downsample to larger dimensions");
+  }
+
+  Image out(width, height, img.maxval(), img.allocator());
+
+  size_t const srcW = img.width(), srcH = img.height();
+  uint8_t const *const src = img.pixels();
+  uint8_t *const dst = out.pixels();
+
+  size_t const numChunks = num_chunks(
+    height,
+    numThreads,
+    std::max<size_t>(MIN_PIXELS_PER_THREAD / srcW / (srcH / height), 1)
+  );
+
+  switch (filter) {
+    case Filter::BOX: {
+      std::vector<size_t> colStart(width + 1);
+      for (size_t x = 0; x <= width; ++x) {
+        colStart[x] = x * srcW / width;
+      }
+      std::vector<double> colRecip(width);
+      for (size_t x = 0; x < width; ++x) {
+        colRecip[x] = 1.0 / static_cast<double>(colStart[x + 1] - colStart[x]);
+      }
+
+      run_chunks(height, numChunks, [&](size_t const begin, size_t const end, size_t) {
+        std::vector<uint32_t> colSums(srcW);
+        box_rows(
+          src, srcW, srcH, dst, width, height,
+          colStart.data(), colRecip.data(), colSums.data(),
+          begin, end
+        );
+      });
+      break;
+    }
+
+    case Filter::BILINEAR: {
+      BilinearAxis const xs(srcW, width), ys(srcH, height);
+
+      run_chunks(height, numChunks, [&](size_t const begin, size_t const end, size_t) {
+        bilinear_rows(src, srcW, dst, width, xs, ys, begin, end);
+      });
+      break;
+    }
+
+    default: throw std::runtime_error("bad `filter`");
+  }
+
+  return out;
 }
@@ -1,8 +1,48 @@
 #include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <cctype>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <regex>
+#include <span>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#define REGEXGLOB_POSIX 1
+#else
+#define REGEXGLOB_POSIX 0
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <cerrno>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define REGEXGLOB_IO_URING 1
+#else
+#define REGEXGLOB_IO_URING 0
+#endif
+
+#include "../include/cstr.hpp"
+#include "../include/on-scope-exit.hpp"
 #include "../include/regexglob.hpp"
 
 namespace fs = std::filesystem;
@@ -48,73 +88,2906 @@ void regexglob::set_ofstream(std::ofstream *const ofs) {
   s_ofstream = ofs;
 }
 
-std::vector<fs::path> regexglob::fmatch(
-  char const *const root,
-  char const *const filePattern
-) {
-  fs::path const rootDir(root);
-  if (!fs::is_directory(rootDir)) {
-    throw "`root` is not a directory";
+namespace {
+
+using ByteSet = std::bitset<256>;
+
+// Node of a parsed regular expression.
+struct Node {
+  enum class Kind {
+    SET,       // one character out of `set`
+    CONCAT,    // `children` one after another, no children matches empty
+    ALTERNATE, // any one of `children`
+    REPEAT,    // `children[0]` between `min` and `max` times
+  };
+
+  static constexpr size_t UNBOUNDED = SIZE_MAX;
+
+  Kind kind;
+  ByteSet set{};
+  std::vector<Node> children{};
+  size_t min = 0;
+  size_t max = 0;
+};
+
+// Thrown while compiling a pattern the DFA can't handle, `std::regex` takes over.
+struct Unsupported {};
+
+ByteSet byte_range(unsigned const first, unsigned const last) {
+  ByteSet set{};
+  for (unsigned c = first; c <= last; ++c) {
+    set.set(c);
   }
+  return set;
+}
 
-  if (std::strlen(filePattern) == 0) {
-    throw "blank `filePattern`";
+// Matches anything except line terminators, like ECMAScript's `.`.
+ByteSet dot_set() {
+  ByteSet set{};
+  set.set();
+  set.reset('\n');
+  set.reset('\r');
+  return set;
+}
+
+unsigned only_member(ByteSet const &set) {
+  unsigned c = 0;
+  while (!set.test(c)) {
+    ++c;
   }
+  return c;
+}
 
-  std::vector<fs::path> matchedFiles{};
-  std::regex const regex(filePattern);
+ByteSet digit_set() {
+  return byte_range('0', '9');
+}
 
-  if (s_ofstream != nullptr) {
-    *s_ofstream
-      << "<root>: " << root << '\n'
-      << "<file_pattern>: " << filePattern << '\n'
-      << "<files_checked>:\n";
+ByteSet word_set() {
+  return byte_range('a', 'z') | byte_range('A', 'Z') | digit_set() | byte_range('_', '_');
+}
+
+ByteSet space_set() {
+  return byte_range('\t', '\r') | byte_range(' ', ' ');
+}
+
+// Recursive descent parser for the subset of ECMAScript regular expression
+// syntax the DFA supports, throws `Unsupported` for anything else (including
+// invalid syntax, so `std::regex` can report it).
+class Parser {
+public:
+  explicit Parser(std::string_view const regex) : m_re(regex) {}
+
+  Node parse() {
+    // a match always spans the whole name, so leading `^` and trailing `$` are redundant
+    if (!m_re.empty() && m_re.front() == '^') {
+      m_re.remove_prefix(1);
+    }
+    if (!m_re.empty() && m_re.back() == '$') {
+      size_t backslashes = 0;
+      while (backslashes + 1 < m_re.size() && m_re[m_re.size() - 2 - backslashes] == '\\') {
+        ++backslashes;
+      }
+      if (backslashes % 2 == 0) {
+        m_re.remove_suffix(1);
+      }
+    }
+
+    Node node = parse_alternation();
+    if (m_pos != m_re.size()) {
+      throw Unsupported{};
+    }
+    return node;
   }
 
-  for (
-    auto const &entry :
-    fs::recursive_directory_iterator(
-      rootDir,
-      fs::directory_options::skip_permission_denied
-    )
-  ) {
-    // ignore anything that isn't a file or shortcut
-    if (
-      !entry.is_regular_file() &&
-      !entry.is_block_file() &&
-      !entry.is_character_file() &&
-      !entry.is_fifo() &&
-      !entry.is_symlink()
-    ) {
-      continue;
+private:
+  std::string_view m_re;
+  size_t m_pos = 0;
+
+  bool at_end() const noexcept {
+    return m_pos == m_re.size();
+  }
+  char peek() const noexcept {
+    return at_end() ? '\0' : m_re[m_pos];
+  }
+  char next() {
+    if (at_end()) {
+      throw Unsupported{};
     }
+    return m_re[m_pos++];
+  }
 
-    if (s_ofstream != nullptr) {
-      *s_ofstream << "  " << entry.path() << '\n';
+  Node parse_alternation() {
+    Node first = parse_concat();
+    if (peek() != '|') {
+      return first;
     }
 
-    {
-      std::string path = entry.path().string();
-      std::string const fileName = entry.path().filename().string();
-      if (std::regex_match(fileName, regex)) {
-        regexglob::homogenize_path_separators(path, s_prefSep);
-        matchedFiles.emplace_back(path);
+    Node alt{ Node::Kind::ALTERNATE };
+    alt.children.push_back(std::move(first));
+    while (!at_end() && peek() == '|') {
+      ++m_pos;
+      alt.children.push_back(parse_concat());
+    }
+    return alt;
+  }
+
+  Node parse_concat() {
+    Node concat{ Node::Kind::CONCAT };
+    while (!at_end() && peek() != '|' && peek() != ')') {
+      concat.children.push_back(parse_repeat());
+    }
+    return concat;
+  }
+
+  size_t parse_count() {
+    size_t count = 0;
+    size_t digits = 0;
+    while (!at_end() && std::isdigit(static_cast<unsigned char>(peek()))) {
+      count = count * 10 + static_cast<size_t>(next() - '0');
+      // anything bigger would blow up the automaton anyway
+      if (++digits > 4) {
+        throw Unsupported{};
       }
     }
+    if (digits == 0) {
+      throw Unsupported{};
+    }
+    return count;
   }
 
-  if (s_ofstream != nullptr) {
-    *s_ofstream << "<files_matched>:";
-    if (matchedFiles.empty()) {
-      *s_ofstream << " none\n";
+  Node parse_repeat() {
+    Node atom = parse_atom();
+
+    size_t min, max;
+    switch (peek()) {
+      case '*': ++m_pos; min = 0; max = Node::UNBOUNDED; break;
+      case '+': ++m_pos; min = 1; max = Node::UNBOUNDED; break;
+      case '?': ++m_pos; min = 0; max = 1; break;
+      case '{':
+        ++m_pos;
+        min = max = parse_count();
+        if (peek() == ',') {
+          ++m_pos;
+          max = peek() == '}' ? Node::UNBOUNDED : parse_count();
+        }
+        if (next() != '}' || max < min) {
+          throw Unsupported{};
+        }
+        break;
+      default:
+        return atom;
+    }
+
+    // laziness doesn't change whether the whole name matches
+    if (peek() == '?') {
+      ++m_pos;
+    }
+    if (peek() == '*' || peek() == '+' || peek() == '?' || peek() == '{') {
+      throw Unsupported{};
+    }
+
+    Node repeat{ Node::Kind::REPEAT };
+    repeat.children.push_back(std::move(atom));
+    repeat.min = min;
+    repeat.max = max;
+    return repeat;
+  }
+
+  Node parse_atom() {
+    char const c = next();
+    switch (c) {
+      case '(': {
+        if (peek() == '?') {
+          ++m_pos;
+          if (next() != ':') { // lookaheads
+            throw Unsupported{};
+          }
+        }
+        Node group = parse_alternation();
+        if (next() != ')') {
+          throw Unsupported{};
+        }
+        return group;
+      }
+      case '[': return set_node(parse_class());
+      case '.': return set_node(dot_set());
+      case '\\': return set_node(parse_escape(false));
+      case '*': case '+': case '?': case '{': case '}':
+      case ']': case '^': case '$': case '|': case ')':
+        throw Unsupported{};
+      default: return set_node(byte_range(
+        static_cast<unsigned char>(c), static_cast<unsigned char>(c)));
+    }
+  }
+
+  static Node set_node(ByteSet const &set) {
+    Node node{ Node::Kind::SET };
+    node.set = set;
+    return node;
+  }
+
+  static int hex_digit(char const c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    throw Unsupported{};
+  }
+
+  ByteSet parse_escape(bool const inClass) {
+    char const c = next();
+    auto const single = [](unsigned const byte) {
+      return byte_range(byte, byte);
+    };
+
+    switch (c) {
+      case 'd': return digit_set();
+      case 'D': return ~digit_set();
+      case 'w': return word_set();
+      case 'W': return ~word_set();
+      case 's': return space_set();
+      case 'S': return ~space_set();
+      case 't': return single('\t');
+      case 'n': return single('\n');
+      case 'r': return single('\r');
+      case 'f': return single('\f');
+      case 'v': return single('\v');
+      case '0':
+        if (std::isdigit(static_cast<unsigned char>(peek()))) {
+          throw Unsupported{};
+        }
+        return single('\0');
+      case 'x': {
+        int const hi = hex_digit(next());
+        int const lo = hex_digit(next());
+        return single(static_cast<unsigned>(hi * 16 + lo));
+      }
+      default:
+        // backreferences, word boundaries, \c, \u, ...
+        if (std::isalnum(static_cast<unsigned char>(c)) || (inClass && c == '-')) {
+          throw Unsupported{};
+        }
+        return single(static_cast<unsigned char>(c));
+    }
+  }
+
+  // Parses a single class member, sets `isSingle` if it's one character (so it can be a range endpoint).
+  ByteSet parse_class_atom(bool &isSingle) {
+    char const c = next();
+    ByteSet set{};
+    if (c == '\\') {
+      set = parse_escape(true);
+    } else if (c == '[' && (peek() == ':' || peek() == '.' || peek() == '=')) {
+      throw Unsupported{}; // [:alpha:] etc.
     } else {
-      *s_ofstream << '\n';
-      for (auto const &match : matchedFiles) {
-        *s_ofstream << "  " << match << '\n';
+      set.set(static_cast<unsigned char>(c));
+    }
+    isSingle = set.count() == 1;
+    return set;
+  }
+
+  ByteSet parse_class() {
+    bool const negate = peek() == '^';
+    if (negate) {
+      ++m_pos;
+    }
+    // `[]` and `[^]` are special in ECMAScript
+    if (peek() == ']') {
+      throw Unsupported{};
+    }
+
+    ByteSet set{};
+    while (peek() != ']') {
+      bool loIsSingle;
+      ByteSet const lo = parse_class_atom(loIsSingle);
+
+      if (peek() == '-' && m_pos + 1 < m_re.size() && m_re[m_pos + 1] != ']') {
+        ++m_pos;
+        bool hiIsSingle;
+        ByteSet const hi = parse_class_atom(hiIsSingle);
+        if (!loIsSingle || !hiIsSingle) {
+          throw Unsupported{};
+        }
+        unsigned const first = only_member(lo), last = only_member(hi);
+        // non-ASCII endpoints compare as signed chars in std::regex
+        if (first > last || last > 0x7f) {
+          throw Unsupported{};
+        }
+        set |= byte_range(first, last);
+      } else {
+        set |= lo;
       }
     }
-    *s_ofstream << '\n';
+    ++m_pos; // ']'
+
+    return negate ? ~set : set;
   }
+};
 
-  return matchedFiles;
+// Thompson NFA, each state either consumes one character from `set` moving to
+// `next`, or has epsilon transitions to `epsilon`.
+class Nfa {
+public:
+  static constexpr uint32_t NONE = UINT32_MAX;
+  // Bigger NFAs are left to std::regex.
+  static constexpr size_t MAX_STATES = 10'000;
+
+  struct State {
+    ByteSet set{};
+    uint32_t next = NONE;
+    std::vector<uint32_t> epsilon{};
+  };
+
+  // Matching any of `roots`, each with its own accept state.
+  explicit Nfa(std::vector<Node const *> const &roots) {
+    m_start = add_state();
+    for (auto const *const root : roots) {
+      uint32_t const accept = add_state();
+      m_accepts.push_back(accept);
+      uint32_t const rootStart = compile(*root, accept);
+      m_states[m_start].epsilon.push_back(rootStart);
+    }
+  }
+
+  std::vector<State> const &states() const noexcept { return m_states; }
+  uint32_t start() const noexcept { return m_start; }
+  // Accept state of each root.
+  std::vector<uint32_t> const &accepts() const noexcept { return m_accepts; }
+
+private:
+  std::vector<State> m_states{};
+  uint32_t m_start;
+  std::vector<uint32_t> m_accepts{};
+
+  uint32_t add_state() {
+    if (m_states.size() == MAX_STATES) {
+      throw Unsupported{};
+    }
+    m_states.emplace_back();
+    return static_cast<uint32_t>(m_states.size() - 1);
+  }
+
+  // Compiles `node` so that it continues to `next` once matched, returns its start state.
+  uint32_t compile(Node const &node, uint32_t next) {
+    switch (node.kind) {
+      case Node::Kind::SET: {
+        uint32_t const state = add_state();
+        m_states[state].set = node.set;
+        m_states[state].next = next;
+        return state;
+      }
+      case Node::Kind::CONCAT:
+        for (auto it = node.children.rbegin(); it != node.children.rend(); ++it) {
+          next = compile(*it, next);
+        }
+        return next;
+      case Node::Kind::ALTERNATE: {
+        uint32_t const state = add_state();
+        for (auto const &child : node.children) {
+          uint32_t const childStart = compile(child, next);
+          m_states[state].epsilon.push_back(childStart);
+        }
+        return state;
+      }
+      case Node::Kind::REPEAT: {
+        Node const &child = node.children[0];
+        uint32_t start = next;
+        if (node.max == Node::UNBOUNDED) {
+          uint32_t const loop = add_state();
+          uint32_t const body = compile(child, loop);
+          m_states[loop].epsilon = { body, next };
+          start = loop;
+        } else {
+          // x{0,2} is (x(x)?)?
+          for (size_t i = node.min; i < node.max; ++i) {
+            uint32_t const optional = add_state();
+            uint32_t const body = compile(child, start);
+            m_states[optional].epsilon = { body, next };
+            start = optional;
+          }
+        }
+        for (size_t i = 0; i < node.min; ++i) {
+          start = compile(child, start);
+        }
+        return start;
+      }
+    }
+    return next;
+  }
+};
+
+// Flattens nested concatenations (groups) into `out`.
+void flatten_concat(Node const &node, std::vector<Node const *> &out) {
+  if (node.kind == Node::Kind::CONCAT) {
+    for (auto const &child : node.children) {
+      flatten_concat(child, out);
+    }
+  } else {
+    out.push_back(&node);
+  }
+}
+
+bool is_literal_char(Node const *const node) {
+  return node->kind == Node::Kind::SET && node->set.count() == 1;
+}
+
+bool is_dot_star(Node const *const node) {
+  return
+    node->kind == Node::Kind::REPEAT &&
+    node->min == 0 && node->max == Node::UNBOUNDED &&
+    node->children[0].kind == Node::Kind::SET &&
+    node->children[0].set == dot_set();
+}
+
+bool has_line_terminator(std::string_view const str) noexcept {
+  return
+    std::memchr(str.data(), '\n', str.size()) != nullptr ||
+    std::memchr(str.data(), '\r', str.size()) != nullptr;
+}
+
+// Longest run of literal characters every match of `regex` contains, empty if
+// there's none (or `regex` is beyond the parser).
+std::string required_literal(std::string_view const regex) {
+  std::string longest{};
+  try {
+    Node const root = Parser(regex).parse();
+    std::vector<Node const *> items{};
+    flatten_concat(root, items);
+
+    std::string run{};
+    for (auto const *const item : items) {
+      if (is_literal_char(item)) {
+        run += static_cast<char>(only_member(item->set));
+      } else {
+        run.clear();
+      }
+      if (run.size() > longest.size()) {
+        longest = run;
+      }
+    }
+  } catch (Unsupported const &) {
+    longest.clear();
+  }
+  return longest;
+}
+
+// Tables of a DFA built from one or more patterns.
+struct Dfa {
+  std::array<uint8_t, 256> byteClasses{};
+  uint32_t numClasses = 0;
+  uint32_t start = 0;
+  // `numClasses` entries per state, state 0 is dead (no match possible)
+  std::vector<uint32_t> transitions{};
+  // Indices of the patterns each state accepts, ascending.
+  std::vector<std::vector<uint32_t>> accepts{};
+};
+
+// Bigger DFAs are left to std::regex (or, for pattern sets, split up).
+constexpr size_t MAX_DFA_STATES = 4096;
+constexpr size_t MAX_PATTERN_SET_DFA_STATES = 16384;
+
+// Builds a DFA matching any of `roots`, throws `Unsupported` if it would need more than `maxStates` states.
+Dfa build_dfa(std::vector<Node const *> const &roots, size_t const maxStates) {
+  Nfa const nfa(roots);
+  auto const &nfaStates = nfa.states();
+
+  // pattern index of each accept state
+  std::vector<uint32_t> acceptOf(nfaStates.size(), Nfa::NONE);
+  for (size_t i = 0; i < nfa.accepts().size(); ++i) {
+    acceptOf[nfa.accepts()[i]] = static_cast<uint32_t>(i);
+  }
+
+  Dfa dfa{};
+
+  // split bytes into classes no NFA transition tells apart
+  {
+    std::array<uint32_t, 256> classes{};
+    uint32_t numClasses = 1;
+    for (auto const &state : nfaStates) {
+      if (state.next == Nfa::NONE) {
+        continue;
+      }
+      // members of `state.set` move to a new class, then ids are made dense again
+      std::array<uint32_t, 512> renumbered{};
+      renumbered.fill(UINT32_MAX);
+      uint32_t newNumClasses = 0;
+      for (unsigned c = 0; c < 256; ++c) {
+        uint32_t &id = renumbered[classes[c] * 2 + state.set.test(c)];
+        if (id == UINT32_MAX) {
+          id = newNumClasses++;
+        }
+        classes[c] = id;
+      }
+      numClasses = newNumClasses;
+    }
+    dfa.numClasses = numClasses;
+    for (unsigned c = 0; c < 256; ++c) {
+      dfa.byteClasses[c] = static_cast<uint8_t>(classes[c]);
+    }
+  }
+
+  std::vector<unsigned> representatives(dfa.numClasses);
+  for (unsigned c = 256; c-- > 0;) {
+    representatives[dfa.byteClasses[c]] = c;
+  }
+
+  // subset construction
+  using StateSet = std::vector<uint32_t>;
+  auto const closure = [&nfaStates, &acceptOf](StateSet &set) {
+    std::vector<uint32_t> stack(set);
+    std::vector<bool> seen(nfaStates.size(), false);
+    for (uint32_t const s : set) {
+      seen[s] = true;
+    }
+    while (!stack.empty()) {
+      uint32_t const s = stack.back();
+      stack.pop_back();
+      for (uint32_t const t : nfaStates[s].epsilon) {
+        if (!seen[t]) {
+          seen[t] = true;
+          set.push_back(t);
+          stack.push_back(t);
+        }
+      }
+    }
+    // only consuming states and accept states matter for identity
+    set.erase(std::remove_if(set.begin(), set.end(), [&](uint32_t const s) {
+      return nfaStates[s].next == Nfa::NONE && acceptOf[s] == Nfa::NONE;
+    }), set.end());
+    std::sort(set.begin(), set.end());
+    set.erase(std::unique(set.begin(), set.end()), set.end());
+  };
+
+  std::map<StateSet, uint32_t> ids{};
+  std::vector<StateSet> dfaStates{};
+  auto const intern = [&](StateSet &&set) {
+    auto const [it, inserted] = ids.emplace(set, static_cast<uint32_t>(dfaStates.size()));
+    if (inserted) {
+      if (dfaStates.size() == maxStates) {
+        throw Unsupported{};
+      }
+      dfaStates.push_back(std::move(set));
+    }
+    return it->second;
+  };
+
+  intern(StateSet{}); // dead state
+  {
+    StateSet start{ nfa.start() };
+    closure(start);
+    dfa.start = intern(std::move(start));
+  }
+
+  for (size_t i = 0; i < dfaStates.size(); ++i) {
+    for (uint32_t cls = 0; cls < dfa.numClasses; ++cls) {
+      StateSet target{};
+      for (uint32_t const s : dfaStates[i]) {
+        auto const &state = nfaStates[s];
+        if (state.next != Nfa::NONE && state.set.test(representatives[cls])) {
+          target.push_back(state.next);
+        }
+      }
+      closure(target);
+      dfa.transitions.push_back(intern(std::move(target)));
+    }
+  }
+
+  dfa.accepts.resize(dfaStates.size());
+  for (size_t i = 0; i < dfaStates.size(); ++i) {
+    for (uint32_t const s : dfaStates[i]) {
+      if (acceptOf[s] != Nfa::NONE) {
+        dfa.accepts[i].push_back(acceptOf[s]);
+      }
+    }
+    std::sort(dfa.accepts[i].begin(), dfa.accepts[i].end());
+  }
+
+  return dfa;
+}
+
+} // namespace
+
+regexglob::Pattern::Pattern(char const *const regex)
+: m_engine(Engine::STD_REGEX),
+  m_literalKind(LiteralKind::EXACT),
+  m_prefix(),
+  m_suffix(),
+  m_byteClasses(),
+  m_numClasses(0),
+  m_startState(0),
+  m_transitions(),
+  m_accepting(),
+  m_regex()
+{
+  try {
+    Node const root = Parser(regex).parse();
+
+    std::vector<Node const *> items{};
+    flatten_concat(root, items);
+
+    size_t prefixEnd = 0;
+    while (prefixEnd < items.size() && is_literal_char(items[prefixEnd])) {
+      m_prefix += static_cast<char>(only_member(items[prefixEnd]->set));
+      ++prefixEnd;
+    }
+    size_t suffixBegin = items.size();
+    while (suffixBegin > prefixEnd && is_literal_char(items[suffixBegin - 1])) {
+      --suffixBegin;
+      m_suffix.insert(m_suffix.begin(),
+        static_cast<char>(only_member(items[suffixBegin]->set)));
+    }
+
+    // literal fast paths: `lit`, `lit.*`, `.*lit`, `.*lit.*`, `.*`
+    {
+      size_t first = 0, last = items.size();
+      bool const leadingDotStar = first < last && is_dot_star(items[first]);
+      first += leadingDotStar;
+      bool const trailingDotStar = first < last && is_dot_star(items[last - 1]);
+      last -= trailingDotStar;
+
+      std::string literal{};
+      bool allLiteral = true;
+      for (size_t i = first; i < last && allLiteral; ++i) {
+        allLiteral = is_literal_char(items[i]);
+        if (allLiteral) {
+          literal += static_cast<char>(only_member(items[i]->set));
+        }
+      }
+
+      if (allLiteral && !has_line_terminator(literal)) {
+        m_engine = Engine::LITERAL;
+        m_prefix.clear();
+        m_suffix.clear();
+        if (leadingDotStar && trailingDotStar) {
+          m_literalKind = literal.empty() ? LiteralKind::ANY : LiteralKind::CONTAINS;
+          m_prefix = std::move(literal);
+        } else if (leadingDotStar) {
+          m_literalKind = literal.empty() ? LiteralKind::ANY : LiteralKind::SUFFIX;
+          m_suffix = std::move(literal);
+        } else if (trailingDotStar) {
+          m_literalKind = literal.empty() ? LiteralKind::ANY : LiteralKind::PREFIX;
+          m_prefix = std::move(literal);
+        } else {
+          m_literalKind = LiteralKind::EXACT;
+          m_prefix = std::move(literal);
+        }
+        return;
+      }
+    }
+
+    Dfa dfa = build_dfa({ &root }, MAX_DFA_STATES);
+    m_byteClasses = dfa.byteClasses;
+    m_numClasses = dfa.numClasses;
+    m_startState = dfa.start;
+    m_transitions = std::move(dfa.transitions);
+    m_accepting.resize(dfa.accepts.size());
+    for (size_t i = 0; i < dfa.accepts.size(); ++i) {
+      m_accepting[i] = !dfa.accepts[i].empty();
+    }
+
+    m_engine = Engine::DFA;
+  } catch (Unsupported const &) {
+    m_engine = Engine::STD_REGEX;
+    m_prefix.clear();
+    m_suffix.clear();
+    m_transitions.clear();
+    m_accepting.clear();
+    m_regex = std::regex(regex);
+  }
+}
+
+bool regexglob::Pattern::matches(std::string_view const name) const {
+  auto const starts_with = [name](std::string const &lit) {
+    return name.size() >= lit.size() &&
+      std::memcmp(name.data(), lit.data(), lit.size()) == 0;
+  };
+  auto const ends_with = [name](std::string const &lit) {
+    return name.size() >= lit.size() &&
+      std::memcmp(name.data() + name.size() - lit.size(), lit.data(), lit.size()) == 0;
+  };
+
+  switch (m_engine) {
+    case Engine::LITERAL:
+      switch (m_literalKind) {
+        case LiteralKind::EXACT:
+          return name == m_prefix;
+        case LiteralKind::PREFIX:
+          return starts_with(m_prefix) && !has_line_terminator(name);
+        case LiteralKind::SUFFIX:
+          return ends_with(m_suffix) && !has_line_terminator(name);
+        case LiteralKind::CONTAINS:
+          return name.find(m_prefix) != std::string_view::npos && !has_line_terminator(name);
+        case LiteralKind::ANY:
+          return !has_line_terminator(name);
+      }
+      return false;
+
+    case Engine::DFA: {
+      if (
+        name.size() < m_prefix.size() + m_suffix.size() ||
+        !starts_with(m_prefix) ||
+        !ends_with(m_suffix)
+      ) {
+        return false;
+      }
+      uint32_t const *const transitions = m_transitions.data();
+      uint8_t const *const byteClasses = m_byteClasses.data();
+      uint32_t const numClasses = m_numClasses;
+      uint32_t state = m_startState;
+      for (char const c : name) {
+        state = transitions[state * numClasses + byteClasses[static_cast<unsigned char>(c)]];
+        if (state == 0) {
+          return false;
+        }
+      }
+      return m_accepting[state] != 0;
+    }
+
+    case Engine::STD_REGEX:
+      return std::regex_match(name.begin(), name.end(), m_regex);
+  }
+
+  return false;
+}
+
+regexglob::Pattern::Engine regexglob::Pattern::engine() const noexcept {
+  return m_engine;
+}
+
+regexglob::PatternSet::PatternSet(std::vector<std::string> const &regexes)
+: m_size(regexes.size()),
+  m_byteClasses(),
+  m_numClasses(0),
+  m_startState(0),
+  m_transitions(),
+  m_acceptOffsets(),
+  m_acceptIds(),
+  m_separate(),
+  m_separateIds()
+{
+  std::vector<Node> roots{};
+  roots.reserve(regexes.size());
+  std::vector<uint32_t> combinedIds{};
+
+  for (size_t i = 0; i < regexes.size(); ++i) {
+    try {
+      roots.push_back(Parser(regexes[i]).parse());
+      combinedIds.push_back(static_cast<uint32_t>(i));
+    } catch (Unsupported const &) {
+      m_separate.emplace_back(regexes[i].c_str());
+      m_separateIds.push_back(static_cast<uint32_t>(i));
+    }
+  }
+
+  std::vector<Node const *> rootPtrs{};
+  for (auto const &root : roots) {
+    rootPtrs.push_back(&root);
+  }
+
+  Dfa dfa{};
+  try {
+    dfa = build_dfa(rootPtrs, MAX_PATTERN_SET_DFA_STATES);
+  } catch (Unsupported const &) {
+    // combination blew up, match everything one at a time instead
+    for (uint32_t const id : combinedIds) {
+      m_separate.emplace_back(regexes[id].c_str());
+      m_separateIds.push_back(id);
+    }
+    combinedIds.clear();
+    dfa = build_dfa({}, MAX_PATTERN_SET_DFA_STATES);
+  }
+
+  m_byteClasses = dfa.byteClasses;
+  m_numClasses = dfa.numClasses;
+  m_startState = dfa.start;
+  m_transitions = std::move(dfa.transitions);
+
+  m_acceptOffsets.reserve(dfa.accepts.size() + 1);
+  for (auto const &accepts : dfa.accepts) {
+    m_acceptOffsets.push_back(static_cast<uint32_t>(m_acceptIds.size()));
+    for (uint32_t const local : accepts) {
+      m_acceptIds.push_back(combinedIds[local]);
+    }
+  }
+  m_acceptOffsets.push_back(static_cast<uint32_t>(m_acceptIds.size()));
+}
+
+void regexglob::PatternSet::matches(
+  std::string_view const name,
+  std::vector<size_t> &out
+) const {
+  out.clear();
+
+  uint32_t const *const transitions = m_transitions.data();
+  uint8_t const *const byteClasses = m_byteClasses.data();
+  uint32_t const numClasses = m_numClasses;
+  uint32_t state = m_startState;
+  for (char const c : name) {
+    state = transitions[state * numClasses + byteClasses[static_cast<unsigned char>(c)]];
+    if (state == 0) {
+      break;
+    }
+  }
+  out.insert(
+    out.end(),
+    m_acceptIds.begin() + m_acceptOffsets[state],
+    m_acceptIds.begin() + m_acceptOffsets[state + 1]
+  );
+
+  if (!m_separate.empty()) {
+    size_t const numCombined = out.size();
+    for (size_t i = 0; i < m_separate.size(); ++i) {
+      if (m_separate[i].matches(name)) {
+        out.push_back(m_separateIds[i]);
+      }
+    }
+    std::sort(out.begin() + static_cast<std::ptrdiff_t>(numCombined), out.end());
+    std::inplace_merge(
+      out.begin(),
+      out.begin() + static_cast<std::ptrdiff_t>(numCombined),
+      out.end()
+    );
+  }
+}
+
+size_t regexglob::PatternSet::size() const noexcept {
+  return m_size;
+}
+
+size_t regexglob::PatternSet::num_separate() const noexcept {
+  return m_separate.size();
+}
+
+size_t regexglob::PathList::size() const noexcept {
+  return m_entries.size();
+}
+
+bool regexglob::PathList::empty() const noexcept {
+  return m_entries.empty();
+}
+
+std::string_view regexglob::PathList::dir(size_t const i) const noexcept {
+  Dir const &dir = m_dirs[m_entries[i].dir];
+  return std::string_view(m_buffer).substr(dir.offset, dir.length);
+}
+
+std::string_view regexglob::PathList::name(size_t const i) const noexcept {
+  Entry const &entry = m_entries[i];
+  return std::string_view(m_buffer).substr(entry.nameOffset, entry.nameLength);
+}
+
+std::string regexglob::PathList::path(size_t const i) const {
+  std::string_view const dirPart = dir(i);
+  std::string_view const namePart = name(i);
+  std::string path{};
+  path.reserve(dirPart.size() + namePart.size());
+  path += dirPart;
+  path += namePart;
+  return path;
+}
+
+std::vector<fs::path> regexglob::PathList::to_paths() const {
+  std::vector<fs::path> paths{};
+  paths.reserve(size());
+  for (size_t i = 0; i < size(); ++i) {
+    paths.emplace_back(path(i));
+  }
+  return paths;
+}
+
+size_t regexglob::PathList::memory_usage() const noexcept {
+  return
+    m_buffer.capacity() +
+    m_dirs.capacity() * sizeof(Dir) +
+    m_entries.capacity() * sizeof(Entry);
+}
+
+void regexglob::PathList::push_back(
+  std::string_view const dir,
+  std::string_view const name
+) {
+  if (
+    m_dirs.empty() ||
+    m_dirs.back().length != dir.size() ||
+    std::memcmp(m_buffer.data() + m_dirs.back().offset, dir.data(), dir.size()) != 0
+  ) {
+    m_dirs.push_back(Dir{ m_buffer.size(), dir.size() });
+    m_buffer += dir;
+  }
+
+  Entry entry{};
+  entry.dir = static_cast<uint32_t>(m_dirs.size() - 1);
+
+  entry.nameOffset = m_buffer.size();
+  entry.nameLength = static_cast<uint32_t>(name.size());
+  m_buffer += name;
+
+  m_entries.push_back(entry);
+}
+
+void regexglob::PathList::append(PathList const &other) {
+  size_t const bufferBase = m_buffer.size();
+  auto const dirBase = static_cast<uint32_t>(m_dirs.size());
+
+  m_buffer += other.m_buffer;
+  for (Dir dir : other.m_dirs) {
+    dir.offset += bufferBase;
+    m_dirs.push_back(dir);
+  }
+  m_entries.reserve(m_entries.size() + other.m_entries.size());
+  for (Entry entry : other.m_entries) {
+    entry.nameOffset += bufferBase;
+    entry.dir += dirBase;
+    m_entries.push_back(entry);
+  }
+}
+
+// True if `a1` + `a2` < `b1` + `b2`, without concatenating them.
+static
+bool less_concat(
+  std::string_view a1,
+  std::string_view a2,
+  std::string_view b1,
+  std::string_view b2
+) noexcept {
+  for (;;) {
+    if (a1.empty()) {
+      if (a2.empty()) {
+        return !b1.empty() || !b2.empty();
+      }
+      a1 = a2;
+      a2 = {};
+    }
+    if (b1.empty()) {
+      if (b2.empty()) {
+        return false;
+      }
+      b1 = b2;
+      b2 = {};
+    }
+    size_t const n = std::min(a1.size(), b1.size());
+    int const cmp = std::memcmp(a1.data(), b1.data(), n);
+    if (cmp != 0) {
+      return cmp < 0;
+    }
+    a1.remove_prefix(n);
+    b1.remove_prefix(n);
+  }
+}
+
+void regexglob::PathList::sort() {
+  std::string_view const buffer = m_buffer;
+  std::sort(m_entries.begin(), m_entries.end(), [&](Entry const &a, Entry const &b) {
+    Dir const &aDir = m_dirs[a.dir];
+    Dir const &bDir = m_dirs[b.dir];
+    return less_concat(
+      buffer.substr(aDir.offset, aDir.length),
+      buffer.substr(a.nameOffset, a.nameLength),
+      buffer.substr(bDir.offset, bDir.length),
+      buffer.substr(b.nameOffset, b.nameLength)
+    );
+  });
+}
+
+void regexglob::PathList::clear() noexcept {
+  m_buffer.clear();
+  m_dirs.clear();
+  m_entries.clear();
+}
+
+namespace {
+
+enum class EntryType {
+  // Anything `fmatch` considers a file: regular files, block/character
+  // devices, FIFOs and symlinks (which are never followed).
+  FILE,
+  DIRECTORY,
+  OTHER,
+};
+
+} // namespace
+
+// Calls `onEntry(name, type)` for every entry of the directory at `path`
+// (excluding "." and ".."), until it returns false. Returns false if the
+// directory couldn't be opened.
+template <typename OnEntry>
+static
+bool read_dir(std::string const &path, OnEntry const &onEntry) {
+#if REGEXGLOB_POSIX
+  // readdir fetches entries in large batches (getdents64 on Linux), and the
+  // type it reports spares us a stat per entry on most filesystems
+  DIR *const dir = opendir(path.c_str());
+  if (dir == nullptr) {
+    return false;
+  }
+  auto const closeDirOnScopeExit = make_on_scope_exit([dir]() {
+    closedir(dir);
+  });
+
+  while (dirent const *const entry = readdir(dir)) {
+    char const *const name = entry->d_name;
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+      continue;
+    }
+
+    unsigned char type = entry->d_type;
+    if (type == DT_UNKNOWN) {
+      // filesystem doesn't report types
+      struct stat st;
+      if (fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        continue;
+      }
+      type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISSOCK(st.st_mode) ? DT_SOCK : DT_REG;
+    }
+
+    EntryType const kind =
+      type == DT_DIR ? EntryType::DIRECTORY :
+      type == DT_SOCK ? EntryType::OTHER :
+      EntryType::FILE;
+
+    if (!onEntry(std::string_view(name), kind)) {
+      break;
+    }
+  }
+
+  return true;
+#else
+  std::error_code ec{};
+  fs::directory_iterator it(
+    path,
+    fs::directory_options::skip_permission_denied,
+    ec
+  );
+  if (ec) {
+    return false;
+  }
+
+  for (; it != fs::directory_iterator(); it.increment(ec)) {
+    if (ec) {
+      break;
+    }
+    std::string const name = it->path().filename().string();
+    fs::file_status const status = it->symlink_status();
+    EntryType kind = EntryType::OTHER;
+    switch (status.type()) {
+      case fs::file_type::directory: kind = EntryType::DIRECTORY; break;
+      case fs::file_type::regular:
+      case fs::file_type::block:
+      case fs::file_type::character:
+      case fs::file_type::fifo:
+      case fs::file_type::symlink: kind = EntryType::FILE; break;
+      default: break;
+    }
+
+    if (!onEntry(std::string_view(name), kind)) {
+      break;
+    }
+  }
+
+  return true;
+#endif
+}
+
+static
+std::string join_path(std::string const &dir, std::string_view const name) {
+  std::string path{};
+  path.reserve(dir.size() + 1 + name.size());
+  path += dir;
+  if (!path.empty() && path.back() != '/' && path.back() != '\\') {
+    path += s_prefSep;
+  }
+  path += name;
+  return path;
+}
+
+using Clock = std::chrono::steady_clock;
+
+// Per thread counters for `walk`.
+struct WalkStats {
+  size_t dirsRead = 0;
+  size_t dirsSkipped = 0;
+  size_t dirsPruned = 0;
+  size_t filesChecked = 0;
+  // Time spent in `onFile`, and the rest of the time spent reading directories.
+  Clock::duration readTime{};
+  Clock::duration fileTime{};
+};
+
+// Walks the tree under `root` using `numThreads` threads. Calls `onFile(threadIdx, dirPath, name)` for every file directly inside `root` or inside a directory marked `included`, until it returns false. Subdirectories `maxDepth` levels below `root` aren't read, nor are those for which `shouldDescend(threadIdx, dirPath, name, included)` returns false. `included` starts out as the parent's value (false for `root`) and may be set by `shouldDescend`, to mark entire subtrees. Each thread has its own deque of directories to read, it pushes subdirectories it finds onto the back and takes work from the back, when it runs dry it steals from the front of the others. If `onFile` throws, the walk stops and the exception is rethrown. If `stats` isn't null, each thread counts into `stats[threadIdx]`.
+template <typename ShouldDescend, typename OnFile>
+static
+void walk(
+  std::string const &root,
+  size_t numThreads,
+  size_t const maxDepth,
+  ShouldDescend const &shouldDescend,
+  OnFile const &onFile,
+  WalkStats *const stats
+) {
+  numThreads = std::max<size_t>(numThreads, 1);
+
+  struct Dir {
+    std::string path;
+    size_t depth;
+    bool included;
+  };
+
+  struct WorkQueue {
+    std::mutex mutex{};
+    std::deque<Dir> dirs{};
+  };
+
+  std::vector<WorkQueue> queues(numThreads);
+  queues[0].dirs.push_back(Dir{ root, 0, false });
+
+  // directories queued or being read, the walk is over when this hits 0
+  std::atomic<size_t> pending = 1;
+  // directories sitting in the queues
+  std::atomic<size_t> queued = 1;
+  std::atomic<bool> stop = false;
+  std::exception_ptr err = nullptr;
+  std::mutex errMutex{};
+
+  // Threads which run out of work sleep on `wakeUp` (rather than spinning while the others are stuck in slow reads)
+  // until there's something to steal or the walk is over. `idle` lets the busy threads skip the notification when
+  // nobody is waiting.
+  std::mutex idleMutex{};
+  std::condition_variable wakeUp{};
+  std::atomic<size_t> idle = 0;
+
+  auto const wake = [&](bool const all) {
+    if (idle.load() == 0) {
+      return;
+    }
+    {
+      // waiters check their condition while holding the mutex, so it can't change between the check and the wait
+      std::scoped_lock const lock(idleMutex);
+    }
+    if (all) {
+      wakeUp.notify_all();
+    } else {
+      wakeUp.notify_one();
+    }
+  };
+
+  auto const takeWork = [&queues, &queued](size_t const threadIdx, Dir &dir) {
+    {
+      WorkQueue &own = queues[threadIdx];
+      std::scoped_lock const lock(own.mutex);
+      if (!own.dirs.empty()) {
+        dir = std::move(own.dirs.back());
+        own.dirs.pop_back();
+        --queued;
+        return true;
+      }
+    }
+    for (size_t i = 1; i < queues.size(); ++i) {
+      WorkQueue &victim = queues[(threadIdx + i) % queues.size()];
+      std::scoped_lock const lock(victim.mutex);
+      if (!victim.dirs.empty()) {
+        dir = std::move(victim.dirs.front());
+        victim.dirs.pop_front();
+        --queued;
+        return true;
+      }
+    }
+    return false;
+  };
+
+  auto const work = [&](size_t const threadIdx) {
+    Dir dir{};
+    std::vector<Dir> subdirs{};
+
+    while (!stop.load(std::memory_order_relaxed)) {
+      if (!takeWork(threadIdx, dir)) {
+        if (pending.load() == 0) {
+          return;
+        }
+        std::unique_lock lock(idleMutex);
+        ++idle;
+        wakeUp.wait(lock, [&] {
+          return stop.load() || pending.load() == 0 || queued.load() > 0;
+        });
+        --idle;
+        continue;
+      }
+      if (queued.load() > 0) {
+        // pass on the wake up, in case several directories were queued at once
+        wake(false);
+      }
+
+      try {
+        subdirs.clear();
+        bool const descend = dir.depth < maxDepth;
+        WalkStats *const threadStats = stats == nullptr ? nullptr : &stats[threadIdx];
+        Clock::time_point const readStart =
+          threadStats == nullptr ? Clock::time_point() : Clock::now();
+        Clock::duration fileTime{};
+
+        bool const opened = read_dir(dir.path, [&](std::string_view const name, EntryType const type) {
+          if (type == EntryType::DIRECTORY) {
+            bool included = dir.included;
+            if (descend && shouldDescend(threadIdx, dir.path, name, included)) {
+              subdirs.push_back(Dir{ join_path(dir.path, name), dir.depth + 1, included });
+            } else if (threadStats != nullptr) {
+              ++threadStats->dirsPruned;
+            }
+          } else if (type == EntryType::FILE && (dir.depth == 0 || dir.included)) {
+            bool keepGoing;
+            if (threadStats == nullptr) {
+              keepGoing = onFile(threadIdx, dir.path, name);
+            } else {
+              ++threadStats->filesChecked;
+              Clock::time_point const fileStart = Clock::now();
+              keepGoing = onFile(threadIdx, dir.path, name);
+              fileTime += Clock::now() - fileStart;
+            }
+            if (!keepGoing) {
+              stop = true;
+            }
+          }
+          return !stop.load(std::memory_order_relaxed);
+        });
+
+        if (threadStats != nullptr) {
+          ++(opened ? threadStats->dirsRead : threadStats->dirsSkipped);
+          threadStats->readTime += Clock::now() - readStart - fileTime;
+          threadStats->fileTime += fileTime;
+        }
+      } catch (...) {
+        {
+          std::scoped_lock const lock(errMutex);
+          if (err == nullptr) {
+            err = std::current_exception();
+          }
+        }
+        stop = true;
+        wake(true);
+        return;
+      }
+
+      if (!subdirs.empty()) {
+        pending += subdirs.size();
+        {
+          WorkQueue &own = queues[threadIdx];
+          std::scoped_lock const lock(own.mutex);
+          for (auto &subdir : subdirs) {
+            own.dirs.push_back(std::move(subdir));
+          }
+        }
+        queued += subdirs.size();
+        wake(false);
+      }
+      if (--pending == 0 || stop.load()) {
+        wake(true);
+      }
+    }
+  };
+
+  {
+    std::vector<std::thread> threads{};
+    threads.reserve(numThreads - 1);
+    auto const joinThreadsOnScopeExit = make_on_scope_exit([&threads]() {
+      for (auto &t : threads) {
+        t.join();
+      }
+    });
+
+    for (size_t i = 1; i < numThreads; ++i) {
+      threads.emplace_back(work, i);
+    }
+    work(0);
+  }
+
+  if (err != nullptr) {
+    std::rethrow_exception(err);
+  }
+}
+
+static
+void check_root(char const *const root) {
+  fs::path const rootDir(root);
+  if (!fs::is_directory(rootDir)) {
+    throw "`root` is not a directory";
+  }
+}
+
+// Appends `str` to `out` escaped the same way as `std::quoted`, minus the quotes.
+static
+void append_escaped(std::string &out, std::string_view const str) {
+  for (char const c : str) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+    }
+    out += c;
+  }
+}
+
+// Appends `dir` + `name` (joined as by `join_path`) to `out` in double quotes,
+// the same as `std::quoted` would.
+static
+void append_quoted_path(std::string &out, std::string const &dir, std::string_view const name) {
+  out += '"';
+  append_escaped(out, dir);
+  if (!dir.empty() && dir.back() != '/' && dir.back() != '\\') {
+    out += s_prefSep;
+  }
+  append_escaped(out, name);
+  out += '"';
+}
+
+// Writes the "<files_matched>" section of the log (`heading` included) in one go.
+static
+void log_matches(std::string_view const heading, std::vector<fs::path> const &matches) {
+  std::string log(heading);
+  if (matches.empty()) {
+    log += " none\n";
+  } else {
+    log += '\n';
+    for (auto const &match : matches) {
+      log += "  \"";
+      append_escaped(log, match.string());
+      log += "\"\n";
+    }
+  }
+  s_ofstream->write(log.data(), static_cast<std::streamsize>(log.size()));
+}
+
+// Writes the "<files_checked>" section of the log (`traces` being the lines
+// listing the files) and the "<stats>" line.
+static
+void log_walk(std::vector<std::string> const &traces, regexglob::Stats const &stats) {
+  *s_ofstream << "<files_checked>:\n";
+  for (auto const &trace : traces) {
+    s_ofstream->write(trace.data(), static_cast<std::streamsize>(trace.size()));
+  }
+  *s_ofstream
+    << "<stats>: dirs_read=" << stats.dirsRead
+    << " dirs_skipped=" << stats.dirsSkipped
+    << " dirs_pruned=" << stats.dirsPruned
+    << " files_checked=" << stats.filesChecked
+    << " read_ms=" << std::chrono::duration<double, std::milli>(stats.readTime).count()
+    << " match_ms=" << std::chrono::duration<double, std::milli>(stats.matchTime).count()
+    << '\n';
+}
+
+namespace {
+
+// `Options::excludeDirs` and `Options::includeDirs`, compiled.
+class DirFilter {
+public:
+  explicit DirFilter(regexglob::Options const &options) {
+    if (!options.excludeDirs.empty()) {
+      m_exclude.emplace(options.excludeDirs);
+    }
+    if (!options.includeDirs.empty()) {
+      m_include.emplace(options.includeDirs);
+    }
+  }
+
+  // True if every subdirectory of a directory with `included` (see `walk`) is descended into and included, so
+  // `should_descend` needn't be called.
+  bool trivial(bool const included) const noexcept {
+    return !m_exclude.has_value() && included;
+  }
+
+  // Whether to descend into the directory `subject` (its name or relative path) refers to, `included` is as in `walk`:
+  // whether the directory's files are checked. Directories which don't match `includeDirs` are still descended into,
+  // since directories below them might. `matchedPatterns` is scratch space, as in `PatternSet::matches`.
+  bool should_descend(
+    std::string_view const subject,
+    bool &included,
+    std::vector<size_t> &matchedPatterns
+  ) const {
+    if (m_exclude.has_value()) {
+      m_exclude->matches(subject, matchedPatterns);
+      if (!matchedPatterns.empty()) {
+        return false;
+      }
+    }
+    if (!included) {
+      if (m_include.has_value()) {
+        m_include->matches(subject, matchedPatterns);
+        included = !matchedPatterns.empty();
+      } else {
+        included = true;
+      }
+    }
+    return true;
+  }
+
+private:
+  std::optional<regexglob::PatternSet> m_exclude{};
+  std::optional<regexglob::PatternSet> m_include{};
+};
+
+} // namespace
+
+// Walks the tree under `root` (see `walk`) as set out by `options`, logging
+// every file checked. Calls `onFile(threadIdx, dir, name, subject)` for each
+// until it returns false, `subject` is what file patterns should be matched
+// against (the name, or the path relative to `root`).
+template <typename OnFile>
+static
+void walk_files(
+  char const *const root,
+  regexglob::Options const &options,
+  OnFile const &onFile
+) {
+  DirFilter const dirFilter(options);
+
+  std::string rootPath(root);
+  regexglob::homogenize_path_separators(rootPath, s_prefSep);
+
+  // where paths relative to `rootPath` start in paths below it (see `join_path`)
+  size_t const relativeStart =
+    rootPath.size() + (rootPath.empty() || rootPath.back() == s_prefSep ? 0 : 1);
+
+  size_t const numThreads = std::max<size_t>(options.numThreads, 1);
+  // per thread, to avoid reallocating for every file and directory
+  std::vector<std::string> relativePaths(numThreads);
+  std::vector<std::vector<size_t>> matchedPatterns(numThreads);
+
+  // `subject` of `name` in `dir`, stored in `out` if it's a relative path
+  auto const subject_of = [&](
+    std::string const &dir,
+    std::string_view const name,
+    std::string &out
+  ) {
+    if (!options.matchRelativePaths) {
+      return name;
+    }
+    out.clear();
+    if (dir.size() > rootPath.size()) {
+      out.append(dir, relativeStart);
+      out += s_prefSep;
+    }
+    out += name;
+    return std::string_view(out);
+  };
+
+  bool const collectStats = options.stats != nullptr || s_ofstream != nullptr;
+  std::vector<WalkStats> walkStats(collectStats ? numThreads : 0);
+  // written out in one go once the walk is done
+  std::vector<std::string> traces(s_ofstream != nullptr ? numThreads : 0);
+
+  walk(
+    rootPath,
+    numThreads,
+    options.maxDepth,
+    [&](size_t const threadIdx, std::string const &dir, std::string_view const name, bool &included) {
+      if (dirFilter.trivial(included)) {
+        return true;
+      }
+      return dirFilter.should_descend(
+        subject_of(dir, name, relativePaths[threadIdx]),
+        included,
+        matchedPatterns[threadIdx]
+      );
+    },
+    [&](size_t const threadIdx, std::string const &dir, std::string_view const name) {
+      if (s_ofstream != nullptr) {
+        std::string &trace = traces[threadIdx];
+        trace += "  ";
+        append_quoted_path(trace, dir, name);
+        trace += '\n';
+      }
+      std::string_view const subject =
+        subject_of(dir, name, relativePaths[threadIdx]);
+      return onFile(threadIdx, dir, name, subject);
+    },
+    collectStats ? walkStats.data() : nullptr
+  );
+
+  if (!collectStats) {
+    return;
+  }
+
+  regexglob::Stats stats{};
+  for (auto const &threadStats : walkStats) {
+    stats.dirsRead += threadStats.dirsRead;
+    stats.dirsSkipped += threadStats.dirsSkipped;
+    stats.dirsPruned += threadStats.dirsPruned;
+    stats.filesChecked += threadStats.filesChecked;
+    stats.readTime += std::chrono::duration_cast<std::chrono::nanoseconds>(threadStats.readTime);
+    stats.matchTime += std::chrono::duration_cast<std::chrono::nanoseconds>(threadStats.fileTime);
+  }
+  if (options.stats != nullptr) {
+    *options.stats = stats;
+  }
+
+  if (s_ofstream != nullptr) {
+    log_walk(traces, stats);
+  }
+}
+
+// Common part of `fmatch_compact` and `fmatch_each`. Calls
+// `onMatch(threadIdx, dir, name)` for every match (from any of the walking
+// threads, possibly concurrently) until it returns false.
+template <typename OnMatch>
+static
+void match_files(
+  char const *const root,
+  char const *const filePattern,
+  regexglob::Options const &options,
+  OnMatch const &onMatch
+) {
+  check_root(root);
+
+  if (std::strlen(filePattern) == 0) {
+    throw "blank `filePattern`";
+  }
+
+  regexglob::Pattern const pattern(filePattern);
+
+  if (s_ofstream != nullptr) {
+    *s_ofstream
+      << "<root>: " << root << '\n'
+      << "<file_pattern>: " << filePattern << '\n';
+  }
+
+  walk_files(root, options, [&](
+    size_t const threadIdx,
+    std::string const &dir,
+    std::string_view const name,
+    std::string_view const subject
+  ) {
+    if (pattern.matches(subject)) {
+      return onMatch(threadIdx, dir, name);
+    }
+    return true;
+  });
+}
+
+std::vector<fs::path> regexglob::fmatch(
+  char const *const root,
+  char const *const filePattern
+) {
+  return fmatch(root, filePattern, Options{});
+}
+
+std::vector<fs::path> regexglob::fmatch(
+  char const *const root,
+  char const *const filePattern,
+  Options const &options
+) {
+  std::vector<fs::path> const matchedFiles =
+    fmatch_compact(root, filePattern, options).to_paths();
+
+  if (s_ofstream != nullptr) {
+    log_matches("<files_matched>:", matchedFiles);
+    *s_ofstream << '\n';
+  }
+
+  return matchedFiles;
+}
+
+regexglob::PathList regexglob::fmatch_compact(
+  char const *const root,
+  char const *const filePattern,
+  Options const &options
+) {
+  size_t const numThreads = std::max<size_t>(options.numThreads, 1);
+
+  struct ThreadState {
+    PathList matches{};
+    // `dir` of the last match and it with a trailing separator, only
+    // recomputed when a match comes from a different directory
+    std::string lastDir{};
+    std::string lastDirPrefix{};
+  };
+  std::vector<ThreadState> threadStates(numThreads);
+  std::atomic<size_t> numMatches = 0;
+
+  match_files(root, filePattern, options, [&](
+    size_t const threadIdx,
+    std::string const &dir,
+    std::string_view const name
+  ) {
+    bool keepGoing = true;
+    if (options.maxMatches != 0) {
+      size_t const idx = numMatches++;
+      if (idx >= options.maxMatches) {
+        return false;
+      }
+      keepGoing = idx + 1 < options.maxMatches;
+    }
+
+    ThreadState &state = threadStates[threadIdx];
+    if (state.lastDirPrefix.empty() || dir != state.lastDir) {
+      state.lastDir = dir;
+      state.lastDirPrefix = join_path(dir, "");
+    }
+    state.matches.push_back(state.lastDirPrefix, name);
+
+    return keepGoing;
+  });
+
+  PathList matches = std::move(threadStates[0].matches);
+  for (size_t i = 1; i < numThreads; ++i) {
+    matches.append(threadStates[i].matches);
+  }
+
+  if (options.stats != nullptr) {
+    options.stats->matches = matches.size();
+  }
+
+  if (options.sorted) {
+    matches.sort();
+  }
+
+  return matches;
+}
+
+#if REGEXGLOB_POSIX
+static
+fs::file_time_type to_file_time(int64_t const seconds, uint32_t const nanoseconds) {
+  auto const sinceEpoch =
+    std::chrono::seconds(seconds) + std::chrono::nanoseconds(nanoseconds);
+  return std::chrono::file_clock::from_sys(
+    std::chrono::system_clock::time_point(
+      std::chrono::duration_cast<std::chrono::system_clock::duration>(sinceEpoch)
+    )
+  );
+}
+
+static
+fs::file_type to_file_type(unsigned const mode) noexcept {
+  switch (mode & S_IFMT) {
+    case S_IFREG: return fs::file_type::regular;
+    case S_IFDIR: return fs::file_type::directory;
+    case S_IFLNK: return fs::file_type::symlink;
+    case S_IFBLK: return fs::file_type::block;
+    case S_IFCHR: return fs::file_type::character;
+    case S_IFIFO: return fs::file_type::fifo;
+    case S_IFSOCK: return fs::file_type::socket;
+    default: return fs::file_type::unknown;
+  }
+}
+#endif
+
+// Fills in the metadata of `info` with a blocking call.
+static
+void stat_file(std::string const &pathname, regexglob::FileInfo &info) {
+#if REGEXGLOB_POSIX
+  struct stat st;
+  if (lstat(pathname.c_str(), &st) != 0) {
+    return;
+  }
+  info.type = to_file_type(st.st_mode);
+  info.size = static_cast<uint64_t>(st.st_size);
+#if defined(__APPLE__)
+  info.lastWriteTime = to_file_time(st.st_mtimespec.tv_sec, static_cast<uint32_t>(st.st_mtimespec.tv_nsec));
+#else
+  info.lastWriteTime = to_file_time(st.st_mtim.tv_sec, static_cast<uint32_t>(st.st_mtim.tv_nsec));
+#endif
+#else
+  std::error_code ec{};
+  fs::file_status const status = fs::symlink_status(pathname, ec);
+  if (ec || status.type() == fs::file_type::not_found) {
+    return;
+  }
+  info.type = status.type();
+  if (info.type == fs::file_type::regular) {
+    info.size = fs::file_size(pathname, ec);
+    if (ec) {
+      info.size = 0;
+    }
+  }
+  info.lastWriteTime = fs::last_write_time(pathname, ec);
+  if (ec) {
+    info.lastWriteTime = fs::file_time_type{};
+  }
+#endif
+}
+
+// Stats `pathnames[i]` into `infos[i]` for every index, `numThreads` files at
+// a time.
+static
+void stat_files_threads(
+  std::vector<std::string> const &pathnames,
+  std::vector<regexglob::FileInfo> &infos,
+  size_t const numThreads
+) {
+  std::atomic<size_t> nextIdx = 0;
+  auto const work = [&]() {
+    // claim small chunks so a slow file doesn't hold up the rest
+    size_t const chunkSize = 64;
+    for (;;) {
+      size_t const first = nextIdx.fetch_add(chunkSize);
+      if (first >= pathnames.size()) {
+        break;
+      }
+      size_t const last = std::min(first + chunkSize, pathnames.size());
+      for (size_t i = first; i < last; ++i) {
+        stat_file(pathnames[i], infos[i]);
+      }
+    }
+  };
+
+  size_t const numHelpers = std::min(numThreads, (pathnames.size() + 63) / 64);
+  std::vector<std::thread> helpers{};
+  for (size_t i = 1; i < numHelpers; ++i) {
+    helpers.emplace_back(work);
+  }
+  work();
+  for (auto &helper : helpers) {
+    helper.join();
+  }
+}
+
+#if REGEXGLOB_IO_URING
+
+namespace {
+
+// Just enough of an io_uring (see io_uring(7)) to run batches of statx calls,
+// using the raw system calls so we don't depend on liburing.
+class StatxRing {
+public:
+  // Throws if the kernel doesn't support io_uring.
+  explicit StatxRing(unsigned const numEntries) {
+    io_uring_params params{};
+    m_fd = static_cast<int>(syscall(SYS_io_uring_setup, numEntries, &params));
+    if (m_fd < 0) {
+      throw std::runtime_error("io_uring_setup failed");
+    }
+    // the destructor doesn't run if we throw
+    bool ready = false;
+    auto const releaseOnFailure = make_on_scope_exit([this, &ready]() {
+      if (!ready) {
+        release();
+      }
+    });
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool const singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMmap) {
+      m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+
+    m_sqRing = map(m_sqRingSize, IORING_OFF_SQ_RING);
+    m_cqRing = singleMmap ? m_sqRing : map(m_cqRingSize, IORING_OFF_CQ_RING);
+    m_sqes = static_cast<io_uring_sqe *>(
+      map(params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES)
+    );
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+    char *const sq = static_cast<char *>(m_sqRing);
+    m_sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    m_sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    m_sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    m_sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    m_sqEntries = params.sq_entries;
+
+    char *const cq = static_cast<char *>(m_cqRing);
+    m_cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    m_cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    m_cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    ready = true;
+  }
+
+  StatxRing(StatxRing const &) = delete;
+  StatxRing &operator=(StatxRing const &) = delete;
+
+  ~StatxRing() {
+    release();
+  }
+
+  // Number of submissions that can be queued before `submit_and_wait`.
+  [[nodiscard]] unsigned capacity() const noexcept {
+    return m_sqEntries;
+  }
+
+  // Queues an `lstat` of `pathname` into `out`, both must stay valid until
+  // its completion is reaped.
+  void push_statx(char const *const pathname, struct statx *const out, uint64_t const userData) noexcept {
+    unsigned const tail = *m_sqTail;
+    unsigned const idx = tail & m_sqMask;
+    io_uring_sqe &sqe = m_sqes[idx];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_STATX;
+    sqe.fd = AT_FDCWD;
+    sqe.addr = reinterpret_cast<uint64_t>(pathname);
+    sqe.len = STATX_TYPE | STATX_SIZE | STATX_MTIME;
+    sqe.off = reinterpret_cast<uint64_t>(out);
+    sqe.statx_flags = AT_SYMLINK_NOFOLLOW;
+    sqe.user_data = userData;
+    m_sqArray[idx] = idx;
+    __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+  }
+
+  // Submits everything queued and waits for at least `minComplete`
+  // completions. Returns false if the kernel refused.
+  bool submit_and_wait(unsigned const minComplete) noexcept {
+    for (;;) {
+      unsigned const pending = *m_sqTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+      long const ret = syscall(
+        SYS_io_uring_enter, m_fd, pending, minComplete, IORING_ENTER_GETEVENTS, nullptr, 0
+      );
+      if (ret >= 0) {
+        return true;
+      }
+      if (errno != EINTR) {
+        return false;
+      }
+    }
+  }
+
+  // Calls `onCompletion(userData, result)` for every completion available.
+  template <typename OnCompletion>
+  void reap(OnCompletion const &onCompletion) noexcept {
+    unsigned head = *m_cqHead;
+    unsigned const tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      io_uring_cqe const &cqe = m_cqes[head & m_cqMask];
+      onCompletion(cqe.user_data, cqe.res);
+    }
+    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+  }
+
+private:
+  void release() noexcept {
+    if (m_sqes != nullptr) {
+      munmap(m_sqes, m_sqesSize);
+    }
+    if (m_cqRing != nullptr && m_cqRing != m_sqRing) {
+      munmap(m_cqRing, m_cqRingSize);
+    }
+    if (m_sqRing != nullptr) {
+      munmap(m_sqRing, m_sqRingSize);
+    }
+    close(m_fd);
+    m_sqes = nullptr;
+    m_sqRing = m_cqRing = nullptr;
+  }
+
+  void *map(size_t const size, off_t const offset) {
+    void *const ptr = mmap(
+      nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset
+    );
+    if (ptr == MAP_FAILED) {
+      throw std::runtime_error("io_uring mmap failed");
+    }
+    return ptr;
+  }
+
+  int m_fd = -1;
+  void *m_sqRing = nullptr;
+  void *m_cqRing = nullptr;
+  size_t m_sqRingSize = 0;
+  size_t m_cqRingSize = 0;
+  io_uring_sqe *m_sqes = nullptr;
+  size_t m_sqesSize = 0;
+  unsigned *m_sqHead = nullptr;
+  unsigned *m_sqTail = nullptr;
+  unsigned *m_sqArray = nullptr;
+  unsigned m_sqMask = 0;
+  unsigned m_sqEntries = 0;
+  unsigned *m_cqHead = nullptr;
+  unsigned *m_cqTail = nullptr;
+  unsigned m_cqMask = 0;
+  io_uring_cqe *m_cqes = nullptr;
+};
+
+} // namespace
+
+// Stats `pathnames[i]` into `infos[i]` for every index through an io_uring,
+// returns false if io_uring (or its statx) isn't available.
+static
+bool stat_files_io_uring(
+  std::vector<std::string> const &pathnames,
+  std::vector<regexglob::FileInfo> &infos
+) {
+  std::optional<StatxRing> ring{};
+  try {
+    ring.emplace(256);
+  } catch (std::runtime_error const &) {
+    return false;
+  }
+
+  // one buffer per submission slot, reused as completions come back. The
+  // kernel writes into them asynchronously, so they must outlive every
+  // request in flight
+  unsigned const capacity = ring->capacity();
+  std::unique_ptr<struct statx[]> buffers(new struct statx[capacity]);
+  std::vector<unsigned> freeBuffers(capacity);
+  for (unsigned i = 0; i < capacity; ++i) {
+    freeBuffers[i] = capacity - 1 - i;
+  }
+  // `userData` carries the file in the high 32 bits and the buffer in the rest
+  auto const userData = [](size_t const fileIdx, unsigned const bufferIdx) {
+    return (static_cast<uint64_t>(fileIdx) << 32) | bufferIdx;
+  };
+
+  bool supported = true;
+  bool checkedSupport = false;
+  size_t nextIdx = 0;
+  for (;;) {
+    while (supported && nextIdx < pathnames.size() && !freeBuffers.empty()) {
+      unsigned const bufferIdx = freeBuffers.back();
+      freeBuffers.pop_back();
+      ring->push_statx(pathnames[nextIdx].c_str(), &buffers[bufferIdx], userData(nextIdx, bufferIdx));
+      ++nextIdx;
+    }
+    if (freeBuffers.size() == capacity) {
+      break;
+    }
+
+    // waiting for half of what's in flight amortizes the system call without
+    // letting the queue run dry
+    unsigned const numInFlight = capacity - static_cast<unsigned>(freeBuffers.size());
+    if (!ring->submit_and_wait((numInFlight + 1) / 2)) {
+      // can't tell whether what's in flight is done, so leave the buffers to
+      // it and let the caller start over with blocking calls
+      buffers.release();
+      return false;
+    }
+
+    ring->reap([&](uint64_t const data, int const result) {
+      size_t const fileIdx = static_cast<size_t>(data >> 32);
+      unsigned const bufferIdx = static_cast<unsigned>(data & 0xFFFFFFFF);
+      regexglob::FileInfo &info = infos[fileIdx];
+      struct statx const &stx = buffers[bufferIdx];
+
+      if (result == 0) {
+        info.type = to_file_type(stx.stx_mode);
+        info.size = stx.stx_size;
+        info.lastWriteTime = to_file_time(stx.stx_mtime.tv_sec, stx.stx_mtime.tv_nsec);
+        checkedSupport = true;
+      } else if (result == -EINVAL && !checkedSupport) {
+        // kernels before 5.6 don't know IORING_OP_STATX, stop submitting and
+        // wait for the rest to come back
+        supported = false;
+      }
+
+      freeBuffers.push_back(bufferIdx);
+    });
+  }
+
+  return supported;
+}
+
+#endif // REGEXGLOB_IO_URING
+
+std::vector<regexglob::FileInfo> regexglob::fmatch_info(
+  char const *const root,
+  char const *const filePattern,
+  Options const &options,
+  StatMethod const method
+) {
+  PathList const matches = fmatch_compact(root, filePattern, options);
+
+  std::vector<std::string> pathnames{};
+  pathnames.reserve(matches.size());
+  std::vector<FileInfo> infos(matches.size());
+  for (size_t i = 0; i < matches.size(); ++i) {
+    pathnames.push_back(matches.path(i));
+    // `none` marks files not stat'ed yet, anything that fails becomes `not_found`
+    infos[i].type = fs::file_type::none;
+    infos[i].size = 0;
+  }
+
+  bool done = false;
+#if REGEXGLOB_IO_URING
+  // `AUTO` means threads, which were faster on warm caches and io_uring hasn't been measured on cold ones
+  if (method == StatMethod::IO_URING) {
+    done = stat_files_io_uring(pathnames, infos);
+  }
+#else
+  (void)method;
+#endif
+  if (!done) {
+    stat_files_threads(pathnames, infos, std::max<size_t>(options.numThreads, 1));
+  }
+
+  for (size_t i = 0; i < infos.size(); ++i) {
+    if (infos[i].type == fs::file_type::none) {
+      infos[i].type = fs::file_type::not_found;
+    }
+    infos[i].path = std::move(pathnames[i]);
+  }
+
+  return infos;
+}
+
+namespace {
+
+// Finds lines containing a match of a regular expression (like `std::regex_search` on each line).
+class LineSearcher {
+public:
+  explicit LineSearcher(char const *const regex)
+  : m_pattern(wrap(regex).c_str()),
+    m_literal(required_literal(regex))
+  {}
+
+  // Calls `onLine(lineNumber, offset, line)` for each matching line of `text`
+  // until it returns false, `line` excludes the line terminator. Returns false
+  // if `onLine` did.
+  template <typename OnLine>
+  bool search(std::string_view const text, OnLine const &onLine) const {
+    size_t pos = 0; // always the start of a line
+    size_t lineNumber = 1;
+    size_t countedUpTo = 0;
+
+    while (pos < text.size()) {
+      size_t lineStart = pos;
+      if (!m_literal.empty()) {
+        // skip straight to the next line that could match
+        size_t const hit = cstr::find(text, m_literal, pos);
+        if (hit == std::string_view::npos) {
+          return true;
+        }
+        size_t const prevNewline = text.substr(pos, hit - pos).rfind('\n');
+        lineStart = prevNewline == std::string_view::npos ? pos : pos + prevNewline + 1;
+      }
+
+      size_t lineEnd = text.find('\n', lineStart);
+      if (lineEnd == std::string_view::npos) {
+        lineEnd = text.size();
+      }
+
+      lineNumber += count_newlines(text.substr(countedUpTo, lineStart - countedUpTo));
+      countedUpTo = lineStart;
+
+      std::string_view line = text.substr(lineStart, lineEnd - lineStart);
+      if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+      }
+
+      if (m_pattern.matches(line) && !onLine(lineNumber, lineStart, line)) {
+        return false;
+      }
+
+      pos = lineEnd + 1;
+    }
+    return true;
+  }
+
+  static size_t count_newlines(std::string_view text) noexcept {
+    size_t count = 0;
+    while (void const *const newline = std::memchr(text.data(), '\n', text.size())) {
+      ++count;
+      text.remove_prefix(static_cast<size_t>(static_cast<char const *>(newline) - text.data()) + 1);
+    }
+    return count;
+  }
+
+private:
+  regexglob::Pattern m_pattern;
+  // Every matching line contains this, lines without it are skipped without running `m_pattern`.
+  std::string m_literal;
+
+  // Turns a search for `regex` into a full match of a line.
+  static std::string wrap(std::string_view regex) {
+    // anchors can only be moved outside the group when they apply to the whole pattern
+    bool const hasAlternation = regex.find('|') != std::string_view::npos;
+    bool anchoredStart = false, anchoredEnd = false;
+    if (!hasAlternation && !regex.empty() && regex.front() == '^') {
+      anchoredStart = true;
+      regex.remove_prefix(1);
+    }
+    if (!hasAlternation && !regex.empty() && regex.back() == '$') {
+      size_t backslashes = 0;
+      while (backslashes + 1 < regex.size() && regex[regex.size() - 2 - backslashes] == '\\') {
+        ++backslashes;
+      }
+      if (backslashes % 2 == 0) {
+        anchoredEnd = true;
+        regex.remove_suffix(1);
+      }
+    }
+
+    std::string wrapped{};
+    if (!anchoredStart) {
+      wrapped += "[\\s\\S]*";
+    }
+    wrapped += "(?:";
+    wrapped += regex;
+    wrapped += ')';
+    if (!anchoredEnd) {
+      wrapped += "[\\s\\S]*";
+    }
+    return wrapped;
+  }
+};
+
+} // namespace
+
+// Searches the regular file at `pathname` with `searcher`, calling `onLine` as
+// `LineSearcher::search` does. The file is read a chunk of whole lines at a
+// time into `buffer`, so memory use is bounded by the chunk size (or the
+// longest line) and reading stops as soon as `onLine` returns false. Returns
+// false if it isn't a regular file or can't be read.
+template <typename OnLine>
+static
+bool search_file(
+  std::string const &pathname,
+  LineSearcher const &searcher,
+  std::string &buffer,
+  OnLine const &onLine
+) {
+  std::error_code ec{};
+  // FIFOs and devices would block or never end
+  if (!fs::is_regular_file(pathname, ec)) {
+    return false;
+  }
+
+  std::FILE *const file = std::fopen(pathname.c_str(), "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  auto const closeFileOnScopeExit = make_on_scope_exit([file]() {
+    std::fclose(file);
+  });
+
+  size_t constexpr CHUNK_SIZE = 1024 * 1024;
+  // bytes at the start of `buffer` carried over from the last chunk, the
+  // start of a line it didn't finish
+  size_t carried = 0;
+  // lines and bytes before the start of `buffer`
+  size_t linesBefore = 0, bytesBefore = 0;
+
+  for (;;) {
+    buffer.resize(carried + CHUNK_SIZE);
+    size_t const numRead = std::fread(buffer.data() + carried, 1, CHUNK_SIZE, file);
+    bool const atEnd = numRead < CHUNK_SIZE;
+    std::string_view text(buffer.data(), carried + numRead);
+
+    if (!atEnd) {
+      size_t const lastNewline = text.rfind('\n');
+      if (lastNewline == std::string_view::npos) {
+        // a line longer than a chunk, read on until it ends
+        carried = text.size();
+        continue;
+      }
+      text = text.substr(0, lastNewline + 1);
+    }
+
+    bool const keepGoing = searcher.search(text, [&](
+      size_t const lineNumber,
+      size_t const offset,
+      std::string_view const line
+    ) {
+      return onLine(linesBefore + lineNumber, bytesBefore + offset, line);
+    });
+    if (!keepGoing || atEnd) {
+      break;
+    }
+
+    linesBefore += LineSearcher::count_newlines(text);
+    bytesBefore += text.size();
+    carried = carried + numRead - text.size();
+    std::memmove(buffer.data(), buffer.data() + text.size(), carried);
+  }
+
+  return std::ferror(file) == 0;
+}
+
+std::vector<regexglob::LineMatch> regexglob::fsearch(
+  char const *const root,
+  char const *const filePattern,
+  char const *const contentPattern,
+  Options const &options,
+  size_t const maxMatchesPerFile
+) {
+  check_root(root);
+
+  if (std::strlen(filePattern) == 0) {
+    throw "blank `filePattern`";
+  }
+  if (std::strlen(contentPattern) == 0) {
+    throw "blank `contentPattern`";
+  }
+
+  Pattern const pattern(filePattern);
+  LineSearcher const searcher(contentPattern);
+
+  if (s_ofstream != nullptr) {
+    *s_ofstream
+      << "<root>: " << root << '\n'
+      << "<file_pattern>: " << filePattern << '\n'
+      << "<content_pattern>: " << contentPattern << '\n';
+  }
+
+  size_t const numThreads = std::max<size_t>(options.numThreads, 1);
+  struct ThreadState {
+    std::vector<LineMatch> matches{};
+    std::string buffer{};
+  };
+  // the walking threads', then the searcher threads'
+  std::vector<ThreadState> threadStates(2 * numThreads - 1);
+  std::atomic<size_t> numMatches = 0;
+  // also set if a searcher thread throws, to stop everything
+  std::atomic<bool> limitReached = false;
+
+  auto const searchFile = [&](ThreadState &state, std::string const &path) {
+    size_t numFileMatches = 0;
+    search_file(path, searcher, state.buffer, [&](
+      size_t const lineNumber,
+      size_t const offset,
+      std::string_view const line
+    ) {
+      if (options.maxMatches != 0) {
+        size_t const idx = numMatches++;
+        if (idx >= options.maxMatches) {
+          limitReached = true;
+          return false;
+        }
+        if (idx + 1 == options.maxMatches) {
+          limitReached = true;
+        }
+      }
+      state.matches.push_back(LineMatch{ path, lineNumber, offset, std::string(line) });
+      return !limitReached.load() && ++numFileMatches != maxMatchesPerFile;
+    });
+  };
+
+  // With more than one thread, files to search are queued rather than
+  // searched by the thread which found them, so the files of one big
+  // directory are spread over every thread. The queue is drained by
+  // `numThreads - 1` searcher threads, by walking threads whenever it backs
+  // up, and by the calling thread once the walk is over.
+  struct FileQueue {
+    std::mutex mutex{};
+    std::condition_variable changed{};
+    std::deque<std::string> paths{};
+    bool closed = false;
+  } queue{};
+  std::exception_ptr searchErr = nullptr;
+  std::mutex searchErrMutex{};
+
+  // Pops a path into `path`, waiting for one (or the queue to be closed) if `wait`.
+  auto const popFile = [&queue](std::string &path, bool const wait) {
+    std::unique_lock lock(queue.mutex);
+    if (wait) {
+      queue.changed.wait(lock, [&queue] { return !queue.paths.empty() || queue.closed; });
+    }
+    if (queue.paths.empty()) {
+      return false;
+    }
+    path = std::move(queue.paths.front());
+    queue.paths.pop_front();
+    return true;
+  };
+
+  auto const searcherThread = [&](size_t const stateIdx) {
+    std::string path{};
+    while (popFile(path, true)) {
+      if (limitReached.load()) {
+        // just drain the queue
+        continue;
+      }
+      try {
+        searchFile(threadStates[stateIdx], path);
+      } catch (...) {
+        std::scoped_lock const lock(searchErrMutex);
+        if (searchErr == nullptr) {
+          searchErr = std::current_exception();
+        }
+        limitReached = true;
+      }
+    }
+  };
+
+  {
+    std::vector<std::thread> searchers{};
+    searchers.reserve(numThreads - 1);
+    auto const closeQueueOnScopeExit = make_on_scope_exit([&]() {
+      {
+        std::scoped_lock const lock(queue.mutex);
+        queue.closed = true;
+      }
+      queue.changed.notify_all();
+      for (auto &t : searchers) {
+        t.join();
+      }
+    });
+    for (size_t i = 1; i < numThreads; ++i) {
+      searchers.emplace_back(searcherThread, numThreads + i - 1);
+    }
+
+    walk_files(root, options, [&](
+      size_t const threadIdx,
+      std::string const &dir,
+      std::string_view const name,
+      std::string_view const subject
+    ) {
+      if (!pattern.matches(subject)) {
+        return true;
+      }
+
+      std::string path = join_path(dir, name);
+      if (numThreads == 1) {
+        searchFile(threadStates[threadIdx], path);
+        return !limitReached.load();
+      }
+
+      size_t backlog;
+      {
+        std::scoped_lock const lock(queue.mutex);
+        queue.paths.push_back(std::move(path));
+        backlog = queue.paths.size();
+      }
+      queue.changed.notify_one();
+      // the searchers can't keep up, lend a hand
+      if (backlog > numThreads && popFile(path, false)) {
+        searchFile(threadStates[threadIdx], path);
+      }
+      return !limitReached.load();
+    });
+
+    std::string path{};
+    while (popFile(path, false) && !limitReached.load()) {
+      searchFile(threadStates[0], path);
+    }
+  }
+
+  if (searchErr != nullptr) {
+    std::rethrow_exception(searchErr);
+  }
+
+  std::vector<LineMatch> matches = std::move(threadStates[0].matches);
+  for (size_t i = 1; i < threadStates.size(); ++i) {
+    for (auto &match : threadStates[i].matches) {
+      matches.push_back(std::move(match));
+    }
+  }
+
+  if (options.sorted) {
+    std::sort(matches.begin(), matches.end(), [](LineMatch const &a, LineMatch const &b) {
+      return a.path != b.path ? a.path.native() < b.path.native() : a.lineNumber < b.lineNumber;
+    });
+  }
+
+  if (options.stats != nullptr) {
+    options.stats->matches = matches.size();
+  }
+
+  if (s_ofstream != nullptr) {
+    std::string log = "<lines_matched>:";
+    if (matches.empty()) {
+      log += " none\n";
+    } else {
+      log += '\n';
+      for (auto const &match : matches) {
+        log += "  \"";
+        append_escaped(log, match.path.string());
+        log += "\":";
+        log += std::to_string(match.lineNumber);
+        log += ": ";
+        log += match.line;
+        log += '\n';
+      }
+    }
+    log += '\n';
+    s_ofstream->write(log.data(), static_cast<std::streamsize>(log.size()));
+  }
+
+  return matches;
+}
+
+size_t regexglob::fmatch_each(
+  char const *const root,
+  char const *const filePattern,
+  std::function<bool (fs::path const &)> const &onMatch,
+  Options const &options
+) {
+  size_t numMatches = 0;
+  bool stopped = false;
+  std::mutex mutex{};
+
+  match_files(
+    root,
+    filePattern,
+    options,
+    [&](size_t, std::string const &dir, std::string_view const name) {
+      std::scoped_lock const lock(mutex);
+      // another thread may have hit the limit (or been told to stop) while
+      // this one was matching
+      if (stopped) {
+        return false;
+      }
+      ++numMatches;
+      stopped = !onMatch(fs::path(join_path(dir, name))) ||
+        (options.maxMatches != 0 && numMatches >= options.maxMatches);
+      return !stopped;
+    }
+  );
+
+  if (options.stats != nullptr) {
+    options.stats->matches = numMatches;
+  }
+
+  if (s_ofstream != nullptr) {
+    *s_ofstream << "<files_matched>: " << numMatches << "\n\n";
+  }
+
+  return numMatches;
+}
+
+std::vector<std::vector<fs::path>> regexglob::fmatch_multi(
+  char const *const root,
+  std::vector<std::string> const &filePatterns,
+  Options const &options
+) {
+  check_root(root);
+
+  for (auto const &filePattern : filePatterns) {
+    if (filePattern.empty()) {
+      throw "blank `filePattern`";
+    }
+  }
+
+  PatternSet const patterns(filePatterns);
+  size_t const numPatterns = filePatterns.size();
+
+  if (s_ofstream != nullptr) {
+    *s_ofstream << "<root>: " << root << '\n' << "<file_patterns>:\n";
+    for (auto const &filePattern : filePatterns) {
+      *s_ofstream << "  " << filePattern << '\n';
+    }
+  }
+
+  size_t const numThreads = std::max<size_t>(options.numThreads, 1);
+
+  struct ThreadState {
+    std::vector<size_t> matchedPatterns{};
+    std::vector<std::vector<std::string>> matches{};
+  };
+  std::vector<ThreadState> threadStates(numThreads);
+  for (auto &state : threadStates) {
+    state.matches.resize(numPatterns);
+  }
+
+  // only used with `options.maxMatches`
+  std::unique_ptr<std::atomic<size_t>[]> const numMatches(
+    new std::atomic<size_t>[numPatterns]()
+  );
+  std::atomic<size_t> numPatternsSatisfied = 0;
+
+  walk_files(root, options, [&](
+    size_t const threadIdx,
+    std::string const &dir,
+    std::string_view const name,
+    std::string_view const subject
+  ) {
+    ThreadState &state = threadStates[threadIdx];
+    patterns.matches(subject, state.matchedPatterns);
+    if (state.matchedPatterns.empty()) {
+      return true;
+    }
+
+    std::string path = join_path(dir, name);
+    for (size_t const patternIdx : state.matchedPatterns) {
+      if (options.maxMatches != 0) {
+        size_t const idx = numMatches[patternIdx]++;
+        if (idx >= options.maxMatches) {
+          continue;
+        }
+        if (idx + 1 == options.maxMatches) {
+          ++numPatternsSatisfied;
+        }
+      }
+      state.matches[patternIdx].push_back(path);
+    }
+
+    return options.maxMatches == 0 || numPatternsSatisfied.load() < numPatterns;
+  });
+
+  std::vector<std::vector<fs::path>> matchedFiles(numPatterns);
+  if (options.stats != nullptr) {
+    options.stats->matches = 0;
+  }
+
+  for (size_t patternIdx = 0; patternIdx < numPatterns; ++patternIdx) {
+    std::vector<std::string> matches = std::move(threadStates[0].matches[patternIdx]);
+    for (size_t i = 1; i < numThreads; ++i) {
+      for (auto &match : threadStates[i].matches[patternIdx]) {
+        matches.push_back(std::move(match));
+      }
+    }
+
+    if (options.sorted) {
+      std::sort(matches.begin(), matches.end());
+    }
+
+    matchedFiles[patternIdx].assign(matches.begin(), matches.end());
+    if (options.stats != nullptr) {
+      options.stats->matches += matches.size();
+    }
+  }
+
+  if (s_ofstream != nullptr) {
+    for (size_t patternIdx = 0; patternIdx < numPatterns; ++patternIdx) {
+      log_matches(
+        "<files_matched> " + filePatterns[patternIdx] + ':',
+        matchedFiles[patternIdx]
+      );
+    }
+    *s_ofstream << '\n';
+  }
+
+  return matchedFiles;
+}
+
+regexglob::Index::Index(char const *const root)
+: m_root(root),
+  m_dirs()
+{
+  check_root(root);
+}
+
+size_t regexglob::Index::refresh() {
+  constexpr uint32_t NONE = UINT32_MAX;
+  // directories modified this recently might change again within the
+  // timestamp's granularity, they are marked as stale so they get re-read
+  constexpr auto RACY_WINDOW = std::chrono::seconds(2);
+  constexpr int64_t STALE = INT64_MIN;
+
+  std::string rootPath(m_root);
+  homogenize_path_separators(rootPath, s_prefSep);
+
+  struct Task {
+    uint32_t newIdx;
+    uint32_t oldIdx;
+    std::string path;
+  };
+
+  std::vector<Dir> dirs{};
+  dirs.reserve(m_dirs.size());
+  dirs.push_back(Dir{ "", STALE, {}, {} });
+
+  std::vector<Task> stack{};
+  stack.push_back(Task{ 0, m_dirs.empty() ? NONE : 0, rootPath });
+
+  size_t numRead = 0;
+  std::vector<std::pair<std::string, uint32_t>> subdirs{};
+  std::unordered_map<std::string_view, uint32_t> oldSubdirs{};
+
+  while (!stack.empty()) {
+    Task const task = std::move(stack.back());
+    stack.pop_back();
+
+    std::error_code ec{};
+    fs::file_time_type const mtime = fs::last_write_time(task.path, ec);
+    if (ec) {
+      // vanished since its parent was read, left empty
+      continue;
+    }
+    int64_t const ticks = static_cast<int64_t>(mtime.time_since_epoch().count());
+
+    Dir *const old = task.oldIdx == NONE ? nullptr : &m_dirs[task.oldIdx];
+    subdirs.clear();
+
+    if (old != nullptr && old->mtime == ticks) {
+      // unchanged, every old `Dir` is visited at most once so it can be moved from
+      dirs[task.newIdx].mtime = ticks;
+      dirs[task.newIdx].files = std::move(old->files);
+      for (uint32_t const subdirIdx : old->subdirs) {
+        subdirs.emplace_back(m_dirs[subdirIdx].name, subdirIdx);
+      }
+    } else {
+      ++numRead;
+      bool const racy = fs::file_time_type::clock::now() - mtime < RACY_WINDOW;
+      dirs[task.newIdx].mtime = racy ? STALE : ticks;
+
+      std::vector<std::string> files{};
+      read_dir(task.path, [&](std::string_view const name, EntryType const type) {
+        if (type == EntryType::DIRECTORY) {
+          subdirs.emplace_back(name, NONE);
+        } else if (type == EntryType::FILE) {
+          files.emplace_back(name);
+        }
+        return true;
+      });
+      dirs[task.newIdx].files = std::move(files);
+
+      if (old != nullptr) {
+        oldSubdirs.clear();
+        for (uint32_t const subdirIdx : old->subdirs) {
+          oldSubdirs.emplace(m_dirs[subdirIdx].name, subdirIdx);
+        }
+        for (auto &[name, oldIdx] : subdirs) {
+          auto const it = oldSubdirs.find(name);
+          if (it != oldSubdirs.end()) {
+            oldIdx = it->second;
+          }
+        }
+      }
+    }
+
+    for (auto &[name, oldIdx] : subdirs) {
+      auto const newIdx = static_cast<uint32_t>(dirs.size());
+      std::string path = join_path(task.path, name);
+      dirs.push_back(Dir{ std::move(name), STALE, {}, {} });
+      dirs[task.newIdx].subdirs.push_back(newIdx);
+      stack.push_back(Task{ newIdx, oldIdx, std::move(path) });
+    }
+  }
+
+  m_dirs = std::move(dirs);
+  return numRead;
+}
+
+// Index file layout, integers are native endian:
+//   "RGIX", u32 version, u32 root length, root, u32 dir count, then per dir:
+//   u32 name length, name, i64 mtime, u32 file count, per file: u32 length,
+//   name, u32 subdir count, u32 subdir indices
+static constexpr char INDEX_MAGIC[4] = { 'R', 'G', 'I', 'X' };
+static constexpr uint32_t INDEX_VERSION = 1;
+
+void regexglob::Index::save(char const *const pathname) const {
+  std::string buffer{};
+
+  auto const put = [&buffer](auto const value) {
+    char bytes[sizeof(value)];
+    std::memcpy(bytes, &value, sizeof(value));
+    buffer.append(bytes, sizeof(value));
+  };
+  auto const put_string = [&](std::string const &str) {
+    put(static_cast<uint32_t>(str.size()));
+    buffer += str;
+  };
+
+  buffer.append(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  put(INDEX_VERSION);
+  put_string(m_root);
+  put(static_cast<uint32_t>(m_dirs.size()));
+  for (auto const &dir : m_dirs) {
+    put_string(dir.name);
+    put(dir.mtime);
+    put(static_cast<uint32_t>(dir.files.size()));
+    for (auto const &file : dir.files) {
+      put_string(file);
+    }
+    put(static_cast<uint32_t>(dir.subdirs.size()));
+    for (uint32_t const subdirIdx : dir.subdirs) {
+      put(subdirIdx);
+    }
+  }
+
+  std::ofstream file(pathname, std::ios::binary);
+  if (!file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()))) {
+    throw std::runtime_error("failed to write index");
+  }
+}
+
+bool regexglob::Index::load(char const *const pathname) {
+  m_dirs.clear();
+
+  std::ifstream file(pathname, std::ios::binary | std::ios::ate);
+  if (!file) {
+    return false;
+  }
+  std::string buffer(static_cast<size_t>(file.tellg()), '\0');
+  file.seekg(0);
+  if (!file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()))) {
+    return false;
+  }
+
+  size_t pos = 0;
+  bool ok = true;
+  auto const get = [&](auto &value) {
+    if (buffer.size() - pos < sizeof(value)) {
+      ok = false;
+      return;
+    }
+    std::memcpy(&value, buffer.data() + pos, sizeof(value));
+    pos += sizeof(value);
+  };
+  auto const get_string = [&](std::string &str) {
+    uint32_t size = 0;
+    get(size);
+    if (!ok || buffer.size() - pos < size) {
+      ok = false;
+      return;
+    }
+    str.assign(buffer, pos, size);
+    pos += size;
+  };
+
+  if (buffer.size() < sizeof(INDEX_MAGIC) ||
+      std::memcmp(buffer.data(), INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) {
+    return false;
+  }
+  pos = sizeof(INDEX_MAGIC);
+
+  uint32_t version = 0;
+  get(version);
+  std::string root{};
+  get_string(root);
+  uint32_t numDirs = 0;
+  get(numDirs);
+  if (!ok || version != INDEX_VERSION || root != m_root) {
+    return false;
+  }
+
+  // name length, mtime, file count and subdir count, so a corrupt count can't make us allocate more than the file
+  size_t constexpr MIN_DIR_SIZE = 4 + 8 + 4 + 4;
+  if (numDirs > (buffer.size() - pos) / MIN_DIR_SIZE) {
+    return false;
+  }
+
+  std::vector<Dir> dirs(numDirs);
+  // each directory must have a single parent, otherwise `refresh` and `fmatch` would visit it more than once
+  std::vector<bool> hasParent(numDirs, false);
+  for (auto &dir : dirs) {
+    get_string(dir.name);
+    get(dir.mtime);
+    uint32_t numFiles = 0;
+    get(numFiles);
+    for (uint32_t i = 0; ok && i < numFiles; ++i) {
+      get_string(dir.files.emplace_back());
+    }
+    uint32_t numSubdirs = 0;
+    get(numSubdirs);
+    for (uint32_t i = 0; ok && i < numSubdirs; ++i) {
+      uint32_t subdirIdx = 0;
+      get(subdirIdx);
+      // subdirectories always come after their parent, which rules out cycles
+      ok = ok && subdirIdx > static_cast<uint32_t>(&dir - dirs.data()) && subdirIdx < numDirs
+        && !hasParent[subdirIdx];
+      if (ok) {
+        hasParent[subdirIdx] = true;
+        dir.subdirs.push_back(subdirIdx);
+      }
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+
+  if (pos != buffer.size()) {
+    return false;
+  }
+
+  m_dirs = std::move(dirs);
+  return true;
+}
+
+std::vector<fs::path> regexglob::Index::fmatch(
+  char const *const filePattern,
+  Options const &options
+) const {
+  if (std::strlen(filePattern) == 0) {
+    throw "blank `filePattern`";
+  }
+
+  Pattern const pattern(filePattern);
+  DirFilter const dirFilter(options);
+
+  if (s_ofstream != nullptr) {
+    *s_ofstream
+      << "<root>: " << m_root << '\n'
+      << "<file_pattern>: " << filePattern << '\n';
+  }
+
+  // nothing is read, so everything counts as matching time
+  Stats stats{};
+  Clock::time_point const start = Clock::now();
+  std::string trace{};
+
+  std::vector<std::string> matches{};
+  std::string rootPath(m_root);
+  homogenize_path_separators(rootPath, s_prefSep);
+
+  struct Task {
+    uint32_t idx;
+    std::string path;
+    std::string relativePath;
+    size_t depth;
+    bool included;
+  };
+
+  auto const relative_path = [](std::string const &parent, std::string_view const name) {
+    std::string path = parent;
+    if (!path.empty()) {
+      path += s_prefSep;
+    }
+    path += name;
+    return path;
+  };
+
+  std::vector<Task> stack{};
+  if (!m_dirs.empty()) {
+    stack.push_back(Task{ 0, rootPath, "", 0, false });
+  }
+  std::string relativePath{};
+  std::vector<size_t> matchedPatterns{};
+
+  while (!stack.empty()) {
+    Task const task = std::move(stack.back());
+    stack.pop_back();
+    Dir const &dir = m_dirs[task.idx];
+    // same as `walk`, only the files of the root and included directories are checked
+    std::span<std::string const> const files = task.depth == 0 || task.included
+      ? std::span<std::string const>(dir.files)
+      : std::span<std::string const>();
+
+    for (auto const &file : files) {
+      ++stats.filesChecked;
+      if (s_ofstream != nullptr) {
+        trace += "  ";
+        append_quoted_path(trace, task.path, file);
+        trace += '\n';
+      }
+      std::string_view subject = file;
+      if (options.matchRelativePaths) {
+        relativePath = relative_path(task.relativePath, file);
+        subject = relativePath;
+      }
+      if (pattern.matches(subject)) {
+        matches.push_back(join_path(task.path, file));
+        if (options.maxMatches != 0 && matches.size() == options.maxMatches) {
+          stack.clear();
+          break;
+        }
+      }
+    }
+
+    bool const full = options.maxMatches != 0 && matches.size() == options.maxMatches;
+    if (full) {
+      continue;
+    }
+    if (task.depth >= options.maxDepth) {
+      stats.dirsPruned += dir.subdirs.size();
+      continue;
+    }
+
+    for (uint32_t const subdirIdx : dir.subdirs) {
+      Dir const &subdir = m_dirs[subdirIdx];
+      std::string subdirRelativePath = relative_path(task.relativePath, subdir.name);
+      bool included = task.included;
+      if (!dirFilter.trivial(included)) {
+        std::string_view const subject = options.matchRelativePaths
+          ? std::string_view(subdirRelativePath)
+          : std::string_view(subdir.name);
+        if (!dirFilter.should_descend(subject, included, matchedPatterns)) {
+          ++stats.dirsPruned;
+          continue;
+        }
+      }
+      stack.push_back(Task{
+        subdirIdx,
+        join_path(task.path, subdir.name),
+        std::move(subdirRelativePath),
+        task.depth + 1,
+        included,
+      });
+    }
+  }
+
+  if (options.sorted) {
+    std::sort(matches.begin(), matches.end());
+  }
+
+  std::vector<fs::path> matchedFiles(matches.begin(), matches.end());
+
+  stats.matches = matchedFiles.size();
+  stats.matchTime = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+  if (options.stats != nullptr) {
+    *options.stats = stats;
+  }
+
+  if (s_ofstream != nullptr) {
+    log_walk({ trace }, stats);
+    log_matches("<files_matched>:", matchedFiles);
+    *s_ofstream << '\n';
+  }
+
+  return matchedFiles;
+}
+
+size_t regexglob::Index::num_dirs() const noexcept {
+  return m_dirs.size();
+}
+
+size_t regexglob::Index::num_files() const noexcept {
+  size_t count = 0;
+  for (auto const &dir : m_dirs) {
+    count += dir.files.size();
+  }
+  return count;
 }
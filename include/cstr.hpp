@@ -1,25 +1,480 @@
 #ifndef CPPLIB_CSTR_HPP
 #define CPPLIB_CSTR_HPP
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define CSTR_X86 1
+#else
+#define CSTR_X86 0
+#endif
+
+#if CSTR_X86 && defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+// MSVC lets any function use any instruction set, so the kernels need no attributes.
+#define CSTR_BLOCK_READ
+#define CSTR_BLOCK_READ_AVX2
+#define CSTR_KERNEL
+#define CSTR_KERNEL_AVX2
+#elif CSTR_X86
+// Block reads may extend past either end of the string (but never into another page), so like the libc
+// functions they replace they're exempt from AddressSanitizer, and the kernels are kept out of line, where
+// the compiler can't see (and warn about) the bounds of the caller's array.
+#define CSTR_BLOCK_READ __attribute__((no_sanitize_address))
+#define CSTR_BLOCK_READ_AVX2 __attribute__((target("avx2"), no_sanitize_address))
+#define CSTR_KERNEL __attribute__((noinline, flatten, no_sanitize_address))
+#define CSTR_KERNEL_AVX2 __attribute__((target("avx2"), noinline, flatten, no_sanitize_address))
+#endif
 
 // Module for working with C-style strings. Includes constexpr alternatives to some standard functions.
+// At run time, `cmp`, `len`, `count`, `remove_spaces`, `find` and `find_icase` process 16 (SSE2) or 32 (AVX2,
+// if the CPU has it) bytes at a time on x86-64. In constant expressions they fall back to plain loops.
 namespace cstr {
 
+namespace detail {
+
+// Same as `std::isspace` in the "C" locale, but usable in constant expressions.
+constexpr
+bool is_space(char const c) noexcept {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+constexpr
+bool is_alpha(char const c) noexcept {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+// ASCII only, like `std::tolower` in the "C" locale.
+constexpr
+char to_lower(char const c) noexcept {
+  return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+// True if the `length` characters at `s1` and `s2` are the same, ignoring ASCII case.
+constexpr
+bool equal_icase(char const *const s1, char const *const s2, size_t const length) noexcept {
+  for (size_t i = 0; i < length; ++i) {
+    if (to_lower(s1[i]) != to_lower(s2[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#if CSTR_X86
+
+// Instruction set traits for the SIMD kernels. Each function loads one block and returns a bitmask with a
+// bit per byte, masks are returned rather than vectors so the AVX2 ones can be called from code compiled
+// for the baseline instruction set.
+struct Sse2 {
+  static constexpr size_t WIDTH = 16;
+  static constexpr uint32_t FULL = 0xFFFF;
+
+  CSTR_BLOCK_READ
+  static uint32_t zero_mask(char const *const block) noexcept {
+    __m128i const v = _mm_load_si128(reinterpret_cast<__m128i const *>(block));
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())));
+  }
+
+  CSTR_BLOCK_READ
+  static uint32_t eq_mask(char const *const block, char const c) noexcept {
+    __m128i const v = _mm_load_si128(reinterpret_cast<__m128i const *>(block));
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c))));
+  }
+
+  // Bytes which equal `c` once ORed with `fold`, at `p` which doesn't need to be aligned. A `fold` of 0x20
+  // makes an uppercase ASCII letter match the lowercase `c`.
+  CSTR_BLOCK_READ
+  static uint32_t eq_mask_unaligned(char const *const p, char const c, char const fold) noexcept {
+    __m128i const v = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<__m128i const *>(p)), _mm_set1_epi8(fold));
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c))));
+  }
+
+  // Bytes matching `is_space`: ' ' or '\t'..'\r'.
+  CSTR_BLOCK_READ
+  static uint32_t space_mask(char const *const block) noexcept {
+    __m128i const v = _mm_load_si128(reinterpret_cast<__m128i const *>(block));
+    __m128i const fromTab = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    __m128i const isCtrl = _mm_cmpeq_epi8(_mm_min_epu8(fromTab, _mm_set1_epi8(4)), fromTab);
+    __m128i const isBlank = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(isCtrl, isBlank)));
+  }
+
+  // Bytes where `s1` and `s2` differ or `s1` ends, neither needs to be aligned.
+  CSTR_BLOCK_READ
+  static uint32_t stop_mask(char const *const s1, char const *const s2) noexcept {
+    __m128i const a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(s1));
+    __m128i const b = _mm_loadu_si128(reinterpret_cast<__m128i const *>(s2));
+    uint32_t const same = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)));
+    uint32_t const end = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(a, _mm_setzero_si128())));
+    return (~same | end) & FULL;
+  }
+
+  // True if any of the 4 blocks starting at `block` contains a NUL.
+  CSTR_BLOCK_READ
+  static bool has_zero_x4(char const *const block) noexcept {
+    auto const v = reinterpret_cast<__m128i const *>(block);
+    __m128i const min = _mm_min_epu8(_mm_min_epu8(_mm_load_si128(v), _mm_load_si128(v + 1)),
+      _mm_min_epu8(_mm_load_si128(v + 2), _mm_load_si128(v + 3)));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(min, _mm_setzero_si128())) != 0;
+  }
+
+  // Copies an aligned block to `dest`, which doesn't need to be aligned and may overlap it.
+  CSTR_BLOCK_READ
+  static void copy_block(char *const dest, char const *const block) noexcept {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dest), _mm_load_si128(reinterpret_cast<__m128i const *>(block)));
+  }
+
+  // Copies the bytes of an aligned block selected by `keep` to `dest` in order, returns the end of the
+  // copy. `dest` must not be after `block`, and may be written up to `block + WIDTH`.
+  CSTR_BLOCK_READ
+  static char *compress_block(char *dest, char const *const block, uint32_t keep) noexcept {
+    for (; keep != 0; keep &= keep - 1) {
+      *dest++ = block[std::countr_zero(keep)];
+    }
+    return dest;
+  }
+};
+
+// `_mm_shuffle_epi8` controls which move the bytes selected by an 8-bit mask to the front of 8 bytes.
+inline constexpr auto COMPRESS_SHUFFLES = [] {
+  std::array<uint64_t, 256> shuffles{};
+  for (unsigned mask = 0; mask < 256; ++mask) {
+    unsigned out = 0;
+    for (unsigned i = 0; i < 8; ++i) {
+      if (mask & (1u << i)) {
+        shuffles[mask] |= static_cast<uint64_t>(i) << (8 * out++);
+      }
+    }
+  }
+  return shuffles;
+}();
+
+struct Avx2 {
+  static constexpr size_t WIDTH = 32;
+  static constexpr uint32_t FULL = 0xFFFFFFFF;
+
+  CSTR_BLOCK_READ_AVX2
+  static uint32_t zero_mask(char const *const block) noexcept {
+    __m256i const v = _mm256_load_si256(reinterpret_cast<__m256i const *>(block));
+    return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256())));
+  }
+
+  CSTR_BLOCK_READ_AVX2
+  static uint32_t eq_mask(char const *const block, char const c) noexcept {
+    __m256i const v = _mm256_load_si256(reinterpret_cast<__m256i const *>(block));
+    return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))));
+  }
+
+  CSTR_BLOCK_READ_AVX2
+  static uint32_t eq_mask_unaligned(char const *const p, char const c, char const fold) noexcept {
+    __m256i const v = _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(p)), _mm256_set1_epi8(fold));
+    return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))));
+  }
+
+  CSTR_BLOCK_READ_AVX2
+  static uint32_t space_mask(char const *const block) noexcept {
+    __m256i const v = _mm256_load_si256(reinterpret_cast<__m256i const *>(block));
+    __m256i const fromTab = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+    __m256i const isCtrl = _mm256_cmpeq_epi8(_mm256_min_epu8(fromTab, _mm256_set1_epi8(4)), fromTab);
+    __m256i const isBlank = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(isCtrl, isBlank)));
+  }
+
+  CSTR_BLOCK_READ_AVX2
+  static uint32_t stop_mask(char const *const s1, char const *const s2) noexcept {
+    __m256i const a = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(s1));
+    __m256i const b = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(s2));
+    uint32_t const same = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)));
+    uint32_t const end = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, _mm256_setzero_si256())));
+    return ~same | end;
+  }
+
+  CSTR_BLOCK_READ_AVX2
+  static bool has_zero_x4(char const *const block) noexcept {
+    auto const v = reinterpret_cast<__m256i const *>(block);
+    __m256i const min = _mm256_min_epu8(_mm256_min_epu8(_mm256_load_si256(v), _mm256_load_si256(v + 1)),
+      _mm256_min_epu8(_mm256_load_si256(v + 2), _mm256_load_si256(v + 3)));
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(min, _mm256_setzero_si256())) != 0;
+  }
+
+  CSTR_BLOCK_READ_AVX2
+  static void copy_block(char *const dest, char const *const block) noexcept {
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest), _mm256_load_si256(reinterpret_cast<__m256i const *>(block)));
+  }
+
+  // Compacts each 8 bytes with a table lookup and a shuffle, writing all 8 and advancing by the number kept.
+  CSTR_BLOCK_READ_AVX2
+  static char *compress_block(char *dest, char const *const block, uint32_t const keep) noexcept {
+    __m256i const v = _mm256_load_si256(reinterpret_cast<__m256i const *>(block));
+    __m128i const halves[2] = { _mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1) };
+    for (unsigned h = 0; h < 2; ++h) {
+      unsigned const lo = (keep >> (16 * h)) & 0xFF, hi = (keep >> (16 * h + 8)) & 0xFF;
+      __m128i const control = _mm_set_epi64x(
+        static_cast<long long>(COMPRESS_SHUFFLES[hi] + 0x0808080808080808),
+        static_cast<long long>(COMPRESS_SHUFFLES[lo]));
+      __m128i const packed = _mm_shuffle_epi8(halves[h], control);
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(dest), packed);
+      dest += std::popcount(lo);
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(dest), _mm_unpackhi_epi64(packed, packed));
+      dest += std::popcount(hi);
+    }
+    return dest;
+  }
+};
+
+// Aligned blocks never straddle a page, so reading all of the block containing a string's NUL can't fault
+// even when the NUL is the last byte of the string's allocation.
+template <typename Isa>
+char const *align_down(char const *const p) noexcept {
+  return reinterpret_cast<char const *>(reinterpret_cast<uintptr_t>(p) & ~static_cast<uintptr_t>(Isa::WIDTH - 1));
+}
+
+// Mask of the bytes of `str`'s first block which belong to `str`.
+template <typename Isa>
+uint32_t head_mask(char const *const str, char const *const block) noexcept {
+  return (Isa::FULL << static_cast<unsigned>(str - block)) & Isa::FULL;
+}
+
+// Bits below the lowest set bit of `mask`, which must not be 0.
+inline
+uint32_t below_lowest(uint32_t const mask) noexcept {
+  return (mask & (0u - mask)) - 1;
+}
+
+template <typename Isa>
+size_t len_simd(char const *const str) noexcept {
+  char const *block = align_down<Isa>(str);
+  uint32_t zeros = Isa::zero_mask(block) & head_mask<Isa>(str, block);
+  while (zeros == 0) {
+    block += Isa::WIDTH;
+    // Once aligned to 4 blocks (which still never straddle a page), check 4 at a time.
+    if ((reinterpret_cast<uintptr_t>(block) & (4 * Isa::WIDTH - 1)) == 0) {
+      while (!Isa::has_zero_x4(block)) {
+        block += 4 * Isa::WIDTH;
+      }
+    }
+    zeros = Isa::zero_mask(block);
+  }
+  return static_cast<size_t>(block - str) + static_cast<size_t>(std::countr_zero(zeros));
+}
+
+template <typename Isa>
+size_t count_simd(char const *const str, char const c) noexcept {
+  char const *block = align_down<Isa>(str);
+  uint32_t valid = head_mask<Isa>(str, block);
+  size_t total = 0;
+  for (;;) {
+    uint32_t const zeros = Isa::zero_mask(block) & valid;
+    uint32_t matches = Isa::eq_mask(block, c) & valid;
+    if (zeros != 0) {
+      matches &= below_lowest(zeros);
+      return total + static_cast<size_t>(std::popcount(matches));
+    }
+    total += static_cast<size_t>(std::popcount(matches));
+    block += Isa::WIDTH;
+    valid = Isa::FULL;
+  }
+}
+
+// True if an unaligned block read at `p` could cross into the next page.
+template <typename Isa>
+bool near_page_end(char const *const p) noexcept {
+  return (reinterpret_cast<uintptr_t>(p) & 4095) > 4096 - Isa::WIDTH;
+}
+
+template <typename Isa>
+int cmp_simd(char const *const s1, char const *const s2) noexcept {
+  // The strings are rarely aligned the same way, so blocks are read unaligned, and byte by byte
+  // whenever a block would cross a page boundary in either string.
+  size_t i = 0;
+  for (;;) {
+    if (near_page_end<Isa>(s1 + i) || near_page_end<Isa>(s2 + i)) {
+      for (size_t const end = i + Isa::WIDTH; i < end; ++i) {
+        auto const a = static_cast<unsigned char>(s1[i]), b = static_cast<unsigned char>(s2[i]);
+        if (a != b || a == '\0') {
+          return a - b;
+        }
+      }
+      continue;
+    }
+    uint32_t const stop = Isa::stop_mask(s1 + i, s2 + i);
+    if (stop != 0) {
+      i += static_cast<size_t>(std::countr_zero(stop));
+      return static_cast<unsigned char>(s1[i]) - static_cast<unsigned char>(s2[i]);
+    }
+    i += Isa::WIDTH;
+  }
+}
+
+template <typename Isa>
+void remove_spaces_simd(char *const str) noexcept {
+  char *dest = str;
+  char const *block = align_down<Isa>(str);
+  uint32_t valid = head_mask<Isa>(str, block);
+  for (;;) {
+    uint32_t const zeros = Isa::zero_mask(block) & valid;
+    uint32_t const spaces = Isa::space_mask(block) & valid;
+    if ((zeros | spaces) == 0 && valid == Isa::FULL) {
+      // Nothing to remove, which is most blocks of most strings. Until the first space `dest` is the
+      // block itself, so there's nothing to copy either.
+      if (dest != block) {
+        Isa::copy_block(dest, block);
+      }
+      dest += Isa::WIDTH;
+    } else if (zeros == 0 && valid == Isa::FULL) {
+      dest = Isa::compress_block(dest, block, ~spaces & Isa::FULL);
+    } else {
+      // The first block (where `dest` may be ahead of the block) and the last (where writing past
+      // the NUL would go outside the string) are copied a byte at a time.
+      uint32_t keep = valid & ~spaces;
+      if (zeros != 0) {
+        keep &= below_lowest(zeros);
+      }
+      for (; keep != 0; keep &= keep - 1) {
+        *dest++ = block[std::countr_zero(keep)];
+      }
+      if (zeros != 0) {
+        *dest = '\0';
+        return;
+      }
+    }
+    block += Isa::WIDTH;
+    valid = Isa::FULL;
+  }
+}
+
+CSTR_KERNEL inline size_t len_sse2(char const *const str) noexcept { return len_simd<Sse2>(str); }
+CSTR_KERNEL_AVX2 inline size_t len_avx2(char const *const str) noexcept { return len_simd<Avx2>(str); }
+
+CSTR_KERNEL inline size_t count_sse2(char const *const str, char const c) noexcept { return count_simd<Sse2>(str, c); }
+CSTR_KERNEL_AVX2 inline size_t count_avx2(char const *const str, char const c) noexcept { return count_simd<Avx2>(str, c); }
+
+CSTR_KERNEL inline int cmp_sse2(char const *const s1, char const *const s2) noexcept { return cmp_simd<Sse2>(s1, s2); }
+CSTR_KERNEL_AVX2 inline int cmp_avx2(char const *const s1, char const *const s2) noexcept { return cmp_simd<Avx2>(s1, s2); }
+
+CSTR_KERNEL inline void remove_spaces_sse2(char *const str) noexcept { remove_spaces_simd<Sse2>(str); }
+CSTR_KERNEL_AVX2 inline void remove_spaces_avx2(char *const str) noexcept { remove_spaces_simd<Avx2>(str); }
+
+// Looks for `needle` (2+ characters) by checking a block of candidate positions at once for its first and last
+// characters, and only comparing the rest where both match.
+template <typename Isa>
+size_t find_simd(
+  std::string_view const haystack,
+  std::string_view const needle,
+  size_t pos,
+  bool const ignoreCase
+) noexcept {
+  size_t const n = needle.size();
+  char const *const h = haystack.data();
+  // only letters are folded, ORing 0x20 into '[' would make it match '{'
+  char const firstFold = ignoreCase && is_alpha(needle[0]) ? 0x20 : 0;
+  char const lastFold = ignoreCase && is_alpha(needle[n - 1]) ? 0x20 : 0;
+  char const first = static_cast<char>(needle[0] | firstFold), last = static_cast<char>(needle[n - 1] | lastFold);
+  auto const rest_equal = [&](size_t const at) {
+    return ignoreCase
+      ? equal_icase(h + at + 1, needle.data() + 1, n - 2)
+      : std::memcmp(h + at + 1, needle.data() + 1, n - 2) == 0;
+  };
+
+  for (; haystack.size() - pos >= n - 1 + Isa::WIDTH; pos += Isa::WIDTH) {
+    uint32_t candidates = Isa::eq_mask_unaligned(h + pos, first, firstFold)
+      & Isa::eq_mask_unaligned(h + pos + n - 1, last, lastFold);
+    for (; candidates != 0; candidates &= candidates - 1) {
+      size_t const at = pos + static_cast<size_t>(std::countr_zero(candidates));
+      if (rest_equal(at)) {
+        return at;
+      }
+    }
+  }
+  for (; haystack.size() - pos >= n; ++pos) {
+    if (static_cast<char>(h[pos] | firstFold) == first && static_cast<char>(h[pos + n - 1] | lastFold) == last && rest_equal(pos)) {
+      return pos;
+    }
+  }
+  return std::string_view::npos;
+}
+
+CSTR_KERNEL inline size_t find_sse2(std::string_view const haystack, std::string_view const needle, size_t const pos, bool const ignoreCase) noexcept {
+  return find_simd<Sse2>(haystack, needle, pos, ignoreCase);
+}
+CSTR_KERNEL_AVX2 inline size_t find_avx2(std::string_view const haystack, std::string_view const needle, size_t const pos, bool const ignoreCase) noexcept {
+  return find_simd<Avx2>(haystack, needle, pos, ignoreCase);
+}
+
+// True if the CPU and OS support AVX2, checked once.
+inline
+bool has_avx2() noexcept {
+  static bool const result = [] {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7) {
+      return false;
+    }
+    __cpuid(regs, 1);
+    bool const osxsave = (regs[2] & (1 << 27)) != 0, avx = (regs[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+      return false;
+    }
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+  }();
+  return result;
+}
+
+#endif // CSTR_X86
+
+} // namespace detail
+
 // Returns the difference between two strings -> 0 means the strings are identical.
 inline constexpr
 int cmp(char const *s1, char const *s2) {
+#if CSTR_X86
+  if (!std::is_constant_evaluated()) {
+    return detail::has_avx2() ? detail::cmp_avx2(s1, s2) : detail::cmp_sse2(s1, s2);
+  }
+#endif
   // from https://stackoverflow.com/a/34873406/16471560
   while(*s1 && (*s1 == *s2)) {
     ++s1;
     ++s2;
   }
-  return *(unsigned char const *)s1 - *(unsigned char const *)s2;
+  return static_cast<unsigned char>(*s1) - static_cast<unsigned char>(*s2);
 }
 
 // Returns the length of a NUL-terminated string, excluding the NUL char. Can be computed at compile, unlike std::strlen.
 inline constexpr
 size_t len(char const *const str) {
+#if CSTR_X86
+  if (!std::is_constant_evaluated()) {
+    return detail::has_avx2() ? detail::len_avx2(str) : detail::len_sse2(str);
+  }
+#endif
   size_t i = 0;
   while (str[i] != '\0') {
     ++i;
@@ -30,6 +485,14 @@ size_t len(char const *const str) {
 // Returns the number of occurences of a character.
 inline constexpr
 size_t count(char const *const str, char const c) {
+  if (c == '\0') {
+    return 0;
+  }
+#if CSTR_X86
+  if (!std::is_constant_evaluated()) {
+    return detail::has_avx2() ? detail::count_avx2(str, c) : detail::count_sse2(str, c);
+  }
+#endif
   size_t i = 0, count = 0;
   while (str[i] != '\0') {
     if (str[i] == c) {
@@ -47,15 +510,21 @@ char last_char(char const *const str) {
   return slen > 0 ? str[slen - 1] : '\0';
 }
 
-// Removes any characters that match by `std::isspace`.
-inline
+// Removes any characters that match by `std::isspace` in the "C" locale.
+inline constexpr
 void remove_spaces(char *s) {
+#if CSTR_X86
+  if (!std::is_constant_evaluated()) {
+    detail::has_avx2() ? detail::remove_spaces_avx2(s) : detail::remove_spaces_sse2(s);
+    return;
+  }
+#endif
   char *d = s;
   do {
-    while (std::isspace(*d)) {
+    while (detail::is_space(*d)) {
       ++d;
     }
-  } while (*s++ = *d++);
+  } while ((*s++ = *d++) != '\0');
 }
 
 // Converts an ASCII number ('0'-'9') to an integer (0-9).
@@ -70,6 +539,942 @@ char int_to_ascii_digit(int const digit) {
   return static_cast<char>(static_cast<int>('0') + (digit));
 }
 
+// Why `parse_int` failed.
+enum class ParseError {
+  NONE,
+  // The text doesn't start with a number.
+  NO_DIGITS,
+  // The number doesn't fit in the requested type.
+  OUT_OF_RANGE,
+};
+
+template <typename Int>
+struct ParseResult {
+  // 0 unless `error` is `NONE`.
+  Int value;
+  // Number of characters making up the number (including any '-'), even when it's out of range. 0 for `NO_DIGITS`.
+  size_t length;
+  ParseError error;
+};
+
+namespace detail {
+
+inline constexpr std::array<uint64_t, 20> POWERS_OF_10 = [] {
+  std::array<uint64_t, 20> powers{};
+  uint64_t power = 1;
+  for (uint64_t &p : powers) {
+    p = power;
+    power *= 10;
+  }
+  return powers;
+}();
+
+// "00" "01" ... "99", so numbers can be formatted two digits at a time.
+inline constexpr std::array<char, 200> DIGIT_PAIRS = [] {
+  std::array<char, 200> pairs{};
+  for (size_t i = 0; i < 100; ++i) {
+    pairs[i * 2] = static_cast<char>('0' + i / 10);
+    pairs[i * 2 + 1] = static_cast<char>('0' + i % 10);
+  }
+  return pairs;
+}();
+
+// 8 characters packed into an integer, the first in the lowest byte.
+constexpr
+uint64_t load_chunk(char const *const str) noexcept {
+  uint64_t chunk = 0;
+  if (!std::is_constant_evaluated() && std::endian::native == std::endian::little) {
+    std::memcpy(&chunk, str, 8);
+    return chunk;
+  }
+  for (size_t i = 0; i < 8; ++i) {
+    chunk |= static_cast<uint64_t>(static_cast<unsigned char>(str[i])) << (8 * i);
+  }
+  return chunk;
+}
+
+// Number of digits `chunk` starts with, without looking at them one by one.
+constexpr
+unsigned leading_digits(uint64_t const chunk) noexcept {
+  // A byte is a digit iff both it and it + 6 have a high nibble of 3. The addition can carry into the next byte, but
+  // only out of a byte which isn't a digit, and nothing after the first non-digit matters.
+  uint64_t const nonDigits = (
+    (chunk & 0xF0F0F0F0F0F0F0F0) |
+    (((chunk + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)
+  ) ^ 0x3333333333333333;
+  return static_cast<unsigned>(std::countr_zero(nonDigits)) / 8;
+}
+
+// Value of the first `digits` (1-8) characters of `chunk`, which must be digits.
+constexpr
+uint64_t parse_chunk(uint64_t chunk, unsigned const digits) noexcept {
+  // Shifting out the characters after the digits leaves zero bytes in front of them, i.e. leading zeros. Then
+  // neighbouring digits are combined pairwise: into 2 digit numbers, 4 digit numbers, and finally 8.
+  chunk = (chunk - 0x3030303030303030) << (8 * (8 - digits));
+  chunk = (chunk * 10 + (chunk >> 8)) & 0x00FF00FF00FF00FF;
+  chunk = (chunk * 100 + (chunk >> 16)) & 0x0000FFFF0000FFFF;
+  chunk = (chunk * 10000 + (chunk >> 32)) & 0x00000000FFFFFFFF;
+  return chunk;
+}
+
+// Number of decimal digits in `value`, at least 1.
+constexpr
+unsigned num_digits(uint64_t const value) noexcept {
+  // bit width * log10(2) is either the number of digits or one more
+  unsigned const guess = (static_cast<unsigned>(std::bit_width(value | 1)) * 1233) >> 12;
+  return guess + ((value | 1) >= POWERS_OF_10[guess]);
+}
+
+} // namespace detail
+
+// Parses a base 10 integer from the start of `text`: `-?[0-9]+` for signed types, `[0-9]+` for unsigned ones, like
+// `std::from_chars`. Doesn't skip leading whitespace. Can be computed at compile time.
+template <std::integral Int>
+requires (!std::is_same_v<Int, bool>) && (sizeof(Int) <= sizeof(uint64_t))
+constexpr
+ParseResult<Int> parse_int(std::string_view const text) noexcept {
+  bool const negative = std::is_signed_v<Int> && !text.empty() && text[0] == '-';
+  size_t pos = negative;
+
+  // Digits are consumed 8 at a time while there are 8 characters left, then one at a time. The overflow check needs a
+  // division, but a value below `SAFE` can take another 8 digits without overflowing, so that's only needed for numbers
+  // of 12+ digits.
+  uint64_t constexpr SAFE = (UINT64_MAX - 99999999) / 100000000;
+  uint64_t magnitude = 0;
+  bool overflow = false;
+  auto const append = [&](uint64_t const value, unsigned const digits) {
+    uint64_t const scale = detail::POWERS_OF_10[digits];
+    if (magnitude >= SAFE && magnitude > (UINT64_MAX - value) / scale) {
+      overflow = true;
+    }
+    magnitude = magnitude * scale + value;
+    pos += digits;
+  };
+  while (text.size() - pos >= 8) {
+    uint64_t const chunk = detail::load_chunk(text.data() + pos);
+    unsigned const digits = detail::leading_digits(chunk);
+    if (digits == 0) {
+      break;
+    }
+    append(detail::parse_chunk(chunk, digits), digits);
+    if (digits < 8) {
+      // the tail loop stops straight away, the next character isn't a digit
+      break;
+    }
+  }
+  while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+    append(static_cast<uint64_t>(text[pos] - '0'), 1);
+  }
+
+  if (pos == static_cast<size_t>(negative)) {
+    return { 0, 0, ParseError::NO_DIGITS };
+  }
+  uint64_t const limit = static_cast<uint64_t>(std::numeric_limits<Int>::max()) + negative;
+  if (overflow || magnitude > limit) {
+    return { 0, pos, ParseError::OUT_OF_RANGE };
+  }
+  auto const value = static_cast<std::make_unsigned_t<Int>>(negative ? 0 - magnitude : magnitude);
+  return { static_cast<Int>(value), pos, ParseError::NONE };
+}
+
+// Most characters `format_int` writes for an `Int`.
+template <std::integral Int>
+inline constexpr size_t MAX_INT_CHARS = std::numeric_limits<Int>::digits10 + 1 + std::is_signed_v<Int>;
+
+// Writes `value` in base 10 to `[first, last)`, without a NUL. Returns the end of what was written, or nullptr (having
+// written nothing) if it doesn't fit, `MAX_INT_CHARS` always does. Can be computed at compile time.
+template <std::integral Int>
+requires (!std::is_same_v<Int, bool>) && (sizeof(Int) <= sizeof(uint64_t))
+constexpr
+char *format_int(char *const first, char *const last, Int const value) noexcept {
+  bool const negative = value < 0;
+  uint64_t magnitude = static_cast<uint64_t>(value);
+  if (negative) {
+    magnitude = 0 - magnitude;
+  }
+
+  size_t const length = detail::num_digits(magnitude) + negative;
+  if (static_cast<size_t>(last - first) < length) {
+    return nullptr;
+  }
+
+  char *const end = first + length;
+  char *out = end;
+  while (magnitude >= 100) {
+    size_t const pair = static_cast<size_t>(magnitude % 100) * 2;
+    magnitude /= 100;
+    out -= 2;
+    out[0] = detail::DIGIT_PAIRS[pair];
+    out[1] = detail::DIGIT_PAIRS[pair + 1];
+  }
+  if (magnitude >= 10) {
+    out -= 2;
+    out[0] = detail::DIGIT_PAIRS[magnitude * 2];
+    out[1] = detail::DIGIT_PAIRS[magnitude * 2 + 1];
+  } else {
+    *--out = static_cast<char>('0' + magnitude);
+  }
+  if (negative) {
+    *first = '-';
+  }
+  return end;
+}
+
+// Writes the shortest representation of `value` which parses back to the same value (see `std::to_chars`) to
+// `[first, last)`, without a NUL. Returns the end of what was written, or nullptr if it doesn't fit.
+template <std::floating_point Float>
+char *format_float(char *const first, char *const last, Float const value) noexcept {
+  auto const [end, error] = std::to_chars(first, last, value);
+  return error == std::errc{} ? end : nullptr;
+}
+
+// Like `format_float`, but with the given format and number of digits (after the decimal point, or significant
+// digits for `std::chars_format::general`).
+template <std::floating_point Float>
+char *format_float(
+  char *const first,
+  char *const last,
+  Float const value,
+  std::chars_format const format,
+  int const precision
+) noexcept {
+  auto const [end, error] = std::to_chars(first, last, value, format, precision);
+  return error == std::errc{} ? end : nullptr;
+}
+
+namespace detail {
+
+#if CSTR_X86
+
+// Index of the first of `text[from..]` equal to any of `chars`, checking 16 at a time. Stops (returning where it
+// stopped) when fewer than 16 characters are left, for the caller to finish.
+inline
+size_t find_any_sse2(
+  std::string_view const text,
+  size_t from,
+  char const *const chars,
+  size_t const numChars
+) noexcept {
+  __m128i needles[8];
+  for (size_t i = 0; i < numChars; ++i) {
+    needles[i] = _mm_set1_epi8(chars[i]);
+  }
+  for (; from + 16 <= text.size(); from += 16) {
+    __m128i const block = _mm_loadu_si128(reinterpret_cast<__m128i const *>(text.data() + from));
+    __m128i hits = _mm_cmpeq_epi8(block, needles[0]);
+    for (size_t i = 1; i < numChars; ++i) {
+      hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, needles[i]));
+    }
+    auto const mask = static_cast<uint32_t>(_mm_movemask_epi8(hits));
+    if (mask != 0) {
+      return from + static_cast<size_t>(std::countr_zero(mask));
+    }
+  }
+  return from;
+}
+
+#endif // CSTR_X86
+
+} // namespace detail
+
+// A set of characters, e.g. delimiters. Membership is a lookup in a 256-bit table, and sets of up to 8 characters are
+// also kept as a list, so `find` can compare 16 characters at a time against each of them.
+class CharSet {
+public:
+  constexpr CharSet() noexcept = default;
+  constexpr CharSet(std::string_view const chars) noexcept {
+    for (char const c : chars) {
+      insert(c);
+    }
+  }
+  constexpr CharSet(char const *const chars) noexcept : CharSet(std::string_view(chars)) {}
+
+  constexpr void insert(char const c) noexcept {
+    if (contains(c)) {
+      return;
+    }
+    auto const byte = static_cast<unsigned char>(c);
+    m_bits[byte / 64] |= uint64_t{1} << (byte % 64);
+    if (m_size < MAX_LISTED) {
+      m_listed[m_size] = c;
+    }
+    ++m_size;
+  }
+
+  [[nodiscard]] constexpr bool contains(char const c) const noexcept {
+    auto const byte = static_cast<unsigned char>(c);
+    return (m_bits[byte / 64] >> (byte % 64)) & 1;
+  }
+
+  [[nodiscard]] constexpr size_t size() const noexcept {
+    return m_size;
+  }
+
+  // Index of the first character of `text` at or after `from` which is in the set, `text.size()` if there's none.
+  [[nodiscard]] constexpr size_t find(std::string_view const text, size_t from = 0) const noexcept {
+    if (!std::is_constant_evaluated()) {
+      if (m_size == 1) {
+        return std::min(text.find(m_listed[0], from), text.size());
+      }
+#if CSTR_X86
+      if (m_size > 1 && m_size <= MAX_LISTED) {
+        from = detail::find_any_sse2(text, from, m_listed.data(), m_size);
+      }
+#endif
+    }
+    while (from < text.size() && !contains(text[from])) {
+      ++from;
+    }
+    return std::min(from, text.size());
+  }
+
+  // Index of the first character of `text` at or after `from` which isn't in the set, `text.size()` if there's none.
+  [[nodiscard]] constexpr size_t find_not(std::string_view const text, size_t from = 0) const noexcept {
+    while (from < text.size() && contains(text[from])) {
+      ++from;
+    }
+    return std::min(from, text.size());
+  }
+
+private:
+  static constexpr size_t MAX_LISTED = 8;
+
+  std::array<uint64_t, 4> m_bits{};
+  // The first `MAX_LISTED` characters inserted.
+  std::array<char, MAX_LISTED> m_listed{};
+  size_t m_size = 0;
+};
+
+// Range of the tokens of a string, see `split` and `tokenize`. Tokens are views into the string, which must outlive the
+// range. All state lives in the range and its iterators, so any number of them can be used at once, on any threads.
+class Splitter {
+public:
+  class const_iterator {
+  public:
+    using iterator_concept = std::forward_iterator_tag;
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::string_view;
+    using difference_type = ptrdiff_t;
+    using reference = std::string_view;
+    using pointer = void;
+
+    constexpr const_iterator() noexcept = default;
+
+    constexpr std::string_view operator*() const noexcept {
+      return m_splitter->m_text.substr(m_start, m_end - m_start);
+    }
+
+    constexpr const_iterator &operator++() noexcept {
+      std::string_view const text = m_splitter->m_text;
+      if (m_end == text.size()) {
+        m_start = END;
+        return *this;
+      }
+      m_start = m_end + 1;
+      if (m_splitter->m_skipEmpty) {
+        m_start = m_splitter->m_delimiters.find_not(text, m_start);
+        if (m_start == text.size()) {
+          m_start = END;
+          return *this;
+        }
+      }
+      m_end = m_splitter->m_delimiters.find(text, m_start);
+      return *this;
+    }
+    constexpr const_iterator operator++(int) noexcept {
+      const_iterator const copy = *this;
+      ++*this;
+      return copy;
+    }
+
+    constexpr friend bool operator==(const_iterator const &lhs, const_iterator const &rhs) noexcept {
+      return lhs.m_start == rhs.m_start;
+    }
+
+  private:
+    friend class Splitter;
+
+    static constexpr size_t END = SIZE_MAX;
+
+    constexpr const_iterator(Splitter const *const splitter, size_t const start) noexcept
+      : m_splitter{splitter}, m_start{start}, m_end{0} {}
+
+    Splitter const *m_splitter = nullptr;
+    // Bounds of the current token in the text, `m_start` is `END` past the last one.
+    size_t m_start = END;
+    size_t m_end = 0;
+  };
+
+  constexpr Splitter(std::string_view const text, CharSet const &delimiters, bool const skipEmpty) noexcept
+    : m_text{text}, m_delimiters{delimiters}, m_skipEmpty{skipEmpty} {}
+
+  [[nodiscard]] constexpr const_iterator begin() const noexcept {
+    const_iterator it(this, m_skipEmpty ? m_delimiters.find_not(m_text) : 0);
+    if (m_skipEmpty && it.m_start == m_text.size()) {
+      return end();
+    }
+    it.m_end = m_delimiters.find(m_text, it.m_start);
+    return it;
+  }
+  [[nodiscard]] constexpr const_iterator end() const noexcept {
+    return const_iterator(this, const_iterator::END);
+  }
+
+private:
+  std::string_view m_text;
+  CharSet m_delimiters;
+  bool m_skipEmpty;
+};
+
+// Splits `text` at every occurence of any of `delimiters`, e.g. "a,,b" -> "a", "", "b", and "" -> "". Nothing is
+// copied or modified, unlike `std::strtok` which is also not reentrant.
+[[nodiscard]] constexpr
+Splitter split(std::string_view const text, CharSet const &delimiters) noexcept {
+  return Splitter(text, delimiters, false);
+}
+
+// Like `split`, but without empty tokens, i.e. like `std::strtok`: " a  b " -> "a", "b".
+[[nodiscard]] constexpr
+Splitter tokenize(std::string_view const text, CharSet const &delimiters) noexcept {
+  return Splitter(text, delimiters, true);
+}
+
+// A field of a CSV record, see `split_csv`.
+struct CsvField {
+  // Without the surrounding quotes, if it was quoted. Quotes escaped by doubling them are still doubled, see `unescape`.
+  std::string_view text;
+  bool quoted;
+  // True if `text` contains doubled quotes.
+  bool escaped;
+
+  // Copies `text` to `out` with doubled quotes made single, returns the end of the copy (at most `text.size()` chars).
+  constexpr char *unescape(char *out, char const quote = '"') const noexcept {
+    for (size_t i = 0; i < text.size(); ++i) {
+      *out++ = text[i];
+      i += escaped && text[i] == quote;
+    }
+    return out;
+  }
+};
+
+// Range of the fields of a CSV record, see `split_csv`. Like `Splitter`, fields are views into the record.
+class CsvSplitter {
+public:
+  class const_iterator {
+  public:
+    using iterator_concept = std::forward_iterator_tag;
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = CsvField;
+    using difference_type = ptrdiff_t;
+    using reference = CsvField;
+    using pointer = void;
+
+    constexpr const_iterator() noexcept = default;
+
+    constexpr CsvField operator*() const noexcept {
+      return m_field;
+    }
+
+    constexpr const_iterator &operator++() noexcept {
+      if (m_next > m_splitter->m_record.size()) {
+        m_start = END;
+      } else {
+        parse(m_next);
+      }
+      return *this;
+    }
+    constexpr const_iterator operator++(int) noexcept {
+      const_iterator const copy = *this;
+      ++*this;
+      return copy;
+    }
+
+    constexpr friend bool operator==(const_iterator const &lhs, const_iterator const &rhs) noexcept {
+      return lhs.m_start == rhs.m_start;
+    }
+
+  private:
+    friend class CsvSplitter;
+
+    static constexpr size_t END = SIZE_MAX;
+
+    constexpr explicit const_iterator(CsvSplitter const *const splitter) noexcept : m_splitter{splitter} {}
+
+    // Parses the field starting at `start`.
+    constexpr void parse(size_t const start) noexcept {
+      std::string_view const record = m_splitter->m_record;
+      char const delimiter = m_splitter->m_delimiter, quote = m_splitter->m_quote;
+      m_start = start;
+      m_field = {};
+
+      size_t end;
+      if (start < record.size() && record[start] == quote) {
+        // up to the first quote which isn't followed by another, or the end of the record if the quotes aren't closed
+        m_field.quoted = true;
+        size_t close = record.find(quote, start + 1);
+        while (close != std::string_view::npos && close + 1 < record.size() && record[close + 1] == quote) {
+          m_field.escaped = true;
+          close = record.find(quote, close + 2);
+        }
+        close = std::min(close, record.size());
+        m_field.text = record.substr(start + 1, close - start - 1);
+        // anything between the closing quote and the delimiter is malformed and ignored
+        end = close < record.size() ? std::min(record.find(delimiter, close + 1), record.size()) : close;
+      } else {
+        end = std::min(record.find(delimiter, start), record.size());
+        m_field.text = record.substr(start, end - start);
+      }
+      // past the end of the record if this is the last field
+      m_next = end + 1;
+    }
+
+    CsvSplitter const *m_splitter = nullptr;
+    // Start of the current field in the record, `END` past the last one.
+    size_t m_start = END;
+    // Start of the next field.
+    size_t m_next = 0;
+    CsvField m_field{};
+  };
+
+  constexpr CsvSplitter(std::string_view const record, char const delimiter, char const quote) noexcept
+    : m_record{record}, m_delimiter{delimiter}, m_quote{quote} {}
+
+  [[nodiscard]] constexpr const_iterator begin() const noexcept {
+    const_iterator it(this);
+    it.parse(0);
+    return it;
+  }
+  [[nodiscard]] constexpr const_iterator end() const noexcept {
+    return const_iterator(this);
+  }
+
+private:
+  std::string_view m_record;
+  char m_delimiter;
+  char m_quote;
+};
+
+// Splits a CSV record (a line, without the line terminator) into its fields, e.g. `a,"b,c",,"say ""hi"""` -> `a`,
+// `b,c`, ``, `say ""hi""`. A field starting with `quote` lasts until the matching quote, and may contain delimiters and
+// doubled quotes. Like `split`, nothing is copied or modified and it's reentrant.
+[[nodiscard]] constexpr
+CsvSplitter split_csv(std::string_view const record, char const delimiter = ',', char const quote = '"') noexcept {
+  return CsvSplitter(record, delimiter, quote);
+}
+
+// Index of the first occurence of `needle` in `haystack` at or after `pos`, `std::string_view::npos` if there's none.
+// Same as `haystack.find(needle, pos)`, but at run time long haystacks are scanned a block at a time for places where
+// both the first and last characters of `needle` match, and only those are compared in full.
+[[nodiscard]] constexpr
+size_t find(std::string_view const haystack, std::string_view const needle, size_t const pos = 0) noexcept {
+#if CSTR_X86
+  if (!std::is_constant_evaluated() && needle.size() >= 2 && pos <= haystack.size()) {
+    return detail::has_avx2()
+      ? detail::find_avx2(haystack, needle, pos, false)
+      : detail::find_sse2(haystack, needle, pos, false);
+  }
+#endif
+  return haystack.find(needle, pos);
+}
+
+// Like `find`, but ignoring the case of ASCII letters.
+[[nodiscard]] constexpr
+size_t find_icase(std::string_view const haystack, std::string_view const needle, size_t pos = 0) noexcept {
+  if (pos > haystack.size() || needle.size() > haystack.size() - pos) {
+    return std::string_view::npos;
+  }
+  if (needle.empty()) {
+    return pos;
+  }
+#if CSTR_X86
+  if (!std::is_constant_evaluated() && needle.size() >= 2) {
+    return detail::has_avx2()
+      ? detail::find_avx2(haystack, needle, pos, true)
+      : detail::find_sse2(haystack, needle, pos, true);
+  }
+#endif
+  for (; haystack.size() - pos >= needle.size(); ++pos) {
+    if (detail::equal_icase(haystack.data() + pos, needle.data(), needle.size())) {
+      return pos;
+    }
+  }
+  return std::string_view::npos;
+}
+
+// Several needles compiled into one automaton (Aho-Corasick), so a haystack is searched for all of them in a single
+// pass costing a table lookup per character, however many needles there are. Positions where no needle can start
+// are skipped with `CharSet::find`. Can be built and used in constant expressions.
+class NeedleSet {
+public:
+  struct Match {
+    // Where the match starts in the haystack.
+    size_t position;
+    // Index of the needle (into the constructor's `needles`).
+    size_t needle;
+  };
+
+  // Empty needles are ignored (never match). If `ignoreCase`, ASCII letters match either case.
+  constexpr explicit NeedleSet(std::span<std::string_view const> const needles, bool const ignoreCase = false)
+    : m_numNeedles{needles.size()}
+  {
+    build(needles, ignoreCase);
+  }
+  constexpr NeedleSet(std::initializer_list<std::string_view> const needles, bool const ignoreCase = false)
+    : NeedleSet(std::span<std::string_view const>(needles.begin(), needles.size()), ignoreCase) {}
+
+  [[nodiscard]] constexpr size_t size() const noexcept {
+    return m_numNeedles;
+  }
+
+  // The match at or after `pos` which ends first, the longest one if several end in the same place.
+  [[nodiscard]] constexpr std::optional<Match> find(std::string_view const haystack, size_t const pos = 0) const {
+    std::optional<Match> found{};
+    find_all(haystack, [&found](Match const match) {
+      found = match;
+      return false;
+    }, pos);
+    return found;
+  }
+
+  // Calls `onMatch(Match)` for every occurence of every needle at or after `pos`, overlapping ones included, in order
+  // of where they end (longest first where several end in the same place), until it returns false.
+  template <typename OnMatch>
+  constexpr void find_all(std::string_view const haystack, OnMatch &&onMatch, size_t pos = 0) const {
+    uint32_t state = 0;
+    for (; pos < haystack.size(); ++pos) {
+      if (state == 0) {
+        pos = m_firstChars.find(haystack, pos);
+        if (pos == haystack.size()) {
+          return;
+        }
+      }
+      state = m_table[state + m_byteClasses[static_cast<unsigned char>(haystack[pos])]];
+      for (uint32_t i = m_table[state + m_numClasses]; i < m_table[state + m_numClasses + 1]; ++i) {
+        uint32_t const needle = m_matchIds[i];
+        if (!onMatch(Match{ pos + 1 - m_lengths[needle], needle })) {
+          return;
+        }
+      }
+    }
+  }
+
+private:
+  constexpr void build(std::span<std::string_view const> const needles, bool const ignoreCase) {
+    // Bytes no needle contains share class 0. With `ignoreCase`, both cases of a letter share a class.
+    m_numClasses = 1;
+    for (std::string_view const needle : needles) {
+      for (char const c : needle) {
+        char const folded = ignoreCase ? detail::to_lower(c) : c;
+        auto &cls = m_byteClasses[static_cast<unsigned char>(folded)];
+        if (cls == 0) {
+          cls = static_cast<uint16_t>(m_numClasses++);
+          if (ignoreCase && detail::is_alpha(c)) {
+            m_byteClasses[static_cast<unsigned char>(folded - ('a' - 'A'))] = cls;
+          }
+        }
+      }
+    }
+
+    // Trie of the needles, `NONE` marking missing edges. State 0 is the root.
+    uint32_t constexpr NONE = UINT32_MAX;
+    std::vector<uint32_t> transitions(m_numClasses, NONE);
+    std::vector<std::vector<uint32_t>> matches(1);
+    m_lengths.resize(needles.size());
+    for (size_t i = 0; i < needles.size(); ++i) {
+      std::string_view const needle = needles[i];
+      m_lengths[i] = static_cast<uint32_t>(needle.size());
+      if (needle.empty()) {
+        continue;
+      }
+      char const first = needle[0];
+      m_firstChars.insert(first);
+      if (ignoreCase && detail::is_alpha(first)) {
+        m_firstChars.insert(static_cast<char>(first ^ 0x20));
+      }
+      uint32_t state = 0;
+      for (char const c : needle) {
+        uint32_t &next = transitions[state * m_numClasses + m_byteClasses[static_cast<unsigned char>(c)]];
+        if (next == NONE) {
+          next = static_cast<uint32_t>(matches.size());
+          matches.emplace_back();
+          transitions.resize(transitions.size() + m_numClasses, NONE);
+        }
+        // `next` may have been invalidated by the resize
+        state = transitions[state * m_numClasses + m_byteClasses[static_cast<unsigned char>(c)]];
+      }
+      matches[state].push_back(static_cast<uint32_t>(i));
+    }
+
+    // Turns the trie into a DFA, breadth first so each state's failure state (the longest proper suffix of its
+    // string which is also in the trie) is complete before it's needed. Missing edges take the failure state's,
+    // and each state also matches whatever its failure state does (shorter needles, so after its own).
+    std::vector<uint32_t> failure(matches.size(), 0);
+    std::vector<uint32_t> queue{};
+    for (uint32_t c = 0; c < m_numClasses; ++c) {
+      uint32_t &next = transitions[c];
+      if (next == NONE) {
+        next = 0;
+      } else {
+        queue.push_back(next);
+      }
+    }
+    for (size_t head = 0; head < queue.size(); ++head) {
+      uint32_t const state = queue[head];
+      matches[state].insert(matches[state].end(), matches[failure[state]].begin(), matches[failure[state]].end());
+      for (uint32_t c = 0; c < m_numClasses; ++c) {
+        uint32_t const fallback = transitions[failure[state] * m_numClasses + c];
+        uint32_t &next = transitions[state * m_numClasses + c];
+        if (next == NONE) {
+          next = fallback;
+        } else {
+          failure[next] = fallback;
+          queue.push_back(next);
+        }
+      }
+    }
+
+    // Each state's row of the table is its transitions followed by the bounds of its matches in `m_matchIds`, and
+    // states are identified by the offset of their row, which saves a multiplication per character.
+    uint32_t const stride = m_numClasses + 2;
+    m_table.resize(matches.size() * stride);
+    for (size_t state = 0; state < matches.size(); ++state) {
+      uint32_t *const row = m_table.data() + state * stride;
+      for (uint32_t c = 0; c < m_numClasses; ++c) {
+        row[c] = transitions[state * m_numClasses + c] * stride;
+      }
+      row[m_numClasses] = static_cast<uint32_t>(m_matchIds.size());
+      m_matchIds.insert(m_matchIds.end(), matches[state].begin(), matches[state].end());
+      row[m_numClasses + 1] = static_cast<uint32_t>(m_matchIds.size());
+    }
+  }
+
+  size_t m_numNeedles;
+  // 16 bits, since with every byte value in the needles there are 257 classes.
+  std::array<uint16_t, 256> m_byteClasses{};
+  uint32_t m_numClasses = 0;
+  // Transitions are indexed by `state + m_byteClasses[c]`, and the needles matched on entering `state` are
+  // `m_matchIds[m_table[state + m_numClasses] .. m_table[state + m_numClasses + 1]]`.
+  std::vector<uint32_t> m_table{};
+  std::vector<uint32_t> m_matchIds{};
+  std::vector<uint32_t> m_lengths{};
+  // Characters a needle can start with.
+  CharSet m_firstChars{};
+};
+
+// 64-bit FNV-1a hash of `str`. Simple and usable in constant expressions, but a multiplication per character, see
+// `hash` for a faster one.
+[[nodiscard]] constexpr
+uint64_t fnv1a(std::string_view const str) noexcept {
+  uint64_t hash = 0xCBF29CE484222325;
+  for (char const c : str) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 0x100000001B3;
+  }
+  return hash;
+}
+
+namespace detail {
+
+#ifdef __SIZEOF_INT128__
+__extension__ using uint128 = unsigned __int128;
+#endif
+
+inline constexpr std::array<uint64_t, 3> HASH_SECRET = { 0xA0761D6478BD642F, 0xE7037ED1A0B428DB, 0x8EBC6AF09C88C6E3 };
+
+// The 128-bit product of `a` and `b`, its halves XORed together.
+constexpr
+uint64_t mul_fold(uint64_t const a, uint64_t const b) noexcept {
+#ifdef __SIZEOF_INT128__
+  uint128 const product = static_cast<uint128>(a) * b;
+  return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+#else
+  uint64_t const aLow = a & 0xFFFFFFFF, aHigh = a >> 32, bLow = b & 0xFFFFFFFF, bHigh = b >> 32;
+  uint64_t const lowLow = aLow * bLow, lowHigh = aLow * bHigh, highLow = aHigh * bLow;
+  uint64_t const middle = (lowLow >> 32) + (lowHigh & 0xFFFFFFFF) + (highLow & 0xFFFFFFFF);
+  uint64_t const low = (lowLow & 0xFFFFFFFF) | (middle << 32);
+  uint64_t const high = aHigh * bHigh + (lowHigh >> 32) + (highLow >> 32) + (middle >> 32);
+  return low ^ high;
+#endif
+}
+
+// 4 characters packed into an integer, the first in the lowest byte.
+constexpr
+uint64_t load_half_chunk(char const *const str) noexcept {
+  uint32_t chunk = 0;
+  if (!std::is_constant_evaluated() && std::endian::native == std::endian::little) {
+    std::memcpy(&chunk, str, 4);
+    return chunk;
+  }
+  for (size_t i = 0; i < 4; ++i) {
+    chunk |= static_cast<uint32_t>(static_cast<unsigned char>(str[i])) << (8 * i);
+  }
+  return chunk;
+}
+
+} // namespace detail
+
+// 64-bit hash of `str`, modelled on wyhash: strings are read 8 or 16 characters at a time, each block mixed in with a
+// 64x64->128 bit multiplication. Gives the same result at compile time and at run time, on any platform, so tables of
+// hashes can be computed in constant expressions.
+[[nodiscard]] constexpr
+uint64_t hash(std::string_view const str, uint64_t seed = 0) noexcept {
+  using detail::HASH_SECRET, detail::load_chunk, detail::load_half_chunk, detail::mul_fold;
+
+  char const *p = str.data();
+  size_t const length = str.size();
+  seed ^= mul_fold(seed ^ HASH_SECRET[0], HASH_SECRET[1]);
+  uint64_t a = 0, b = 0;
+  if (length <= 16) {
+    if (length >= 4) {
+      // Two overlapping pairs of 4 characters, from each end, cover every character.
+      size_t const step = (length >> 3) << 2;
+      a = (load_half_chunk(p) << 32) | load_half_chunk(p + step);
+      b = (load_half_chunk(p + length - 4) << 32) | load_half_chunk(p + length - 4 - step);
+    } else if (length > 0) {
+      auto const at = [p](size_t const i) { return static_cast<uint64_t>(static_cast<unsigned char>(p[i])); };
+      a = (at(0) << 16) | (at(length >> 1) << 8) | at(length - 1);
+    }
+  } else {
+    size_t remaining = length;
+    for (; remaining > 16; remaining -= 16, p += 16) {
+      seed = mul_fold(load_chunk(p) ^ HASH_SECRET[1], load_chunk(p + 8) ^ seed);
+    }
+    // The last 16 characters, which may overlap the last block.
+    a = load_chunk(p + remaining - 16);
+    b = load_chunk(p + remaining - 8);
+  }
+  return mul_fold(mul_fold(a ^ HASH_SECRET[1], b ^ seed) ^ HASH_SECRET[2] ^ length, HASH_SECRET[1]);
+}
+
+// A map with a fixed set of string keys, built into a perfect hash table (usually at compile time, see
+// `make_static_map`): every key has a slot to itself, so a lookup is a `hash` of the key and a comparison with the
+// one key in its slot. An alternative to chains of `cmp` for dispatching on command names and the like.
+template <std::semiregular Value, size_t N>
+class StaticMap {
+public:
+  static_assert(N > 0, "StaticMap needs at least one key");
+
+  using Entry = std::pair<std::string_view, Value>;
+
+  // Throws `std::runtime_error` (a compile error, in a constant expression) if a key appears more than once.
+  constexpr explicit StaticMap(std::span<Entry const, N> const entries) {
+    std::array<std::string_view, N> keys{};
+    for (size_t i = 0; i < N; ++i) {
+      keys[i] = entries[i].first;
+    }
+    std::sort(keys.begin(), keys.end());
+    if (std::adjacent_find(keys.begin(), keys.end()) != keys.end()) {
+      throw std::runtime_error("duplicate key in StaticMap");
+    }
+    // Distinct keys with the same hash (or too unlucky a spread of hashes) need another seed, which is very rare.
+    while (!build(entries)) {
+      ++m_seed;
+    }
+  }
+
+  [[nodiscard]] static constexpr size_t size() noexcept {
+    return N;
+  }
+
+  // The value of `key`, null if it isn't one of the keys.
+  [[nodiscard]] constexpr Value const *find(std::string_view const key) const noexcept {
+    uint64_t const keyHash = hash(key, m_seed);
+    Entry const &slot = m_slots[slot_of(keyHash, m_displacements[bucket_of(keyHash)])];
+    return slot.first == key ? &slot.second : nullptr;
+  }
+
+  [[nodiscard]] constexpr bool contains(std::string_view const key) const noexcept {
+    return find(key) != nullptr;
+  }
+
+  // The value of `key`, `fallback` if it isn't one of the keys.
+  [[nodiscard]] constexpr Value get(std::string_view const key, Value const &fallback) const {
+    Value const *const value = find(key);
+    return value != nullptr ? *value : fallback;
+  }
+
+private:
+  // Keys are spread over buckets of about 4 by their hash, then each bucket (largest first) gets the first
+  // displacement which moves all of its keys to free slots. Slots are kept at most 80% full, so it doesn't take long.
+  static constexpr size_t NUM_SLOTS = std::bit_ceil(N + N / 4 + 1);
+  static constexpr int SLOT_BITS = std::countr_zero(NUM_SLOTS);
+  static constexpr size_t NUM_BUCKETS = std::bit_ceil((N + 3) / 4);
+  static constexpr uint32_t MAX_DISPLACEMENT = 1 << 16;
+
+  static constexpr size_t bucket_of(uint64_t const keyHash) noexcept {
+    return static_cast<size_t>(keyHash >> 32) & (NUM_BUCKETS - 1);
+  }
+  static constexpr size_t slot_of(uint64_t const keyHash, uint32_t const displacement) noexcept {
+    return static_cast<size_t>(((keyHash + displacement) * 0x9E3779B97F4A7C15) >> (64 - SLOT_BITS));
+  }
+
+  constexpr bool build(std::span<Entry const, N> const entries) {
+    std::array<uint64_t, N> hashes{};
+    std::vector<std::vector<uint32_t>> buckets(NUM_BUCKETS);
+    for (size_t i = 0; i < N; ++i) {
+      hashes[i] = hash(entries[i].first, m_seed);
+      buckets[bucket_of(hashes[i])].push_back(static_cast<uint32_t>(i));
+    }
+    std::vector<uint32_t> order(NUM_BUCKETS);
+    for (uint32_t b = 0; b < NUM_BUCKETS; ++b) {
+      order[b] = b;
+    }
+    std::sort(order.begin(), order.end(), [&buckets](uint32_t const lhs, uint32_t const rhs) {
+      return buckets[lhs].size() != buckets[rhs].size() ? buckets[lhs].size() > buckets[rhs].size() : lhs < rhs;
+    });
+
+    std::array<bool, NUM_SLOTS> taken{};
+    std::vector<size_t> slots{};
+    for (uint32_t const b : order) {
+      if (buckets[b].empty()) {
+        break;
+      }
+      uint32_t displacement = 0;
+      for (;; ++displacement) {
+        if (displacement == MAX_DISPLACEMENT) {
+          return false;
+        }
+        slots.clear();
+        for (uint32_t const i : buckets[b]) {
+          size_t const slot = slot_of(hashes[i], displacement);
+          if (taken[slot] || std::find(slots.begin(), slots.end(), slot) != slots.end()) {
+            break;
+          }
+          slots.push_back(slot);
+        }
+        if (slots.size() == buckets[b].size()) {
+          break;
+        }
+      }
+      m_displacements[b] = displacement;
+      for (size_t j = 0; j < slots.size(); ++j) {
+        taken[slots[j]] = true;
+        m_slots[slots[j]] = entries[buckets[b][j]];
+      }
+    }
+    // Lookups of keys that aren't in the map can land on a free slot, and mustn't match it. The first key can't
+    // land there (it has its own slot), so it makes a safe filler.
+    for (size_t slot = 0; slot < NUM_SLOTS; ++slot) {
+      if (!taken[slot]) {
+        m_slots[slot] = Entry{ entries[0].first, Value{} };
+      }
+    }
+    return true;
+  }
+
+  uint64_t m_seed = 0;
+  std::array<uint32_t, NUM_BUCKETS> m_displacements{};
+  std::array<Entry, NUM_SLOTS> m_slots{};
+};
+
+// Builds a `StaticMap` from a braced list of entries, e.g. in a constexpr variable so the table is built at compile time:
+// `constexpr auto COMMANDS = cstr::make_static_map<Command>({ { "help", Command::HELP }, { "quit", Command::QUIT } });`
+template <std::semiregular Value, size_t N>
+[[nodiscard]] constexpr
+StaticMap<Value, N> make_static_map(std::pair<std::string_view, Value> const (&entries)[N]) {
+  return StaticMap<Value, N>(entries);
+}
+
 } // namespace cstr
 
 #endif // CPPLIB_CSTR_HPP
@@ -1,23 +1,82 @@
 #ifndef CPPLIB_PGM8_HPP
 #define CPPLIB_PGM8_HPP
 
+#include <array>
 #include <cinttypes>
 #include <fstream>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 // Module for reading and writing 8-bit PGM images.
 namespace pgm8 {
 
+// Interface for supplying pixel buffers to `Image`.
+class Allocator {
+public:
+  virtual ~Allocator() = default;
+
+  // Returns a buffer with room for at least `size` bytes.
+  [[nodiscard]] virtual uint8_t *allocate(size_t size) = 0;
+
+  // Gives back a buffer previously returned by `allocate(size)`.
+  virtual void deallocate(uint8_t *buffer, size_t size) noexcept = 0;
+};
+
+// Returns the allocator used by images which aren't given one, it uses plain `new[]` and `delete[]`.
+Allocator *default_allocator() noexcept;
+
+// Allocator which caches freed buffers in power-of-two size classes so they can be handed out again, giving zero steady-state heap allocations for loops which repeatedly load, copy and discard images of similar sizes. Buffers are aligned to `ALIGNMENT` bytes. Threadsafe. Must outlive any image using it.
+class BufferPool : public Allocator {
+public:
+  static constexpr size_t ALIGNMENT = 64;
+  // Smallest size class, smaller requests are rounded up to this.
+  static constexpr size_t MIN_CLASS_SIZE = 4096;
+
+  BufferPool() = default;
+  ~BufferPool() override;
+
+  BufferPool(BufferPool const &) = delete;
+  BufferPool &operator=(BufferPool const &) = delete;
+
+  [[nodiscard]] uint8_t *allocate(size_t size) override;
+  void deallocate(uint8_t *buffer, size_t size) noexcept override;
+
+  // Frees all cached buffers.
+  void release() noexcept;
+
+  // Returns the number of buffers currently cached.
+  [[nodiscard]] size_t cached() const noexcept;
+
+  // Returns the number of times the heap was hit because no cached buffer was available.
+  [[nodiscard]] size_t heap_allocations() const noexcept;
+
+private:
+  static constexpr size_t NUM_CLASSES = 48;
+
+  mutable std::mutex m_mutex{};
+  std::array<std::vector<uint8_t *>, NUM_CLASSES> m_freeLists{};
+  size_t m_heapAllocations = 0;
+};
+
 // Class for reading 8-bit PGM image files.
 class Image {
 public:
   Image() noexcept;
+  // Pixel buffers will be obtained from `allocator`, which must outlive the image.
+  explicit Image(Allocator *allocator) noexcept;
   Image(std::ifstream &file, bool loadPixels = true);
+  Image(std::ifstream &file, Allocator *allocator, bool loadPixels = true);
+  // Creates a `width` x `height` image with uninitialized pixels.
+  Image(uint16_t width, uint16_t height, uint8_t maxval, Allocator *allocator = nullptr);
   ~Image();
 
+  // Copy construction uses the same allocator as `other`, copy assignment keeps the current allocator and reuses the current pixel buffer if `other` fits.
   Image(Image const &other);                // copy constructor
   Image &operator=(Image const &other);     // copy assignment
+  // Moving transfers the pixel buffer along with the allocator it came from.
   Image(Image &&other) noexcept;            // move constructor
   Image &operator=(Image &&other) noexcept; // move assignment
 
@@ -26,8 +85,11 @@ public:
   [[nodiscard]] uint8_t  maxval() const noexcept;
   [[nodiscard]] uint8_t *pixels() const noexcept;
   [[nodiscard]] size_t   pixel_count() const noexcept;
+  [[nodiscard]] Allocator *allocator() const noexcept;
 
+  // Reuses the existing pixel buffer if the new image fits.
   void load(std::ifstream &file, bool loadPixels = true);
+  // Resets the image, giving its pixel buffer back to its allocator.
   void clear() noexcept;
 
   bool operator==(Image const &other) const noexcept;
@@ -38,6 +100,15 @@ private:
   uint16_t m_height;
   uint8_t  m_maxval;
   uint8_t *m_pixels;
+  // Number of pixels `m_pixels` has room for, allows `load` to reuse the existing buffer.
+  size_t   m_capacity;
+  Allocator *m_allocator;
+
+  // Ensures `m_pixels` has room for `pixelCount` pixels, contents are not preserved. If the allocation throws, the image is unchanged.
+  void reserve(size_t pixelCount);
+  void release_pixels() noexcept;
+
+  friend void rescale(Image &img, uint8_t newMaxval, size_t numThreads);
 };
 
 enum class Format {
@@ -45,8 +116,25 @@ enum class Format {
   PLAIN = 2,
   // Pixels stored in binary raster.
   RAW = 5,
+  // Pixels stored in independently compressed tiles (not part of the Netpbm spec, magic number is "PZ").
+  COMPRESSED = 'Z',
+};
+
+// Metadata from the header of a PGM file.
+struct Header {
+  Format   format;
+  uint16_t width;
+  uint16_t height;
+  uint8_t  maxval;
+  // Offset in bytes from the beginning of the file to the first pixel.
+  size_t   rasterOffset;
 };
 
+// Reads only the header of the PGM file at `pathname`, usually with a single read of the first few hundred bytes. Comments and arbitrary whitespace are handled as per the Netpbm spec.
+Header probe(char const *pathname);
+// Parses the PGM header at the beginning of `data`, throws if `data` ends before the header does.
+Header probe(uint8_t const *data, size_t size);
+
 void write(
   std::ofstream &file,
   uint16_t width,
@@ -56,6 +144,78 @@ void write(
   pgm8::Format format
 );
 
+// Writes a `Format::COMPRESSED` image split into `tileWidth` x `tileHeight` tiles. Smaller tiles make `load_region` cheaper at the cost of compression ratio. `file` should be opened in binary mode.
+void write_compressed(
+  std::ofstream &file,
+  uint16_t width,
+  uint16_t height,
+  uint8_t maxval,
+  uint8_t const *pixels,
+  uint16_t tileWidth = 64,
+  uint16_t tileHeight = 64
+);
+
+// Loads the `width` x `height` region at (`x`, `y`) of the image at `pathname`. For `Format::COMPRESSED` images only the tiles overlapping the region are read and decoded.
+Image load_region(
+  char const *pathname,
+  uint16_t x,
+  uint16_t y,
+  uint16_t width,
+  uint16_t height,
+  Allocator *allocator = nullptr
+);
+
+// Order in which `load_batch` hands loaded images to the caller.
+enum class Order {
+  // Images are handed over in the same order as their pathnames.
+  SUBMISSION,
+  // Images are handed over as soon as they finish loading.
+  COMPLETION,
+};
+
+// Loads every image in `pathnames` using a pool of `numThreads` worker threads. `onLoad` is invoked on the calling thread with the index of the pathname and its loaded image, which may be moved from. Once `onLoad` returns, the image's pixel buffer is recycled for subsequent loads. Pixel buffers are obtained from `allocator` (`default_allocator()` if null). If a file fails to load, the error is rethrown on the calling thread when that image's turn comes.
+void load_batch(
+  std::vector<std::string> const &pathnames,
+  std::function<void (size_t idx, Image &img)> const &onLoad,
+  Order order = Order::SUBMISSION,
+  size_t numThreads = std::thread::hardware_concurrency(),
+  Allocator *allocator = nullptr
+);
+
+// Image operations. Those taking `numThreads` split the work between that many threads (including the calling one), which only pays off for large images.
+
+// Returns the number of occurrences of each pixel value.
+std::array<size_t, 256> histogram(Image const &img, size_t numThreads = 1);
+
+// Replaces every pixel `p` with `lut[p]`.
+void apply_lut(
+  Image &img,
+  std::array<uint8_t, 256> const &lut,
+  size_t numThreads = 1
+);
+
+// Sets pixels greater than `threshold` to maxval and the rest to 0.
+void threshold(Image &img, uint8_t threshold, size_t numThreads = 1);
+
+// Scales pixel values from [0, maxval] to [0, `newMaxval`] (rounding to nearest) and makes `newMaxval` the new maxval.
+void rescale(Image &img, uint8_t newMaxval, size_t numThreads = 1);
+
+enum class Filter {
+  // Each destination pixel is the average of the source pixels it covers.
+  BOX,
+  // Each destination pixel is interpolated from the 4 nearest source pixels.
+  BILINEAR,
+};
+
+// Returns a copy of `img` resampled to `width` x `height`, which must not be larger than `img`. The result uses the same allocator as `img`.
+Image downsample(
+  Image const &img,
+  uint16_t width,
+  uint16_t height,
+  Filter filter,
+  size_t numThreads = 1
+);
+
 } // namespace pgm8
 
 #endif // CPPLIB_PGM8_HPP
@@ -1,8 +1,15 @@
 #ifndef CPPLIB_REGEXGLOB_H
 #define CPPLIB_REGEXGLOB_H
 
+#include <array>
+#include <chrono>
+#include <cinttypes>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <regex>
+#include <string>
+#include <string_view>
 #include <vector>
 
 // Module for file matching using regular expressions.
@@ -17,12 +24,261 @@ void homogenize_path_separators(std::string &path, char const sep);
 
 void set_ofstream(std::ofstream *);
 
+// A filename pattern (ECMAScript regular expression, same as `std::regex`) compiled once for fast repeated matching.
+class Pattern {
+public:
+  enum class Engine {
+    // Pattern is a literal, optionally with leading and/or trailing `.*`, e.g. `.*\.pgm`, matched with memcmp.
+    LITERAL,
+    // Pattern compiled into a DFA, a table lookup per character.
+    DFA,
+    // Pattern uses constructs the DFA doesn't support (backreferences, lookaheads, word boundaries, ...), matched with `std::regex`.
+    STD_REGEX,
+  };
+
+  // Throws `std::regex_error` if `regex` is invalid.
+  explicit Pattern(char const *regex);
+
+  // True if the whole of `name` matches, equivalent to `std::regex_match`.
+  [[nodiscard]] bool matches(std::string_view name) const;
+  [[nodiscard]] Engine engine() const noexcept;
+
+private:
+  enum class LiteralKind : uint8_t { EXACT, PREFIX, SUFFIX, CONTAINS, ANY };
+
+  Engine m_engine;
+  LiteralKind m_literalKind;
+  // For LITERAL, the literal. For DFA, literal characters every match starts/ends with, checked before running the DFA.
+  std::string m_prefix;
+  std::string m_suffix;
+  // DFA state 0 is dead (no match possible), transitions are indexed by `state * m_numClasses + m_byteClasses[c]`.
+  std::array<uint8_t, 256> m_byteClasses;
+  uint32_t m_numClasses;
+  uint32_t m_startState;
+  std::vector<uint32_t> m_transitions;
+  std::vector<uint8_t> m_accepting;
+  std::regex m_regex;
+};
+
+// Several patterns compiled into a single DFA, so matching a name costs about the same however many patterns there are.
+class PatternSet {
+public:
+  // Throws `std::regex_error` if any of `regexes` is invalid.
+  explicit PatternSet(std::vector<std::string> const &regexes);
+
+  // Sets `out` to the indices (into the constructor's `regexes`) of the patterns the whole of `name` matches, ascending.
+  void matches(std::string_view name, std::vector<size_t> &out) const;
+  [[nodiscard]] size_t size() const noexcept;
+  // Number of patterns which couldn't be part of the DFA (see `Pattern::Engine::STD_REGEX`) and are matched one at a time.
+  [[nodiscard]] size_t num_separate() const noexcept;
+
+private:
+  size_t m_size;
+  // Same layout as `Pattern`'s DFA.
+  std::array<uint8_t, 256> m_byteClasses;
+  uint32_t m_numClasses;
+  uint32_t m_startState;
+  std::vector<uint32_t> m_transitions;
+  // Patterns accepted in state `s` are `m_acceptIds[m_acceptOffsets[s] .. m_acceptOffsets[s + 1]]`.
+  std::vector<uint32_t> m_acceptOffsets;
+  std::vector<uint32_t> m_acceptIds;
+  std::vector<Pattern> m_separate;
+  std::vector<uint32_t> m_separateIds;
+};
+
+// List of file paths stored compactly: each path's directory is only stored again if it differs from the previous path's, and everything lives in one buffer, so there's no allocation per path.
+class PathList {
+public:
+  [[nodiscard]] size_t size() const noexcept;
+  [[nodiscard]] bool empty() const noexcept;
+  // Directory part of the `i`th path, including the trailing separator.
+  [[nodiscard]] std::string_view dir(size_t i) const noexcept;
+  [[nodiscard]] std::string_view name(size_t i) const noexcept;
+  [[nodiscard]] std::string path(size_t i) const;
+  [[nodiscard]] std::vector<std::filesystem::path> to_paths() const;
+  // Bytes of heap memory held by the list.
+  [[nodiscard]] size_t memory_usage() const noexcept;
+
+  // Adds `dir` + `name`, `dir` must end with a separator.
+  void push_back(std::string_view dir, std::string_view name);
+  // Adds all of `other`'s paths.
+  void append(PathList const &other);
+  // Sorts paths in the same order as sorting their full path strings would.
+  void sort();
+  void clear() noexcept;
+
+private:
+  struct Dir {
+    size_t offset;
+    size_t length;
+  };
+  struct Entry {
+    size_t nameOffset;
+    // Index into `m_dirs`.
+    uint32_t dir;
+    uint32_t nameLength;
+  };
+
+  std::string m_buffer;
+  std::vector<Dir> m_dirs;
+  std::vector<Entry> m_entries;
+};
+
+// Counters for a walk of the tree, see `Options::stats`.
+struct Stats {
+  size_t dirsRead = 0;
+  // Directories which couldn't be read, e.g. due to permissions.
+  size_t dirsSkipped = 0;
+  // Subdirectories not descended into due to `maxDepth` or `excludeDirs`.
+  size_t dirsPruned = 0;
+  size_t filesChecked = 0;
+  // For `fmatch_multi`, summed over all patterns.
+  size_t matches = 0;
+  // Summed over all threads. Matching includes everything done with a file once it's been read (e.g. collecting the match or calling `fmatch_each`'s callback), reading is the rest.
+  std::chrono::nanoseconds readTime{};
+  std::chrono::nanoseconds matchTime{};
+};
+
+// Controls how `fmatch` and friends traverse the tree.
+struct Options {
+  // Number of threads traversing directories, each directory is a separate unit of work which idle threads steal from busy ones.
+  size_t numThreads = 1;
+  // If true, matches are sorted, otherwise they are in no particular order (which varies between runs when `numThreads` > 1).
+  bool sorted = false;
+  // Stop walking once this many matches have been found, 0 means no limit. When `numThreads` > 1, which matches make the cut varies between runs.
+  size_t maxMatches = 0;
+  // Subdirectories more than this many levels below `root` aren't read, 0 means only files directly inside `root` are checked.
+  size_t maxDepth = SIZE_MAX;
+  // Directories matching any of these patterns are skipped without being read, along with everything below them, e.g. `\.git|node_modules`.
+  std::vector<std::string> excludeDirs = {};
+  // If not empty, only files directly inside `root` or inside a directory matching one of these patterns (at any depth, and everything below it) are checked. Other directories are still read to find matching ones further down. `excludeDirs` still applies inside them.
+  std::vector<std::string> includeDirs = {};
+  // If true, file and directory patterns are matched against paths relative to `root` (using the preferred separator, e.g. `src/.*\.cpp`) instead of names.
+  bool matchRelativePaths = false;
+  // If not null, filled in with counters for the walk, at the cost of two clock reads per file.
+  Stats *stats = nullptr;
+};
+
 // Matches any files starting from `root` (including those in subdirectories) using the `filePattern` regular expression.
 std::vector<std::filesystem::path> fmatch(
   char const *root,
   char const *filePattern
 );
 
+// Matches any files starting from `root` (including those in subdirectories) using the `filePattern` regular expression.
+std::vector<std::filesystem::path> fmatch(
+  char const *root,
+  char const *filePattern,
+  Options const &options
+);
+
+// Like `fmatch`, but returns matches as a `PathList`, which takes a fraction of the memory for large results.
+PathList fmatch_compact(
+  char const *root,
+  char const *filePattern,
+  Options const &options = {}
+);
+
+// Like `fmatch`, but calls `onMatch` with each match as soon as it is found instead of collecting them. Calls are never concurrent (even when `options.numThreads` > 1), and the walk stops as soon as `onMatch` returns false or `options.maxMatches` is reached. `options.sorted` is ignored. Returns the number of matches passed to `onMatch`.
+size_t fmatch_each(
+  char const *root,
+  char const *filePattern,
+  std::function<bool (std::filesystem::path const &)> const &onMatch,
+  Options const &options = {}
+);
+
+// Matches files against each of `filePatterns` in a single walk of the tree, returns the matches of each pattern (in the same order as `filePatterns`). With `options.maxMatches`, each pattern gets at most that many matches and the walk stops once all of them have.
+std::vector<std::vector<std::filesystem::path>> fmatch_multi(
+  char const *root,
+  std::vector<std::string> const &filePatterns,
+  Options const &options = {}
+);
+
+// A file matched by `fmatch_info`, with its metadata.
+struct FileInfo {
+  std::filesystem::path path;
+  // Of the file itself, symlinks aren't followed. `not_found` if the file couldn't be stat'ed (e.g. removed since it was matched), in which case the other fields are zero.
+  std::filesystem::file_type type;
+  uint64_t size;
+  std::filesystem::file_time_type lastWriteTime;
+};
+
+// How `fmatch_info` stats the matched files.
+enum class StatMethod {
+  // Currently `THREADS`, which is faster on warm caches.
+  AUTO,
+  // Opt-in: submits the stat calls in batches through an io_uring (Linux 5.6+), keeping many in flight on a single thread. Falls back to `THREADS` if the kernel doesn't support it.
+  IO_URING,
+  // Splits the matches between `options.numThreads` threads, each making one blocking stat call at a time.
+  THREADS,
+};
+
+// Like `fmatch`, but also returns the type, size and last write time of each match. The metadata is fetched once the walk is done, as set out by `method`.
+std::vector<FileInfo> fmatch_info(
+  char const *root,
+  char const *filePattern,
+  Options const &options = {},
+  StatMethod method = StatMethod::AUTO
+);
+
+// Snapshot of the files under a directory tree which can be saved to disk, so later queries only re-read directories that changed since (detected by their modification time, which changes when entries are added, removed or renamed).
+class Index {
+public:
+  // Throws if `root` is not a directory. The index starts out empty, call `refresh` or `load` to fill it.
+  explicit Index(char const *root);
+
+  // Brings the index up to date by checking the modification time of every indexed directory, only reading those that changed (and new ones). Returns the number of directories read.
+  size_t refresh();
+
+  // Writes the index to `pathname`, throws if the file can't be written.
+  void save(char const *pathname) const;
+  // Replaces the index with one saved by `save`. Returns false (leaving the index empty) if `pathname` doesn't exist, isn't a valid index or was saved for a different root.
+  bool load(char const *pathname);
+
+  // Same as `regexglob::fmatch`, but answered from the index without touching the filesystem. `options.numThreads` is ignored, and in `options.stats` (and the log) `dirsRead` and `readTime` are always 0.
+  [[nodiscard]] std::vector<std::filesystem::path> fmatch(
+    char const *filePattern,
+    Options const &options = {}
+  ) const;
+
+  [[nodiscard]] size_t num_dirs() const noexcept;
+  [[nodiscard]] size_t num_files() const noexcept;
+
+private:
+  struct Dir {
+    std::string name;
+    // `last_write_time` when the directory was read, in file clock ticks.
+    int64_t mtime;
+    std::vector<std::string> files;
+    // Indices into `m_dirs`.
+    std::vector<uint32_t> subdirs;
+  };
+
+  std::string m_root;
+  // `m_dirs[0]` is the root, if the index isn't empty.
+  std::vector<Dir> m_dirs;
+};
+
+// A line of a file matched by `fsearch`.
+struct LineMatch {
+  std::filesystem::path path;
+  // 1-based.
+  size_t lineNumber;
+  // Byte offset of the start of the line within the file.
+  size_t offset;
+  // Without the line terminator.
+  std::string line;
+};
+
+// Searches the contents of the files `fmatch` would match for lines containing a match of the `contentPattern` regular expression (like `std::regex_search` on each line, `^` and `$` anchor to the line). Lines without a literal part of `contentPattern` are skipped before running the full pattern. With `options.numThreads` > 1 matching files are queued and searched by all the threads (so a directory of many files isn't left to the one that read it), a 1 MiB chunk of whole lines at a time. At most `maxMatchesPerFile` (0 means no limit) lines are reported per file, and `options.maxMatches` limits the total.
+std::vector<LineMatch> fsearch(
+  char const *root,
+  char const *filePattern,
+  char const *contentPattern,
+  Options const &options = {},
+  size_t maxMatchesPerFile = 0
+);
+
 } // namespace regexglob
 
 #endif // CPPLIB_REGEXGLOB_H
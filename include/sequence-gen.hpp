@@ -1,106 +1,769 @@
 #ifndef CPPLIB_SEQUENCEGEN_HPP
 #define CPPLIB_SEQUENCEGEN_HPP
 
+#include <algorithm>
+#include <array>
 #include <concepts>
 #include <cinttypes>
-#include <cstring>
-#include <memory>
-#include <regex>
-#include <sstream>
+#include <compare>
+#include <cstddef>
+#include <iterator>
+#include <limits>
+#include <span>
+#include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 #include "cstr.hpp"
+#include "on-scope-exit.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SEQGEN_SSE2 1
+#else
+#define SEQGEN_SSE2 0
+#endif
 
 // Module for generating long, semi-complex integer sequences using a simple and
 // concise syntax.
 namespace seqgen {
 
-// Populates a block of memory using a pattern. The caller is responsible in ensuring `out` has enough room for the sequence described by `pattern`.
+namespace detail {
+
+// A string literal usable as a template argument, e.g. `seqgen::generate<int, "1..3">()`.
+template <size_t Size>
+struct Literal {
+  char chars[Size];
+
+  constexpr Literal(char const (&str)[Size]) noexcept {
+    for (size_t i = 0; i < Size; ++i) {
+      chars[i] = str[i];
+    }
+  }
+};
+
+// Parses `[1-9][0-9]*` at `pos` into `out`, setting `outOfRange` if it doesn't fit. Returns false if there's no such number.
+template <typename Int>
+constexpr
+bool parse_positive(std::string_view const text, size_t &pos, Int &out, bool &outOfRange) noexcept {
+  if (pos == text.size() || text[pos] < '1' || text[pos] > '9') {
+    return false;
+  }
+  auto const result = cstr::parse_int<Int>(text.substr(pos));
+  pos += result.length;
+  out = result.value;
+  outOfRange = outOfRange || result.error == cstr::ParseError::OUT_OF_RANGE;
+  return true;
+}
+
+// Parses `{k}` (with a positive `k`) at `pos`, like `parse_positive`.
+constexpr
+bool parse_repeats(std::string_view const text, size_t &pos, size_t &out, bool &outOfRange) noexcept {
+  if (pos == text.size() || text[pos] != '{') {
+    return false;
+  }
+  ++pos;
+  if (!parse_positive(text, pos, out, outOfRange) || pos == text.size() || text[pos] != '}') {
+    return false;
+  }
+  ++pos;
+  return true;
+}
+
+// Outputs of at least this many bytes are written around the cache, since they wouldn't fit in it anyway and reading every line in before overwriting it costs as much as the write.
+inline constexpr size_t STREAMING_THRESHOLD = 32 * 1024 * 1024;
+
+#if SEQGEN_SSE2
+template <size_t Size>
+__m128i add_lanes(__m128i const a, __m128i const b) noexcept {
+  if constexpr (Size == 1) {
+    return _mm_add_epi8(a, b);
+  } else if constexpr (Size == 2) {
+    return _mm_add_epi16(a, b);
+  } else if constexpr (Size == 4) {
+    return _mm_add_epi32(a, b);
+  } else {
+    return _mm_add_epi64(a, b);
+  }
+}
+
+// Writes the bulk of `fill_progression`'s output 64 bytes at a time, returns the number of elements written (always a prefix of `out`).
+template <typename UTy>
+size_t fill_progression_sse2(UTy *const out, size_t const count, UTy const first, UTy const step) noexcept {
+  constexpr size_t LANES = 16 / sizeof(UTy);
+  // unsigned arithmetic wide enough that promotions can't overflow
+  auto const nth = [first, step](size_t const i) {
+    return static_cast<UTy>(static_cast<uintmax_t>(first) + static_cast<uintmax_t>(i) * static_cast<uintmax_t>(step));
+  };
+
+  size_t i = 0;
+  while (i < count && reinterpret_cast<uintptr_t>(out + i) % 16 != 0) {
+    out[i] = nth(i);
+    ++i;
+  }
+  if (count - i < 4 * LANES) {
+    return i;
+  }
+
+  UTy lanes[LANES];
+  for (size_t lane = 0; lane < LANES; ++lane) {
+    lanes[lane] = nth(i + lane);
+  }
+  __m128i v0 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(lanes));
+  for (size_t lane = 0; lane < LANES; ++lane) {
+    lanes[lane] = static_cast<UTy>(static_cast<uintmax_t>(LANES) * static_cast<uintmax_t>(step));
+  }
+  __m128i const inc = _mm_loadu_si128(reinterpret_cast<__m128i const *>(lanes));
+  __m128i const inc4 = add_lanes<sizeof(UTy)>(add_lanes<sizeof(UTy)>(inc, inc), add_lanes<sizeof(UTy)>(inc, inc));
+  __m128i v1 = add_lanes<sizeof(UTy)>(v0, inc);
+  __m128i v2 = add_lanes<sizeof(UTy)>(v1, inc);
+  __m128i v3 = add_lanes<sizeof(UTy)>(v2, inc);
+
+  size_t const end = i + (count - i) / (4 * LANES) * (4 * LANES);
+  __m128i *dest = reinterpret_cast<__m128i *>(out + i);
+  __m128i *const destEnd = reinterpret_cast<__m128i *>(out + end);
+
+  auto const loop = [&](auto const store) {
+    for (; dest != destEnd; dest += 4) {
+      store(dest + 0, v0);
+      store(dest + 1, v1);
+      store(dest + 2, v2);
+      store(dest + 3, v3);
+      v0 = add_lanes<sizeof(UTy)>(v0, inc4);
+      v1 = add_lanes<sizeof(UTy)>(v1, inc4);
+      v2 = add_lanes<sizeof(UTy)>(v2, inc4);
+      v3 = add_lanes<sizeof(UTy)>(v3, inc4);
+    }
+  };
+  if ((end - i) * sizeof(UTy) >= STREAMING_THRESHOLD) {
+    loop([](__m128i *const p, __m128i const v) { _mm_stream_si128(p, v); });
+    _mm_sfence();
+  } else {
+    loop([](__m128i *const p, __m128i const v) { _mm_store_si128(p, v); });
+  }
+
+  return end;
+}
+#endif
+
+// Writes `first`, `first + step`, `first + 2 * step`, ... (wrapping around on overflow) to `out[0..count)`. A `step` of 0 fills.
+template <typename Ty>
+constexpr
+void fill_progression(Ty *const out, size_t const count, Ty const first, Ty const step) noexcept {
+  using UTy = std::make_unsigned_t<Ty>;
+  UTy n = static_cast<UTy>(first);
+  size_t i = 0;
+
+#if SEQGEN_SSE2
+  if (!std::is_constant_evaluated()) {
+    i = fill_progression_sse2(
+      reinterpret_cast<UTy *>(out), count, n, static_cast<UTy>(step)
+    );
+    n = static_cast<UTy>(
+      static_cast<uintmax_t>(n) + static_cast<uintmax_t>(i) * static_cast<uintmax_t>(static_cast<UTy>(step))
+    );
+  }
+#endif
+
+  for (; i < count; ++i) {
+    out[i] = static_cast<Ty>(n);
+    n = static_cast<UTy>(n + static_cast<UTy>(step));
+  }
+}
+
+} // namespace detail
+
+// A pattern parsed once, which can then populate any number of buffers without being parsed again. Usable in constant expressions, where syntax errors become compile errors.
+//
+// A pattern is a comma-separated list of pieces:
+// - `n`: the number `n`
+// - `n{k}`: `n` repeated `k` times
+// - `a..b`: every number from `a` to `b` inclusive, in either direction
+// - `a..b:s`: every `s`th number from `a` towards `b`, stopping before passing `b`
+// - `a+d{k}`, `a-d{k}`: arithmetic progression of `k` numbers starting at `a` with difference `d`
+// - `a*r{k}`: geometric progression of `k` numbers starting at `a` with ratio `r`
+// - `(pieces){k}`: `pieces` repeated `k` times, groups can be nested
+// Arithmetic wraps around at the limits of `Ty`.
 template <typename Ty>
 requires std::integral<Ty> && (std::is_same<Ty, bool>::value == false)
-void populate(Ty *const out, char const *const pattern) {
-  if (cstr::len(pattern) == 0) {
-    throw std::runtime_error("empty pattern");
+class Pattern {
+  struct Op;
+
+public:
+  // Generates elements on demand, without materializing the sequence. Invalidated if the pattern is moved or destroyed.
+  class const_iterator {
+  public:
+    using iterator_concept = std::random_access_iterator_tag;
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = Ty;
+    using difference_type = ptrdiff_t;
+    // elements don't exist in memory, so they're returned by value
+    using reference = Ty;
+    using pointer = void;
+
+    constexpr const_iterator() noexcept = default;
+
+    constexpr Ty operator*() const noexcept {
+      Op const &op = m_pattern->m_ops[m_opIdx];
+      return m_pattern->element(op, m_idx - op.offset);
+    }
+    constexpr Ty operator[](difference_type const n) const noexcept {
+      return *(*this + n);
+    }
+
+    constexpr const_iterator &operator++() noexcept {
+      ++m_idx;
+      Op const &op = m_pattern->m_ops[m_opIdx];
+      if (m_idx == op.offset + op.count && m_idx != m_pattern->m_size) {
+        ++m_opIdx;
+      }
+      return *this;
+    }
+    constexpr const_iterator operator++(int) noexcept {
+      const_iterator const copy = *this;
+      ++*this;
+      return copy;
+    }
+    constexpr const_iterator &operator--() noexcept {
+      --m_idx;
+      if (m_idx < m_pattern->m_ops[m_opIdx].offset) {
+        --m_opIdx;
+      }
+      return *this;
+    }
+    constexpr const_iterator operator--(int) noexcept {
+      const_iterator const copy = *this;
+      --*this;
+      return copy;
+    }
+
+    constexpr const_iterator &operator+=(difference_type const n) noexcept {
+      m_idx = static_cast<size_t>(static_cast<difference_type>(m_idx) + n);
+      m_opIdx = m_pattern->top_level_op(m_idx);
+      return *this;
+    }
+    constexpr const_iterator &operator-=(difference_type const n) noexcept {
+      return *this += -n;
+    }
+    constexpr friend const_iterator operator+(const_iterator it, difference_type const n) noexcept {
+      return it += n;
+    }
+    constexpr friend const_iterator operator+(difference_type const n, const_iterator it) noexcept {
+      return it += n;
+    }
+    constexpr friend const_iterator operator-(const_iterator it, difference_type const n) noexcept {
+      return it -= n;
+    }
+    constexpr friend difference_type operator-(const_iterator const &lhs, const_iterator const &rhs) noexcept {
+      return static_cast<difference_type>(lhs.m_idx) - static_cast<difference_type>(rhs.m_idx);
+    }
+
+    constexpr friend bool operator==(const_iterator const &lhs, const_iterator const &rhs) noexcept {
+      return lhs.m_idx == rhs.m_idx;
+    }
+    constexpr friend auto operator<=>(const_iterator const &lhs, const_iterator const &rhs) noexcept {
+      return lhs.m_idx <=> rhs.m_idx;
+    }
+
+  private:
+    friend class Pattern;
+
+    constexpr const_iterator(Pattern const *const pattern, size_t const idx) noexcept
+      : m_pattern(pattern), m_idx(idx), m_opIdx(pattern->top_level_op(idx)) {}
+
+    Pattern const *m_pattern = nullptr;
+    size_t m_idx = 0;
+    // Top-level op producing element `m_idx`, or the last one for the end iterator.
+    size_t m_opIdx = 0;
+  };
+
+  // Throws `std::runtime_error` if `pattern` is empty or has invalid syntax.
+  constexpr explicit Pattern(char const *pattern);
+
+  // Number of elements the pattern describes.
+  [[nodiscard]] constexpr size_t size() const noexcept {
+    return m_size;
   }
 
-  auto const pattern_ = [pattern]() {
-    size_t const len = cstr::len(pattern) + 1; // +1 for NUL
-    char *buf = new char[len];
-    std::strncpy(buf, pattern, len);
-    return std::unique_ptr<char []>(buf);
-  }();
+  // Writes the sequence to `out`, which must have room for `size()` elements.
+  constexpr void populate(Ty *const out) const noexcept {
+    write(m_top, m_ops.size(), 0, out, m_size);
+  }
 
-  cstr::remove_spaces(pattern_.get());
+  // Like `populate(out)`, but splits the output between `numThreads` threads (the calling one included) which generate their parts independently. Only worth it for outputs much larger than the cache, small ones are generated on the calling thread.
+  void populate(Ty *out, size_t numThreads) const;
 
-  if (cstr::len(pattern_.get()) == 0) {
-    throw std::runtime_error("empty pattern");
+  // Writes the sequence to the start of `out`, returns the number of elements written (`size()`). Throws `std::runtime_error`, without writing anything, if `out` is too small.
+  constexpr size_t populate(std::span<Ty> const out) const {
+    if (out.size() < m_size) {
+      throw std::runtime_error(
+        "output has room for " + std::to_string(out.size()) +
+        " elements, pattern needs " + std::to_string(m_size)
+      );
+    }
+    populate(out.data());
+    return m_size;
+  }
+
+  // Returns element `idx` (which must be less than `size()`) in O(log pieces) per level of grouping, without generating the ones before it.
+  [[nodiscard]] constexpr Ty operator[](size_t const idx) const noexcept {
+    Op const &op = m_ops[top_level_op(idx)];
+    return element(op, idx - op.offset);
+  }
+
+  // Writes elements `[first, first + out.size())` (stopping at the end of the sequence) to `out`, returns the number written. Lets a long sequence be processed in chunks through a fixed buffer.
+  constexpr size_t extract(size_t const first, std::span<Ty> const out) const noexcept {
+    if (first >= m_size) {
+      return 0;
+    }
+    size_t const numToWrite = std::min(out.size(), m_size - first);
+    write(m_top, m_ops.size(), first, out.data(), numToWrite);
+    return numToWrite;
   }
 
-  std::regex const singleNum("^-?[0-9]+$");
-  std::regex const repeatedNum("^-?[0-9]+\\{[1-9][0-9]*\\}$");
-  std::regex const range("^-?[0-9]+\\.\\.-?[0-9]+$");
+  [[nodiscard]] constexpr const_iterator begin() const noexcept {
+    return const_iterator(this, 0);
+  }
+  [[nodiscard]] constexpr const_iterator end() const noexcept {
+    return const_iterator(this, m_size);
+  }
+
+private:
+  struct Op {
+    enum class Kind : uint8_t {
+      // `n`
+      LITERAL,
+      // `n{k}`
+      REPEAT,
+      // Arithmetic progression: `a..b`, `a..b:s`, `a+d{k}`, `a-d{k}`
+      RANGE,
+      // `a*r{k}`
+      GEOMETRIC,
+      // `(pieces){k}`
+      GROUP,
+    };
+
+    Kind kind;
+    Ty first;
+    // Difference of a `RANGE`, ratio of a `GEOMETRIC`.
+    Ty step;
+    size_t count;
+    // Index of the op's first element within its sequence (the whole pattern or a group's body).
+    size_t offset;
+    // Of a `GROUP`: its body is `m_ops[bodyBegin, bodyEnd)`, `bodySize` elements long.
+    size_t bodyBegin;
+    size_t bodyEnd;
+    size_t bodySize;
+  };
+
+  // Groups nested deeper than this are rejected rather than risking the stack.
+  static constexpr unsigned MAX_DEPTH = 32;
+
+  // Index of the op of the sequence `m_ops[begin, end)` producing its element `idx` (ops are sorted by offset).
+  constexpr size_t op_containing(size_t const begin, size_t const end, size_t const idx) const noexcept {
+    auto const after = std::upper_bound(
+      m_ops.begin() + static_cast<ptrdiff_t>(begin),
+      m_ops.begin() + static_cast<ptrdiff_t>(end),
+      idx,
+      [](size_t const i, Op const &op) { return i < op.offset; }
+    );
+    return static_cast<size_t>(after - m_ops.begin()) - 1;
+  }
+
+  // Like `op_containing` for the whole pattern, `idx` may be past the end.
+  constexpr size_t top_level_op(size_t const idx) const noexcept {
+    return m_size == 0 ? m_top : op_containing(m_top, m_ops.size(), std::min(idx, m_size - 1));
+  }
+
+  // Element `idx` of `op`.
+  constexpr Ty element(Op const &op, size_t idx) const noexcept;
+
+  // Writes elements `[first, first + n)` of the sequence `m_ops[begin, end)` to `out`.
+  constexpr void write(size_t begin, size_t end, size_t first, Ty *out, size_t n) const noexcept;
+
+  // Parses pieces up to the end of `text` (or the `)` closing a group when `depth` > 0) into `ops`, returns the number of elements they describe.
+  constexpr size_t parse_sequence(std::string_view text, size_t &pos, std::vector<Op> &ops, unsigned depth);
+
+  // Parses the piece starting at `pos` (which doesn't start a group) into `op`, returns false if its syntax is invalid.
+  [[nodiscard]] static constexpr bool parse_piece(std::string_view text, size_t &pos, Op &op, bool &outOfRange);
+
+  std::vector<Op> m_ops{};
+  // `m_ops[m_top, m_ops.size())` is the top-level sequence, group bodies come before it.
+  size_t m_top = 0;
+  size_t m_size = 0;
+};
+
+template <typename Ty>
+requires std::integral<Ty> && (std::is_same<Ty, bool>::value == false)
+constexpr Pattern<Ty>::Pattern(char const *const pattern) {
+  std::string text(pattern);
+  cstr::remove_spaces(text.data());
+  text.resize(cstr::len(text.c_str()));
+  if (text.empty()) {
+    throw std::runtime_error("empty pattern");
+  }
 
+  std::vector<Op> top{};
   size_t pos = 0;
+  m_size = parse_sequence(text, pos, top, 0);
+  m_top = m_ops.size();
+  m_ops.insert(m_ops.end(), top.begin(), top.end());
+}
 
-  char *piece = std::strtok(pattern_.get(), ",");
-  while (piece != nullptr) {
-    auto const parseNum = [](char const *const str) {
-      if constexpr (std::is_signed_v<Ty>) {
-        // TODO: maybe replace with std::strtoimax?
-        return static_cast<Ty>(std::stoll(str));
-      } else {
-        // TODO: maybe replace with std::strtoumax?
-        return static_cast<Ty>(std::stoull(str));
+template <typename Ty>
+requires std::integral<Ty> && (std::is_same<Ty, bool>::value == false)
+constexpr size_t Pattern<Ty>::parse_sequence(
+  std::string_view const text,
+  size_t &pos,
+  std::vector<Op> &ops,
+  unsigned const depth
+) {
+  // text of the piece starting at `start`, for errors
+  auto const pieceAt = [text, depth](size_t const start) {
+    size_t end = start;
+    for (unsigned nesting = 0; end < text.size(); ++end) {
+      char const c = text[end];
+      if (nesting == 0 && (c == ',' || (c == ')' && depth > 0))) {
+        break;
       }
-    };
+      nesting += c == '(';
+      nesting -= c == ')' && nesting > 0;
+    }
+    return std::string(text.substr(start, end - start));
+  };
+  auto const invalid = [&pieceAt](size_t const start) {
+    return std::runtime_error("piece `" + pieceAt(start) + "` has invalid syntax");
+  };
+  auto const isEnd = [text, depth](size_t const p) {
+    return p == text.size() || text[p] == ',' || (text[p] == ')' && depth > 0);
+  };
+
+  size_t size = 0;
+  for (;;) {
+    size_t const start = pos;
+    // like `strtok`, empty pieces are skipped
+    if (!isEnd(pos)) {
+      Op op{};
+      bool outOfRange = false;
+
+      if (text[pos] == '(') {
+        if (depth == MAX_DEPTH) {
+          throw std::runtime_error("piece `" + pieceAt(start) + "` nests groups too deeply");
+        }
+        ++pos;
+        std::vector<Op> body{};
+        op.kind = Op::Kind::GROUP;
+        op.bodySize = parse_sequence(text, pos, body, depth + 1);
+        if (op.bodySize == 0 || pos == text.size() || text[pos] != ')') {
+          throw invalid(start);
+        }
+        ++pos;
+        size_t repeats = 0;
+        if (!detail::parse_repeats(text, pos, repeats, outOfRange) || !isEnd(pos)) {
+          throw invalid(start);
+        }
+        if (repeats > SIZE_MAX / op.bodySize) {
+          throw std::runtime_error("piece `" + pieceAt(start) + "` is too large");
+        }
+        op.count = repeats * op.bodySize;
+        op.bodyBegin = m_ops.size();
+        m_ops.insert(m_ops.end(), body.begin(), body.end());
+        op.bodyEnd = m_ops.size();
+      } else if (!parse_piece(text, pos, op, outOfRange) || !isEnd(pos)) {
+        throw invalid(start);
+      }
+
+      if (outOfRange) {
+        throw std::runtime_error("number in piece `" + pieceAt(start) + "` is out of range");
+      }
+      if (op.count > SIZE_MAX - size) {
+        throw std::runtime_error("pattern is too large");
+      }
+      op.offset = size;
+      size += op.count;
+      ops.push_back(op);
+    }
+
+    if (pos == text.size() || text[pos] == ')') {
+      return size;
+    }
+    ++pos; // ','
+  }
+}
+
+template <typename Ty>
+requires std::integral<Ty> && (std::is_same<Ty, bool>::value == false)
+constexpr bool Pattern<Ty>::parse_piece(
+  std::string_view const text,
+  size_t &pos,
+  Op &op,
+  bool &outOfRange
+) {
+  using UTy = std::make_unsigned_t<Ty>;
+  size_t const start = pos;
+
+  // -?[0-9]+, converted to `Ty` the way `std::stoll`/`std::stoull` followed by a `static_cast` would
+  auto const parseNum = [text, &pos, &outOfRange](Ty &out) {
+    bool const negative = pos < text.size() && text[pos] == '-';
+    pos += negative;
+
+    auto const result = cstr::parse_int<uintmax_t>(text.substr(pos));
+    if (result.error == cstr::ParseError::NO_DIGITS) {
+      return false;
+    }
+    pos += result.length;
+    outOfRange = outOfRange || result.error == cstr::ParseError::OUT_OF_RANGE;
+    uintmax_t const magnitude = result.value;
+
+    if constexpr (std::is_signed_v<Ty>) {
+      uintmax_t const limit = static_cast<uintmax_t>(std::numeric_limits<intmax_t>::max()) + negative;
+      outOfRange = outOfRange || magnitude > limit;
+    }
+    out = static_cast<Ty>(negative ? 0 - magnitude : magnitude);
+    return true;
+  };
+  auto const parseRepeats = [text, &pos, &outOfRange](size_t &out) {
+    return detail::parse_repeats(text, pos, out, outOfRange);
+  };
+
+  if (!parseNum(op.first)) {
+    return false;
+  }
+
+  if (pos == text.size() || text[pos] == ',' || text[pos] == ')') {
+    op.kind = Op::Kind::LITERAL;
+    op.count = 1;
+    return true;
+  }
+
+  switch (text[pos]) {
+    case '{':
+      op.kind = Op::Kind::REPEAT;
+      return parseRepeats(op.count);
+
+    case '+':
+    case '-': {
+      bool const negative = text[pos] == '-';
+      ++pos;
+      uintmax_t difference = 0;
+      if (!detail::parse_positive(text, pos, difference, outOfRange) || !parseRepeats(op.count)) {
+        return false;
+      }
+      op.kind = Op::Kind::RANGE;
+      op.step = static_cast<Ty>(static_cast<UTy>(negative ? 0 - difference : difference));
+      return true;
+    }
+
+    case '*': {
+      ++pos;
+      op.kind = Op::Kind::GEOMETRIC;
+      return parseNum(op.step) && parseRepeats(op.count);
+    }
+
+    case '.': {
+      if (text.substr(pos, 2) != "..") {
+        return false;
+      }
+      pos += 2;
+      Ty last{};
+      if (!parseNum(last)) {
+        return false;
+      }
+      uintmax_t stride = 1;
+      if (pos < text.size() && text[pos] == ':') {
+        ++pos;
+        if (!detail::parse_positive(text, pos, stride, outOfRange)) {
+          return false;
+        }
+      }
+      if (outOfRange) {
+        // the count below would be meaningless
+        op.count = 1;
+        return true;
+      }
+
+      bool const descending = !(op.first < last);
+      UTy const distance = descending
+        ? static_cast<UTy>(static_cast<UTy>(op.first) - static_cast<UTy>(last))
+        : static_cast<UTy>(static_cast<UTy>(last) - static_cast<UTy>(op.first));
+      uintmax_t const numSteps = static_cast<uintmax_t>(distance) / stride;
+      if (numSteps >= SIZE_MAX) {
+        throw std::runtime_error("range in piece `" + std::string(text.substr(start, pos - start)) + "` is too large");
+      }
+      op.kind = Op::Kind::RANGE;
+      op.count = static_cast<size_t>(numSteps) + 1;
+      op.step = static_cast<Ty>(static_cast<UTy>(descending ? 0 - stride : stride));
+      return true;
+    }
 
-    // process piece
-    if (std::regex_match(piece, singleNum)) {
-      Ty const num = parseNum(piece);
-      out[pos++] = num;
-    } else if (std::regex_match(piece, repeatedNum)) {
-      Ty const num = parseNum(piece);
+    default:
+      return false;
+  }
+}
 
-      char const *const pieceRepeats = std::find(
-        piece,
-        piece + cstr::len(piece),
-        '{'
-      ) + 1;
+template <typename Ty>
+requires std::integral<Ty> && (std::is_same<Ty, bool>::value == false)
+constexpr Ty Pattern<Ty>::element(Op const &op, size_t const idx) const noexcept {
+  // computed in unsigned arithmetic, which wraps around instead of overflowing
+  using UTy = std::make_unsigned_t<Ty>;
+  uintmax_t const first = static_cast<UTy>(op.first);
+  uintmax_t const step = static_cast<UTy>(op.step);
 
-      size_t const repeats = std::stoull(pieceRepeats);
+  switch (op.kind) {
+    case Op::Kind::RANGE:
+      return static_cast<Ty>(static_cast<UTy>(first + static_cast<uintmax_t>(idx) * step));
 
-      for (size_t i = 1; i <= repeats; ++i) {
-        out[pos++] = num;
+    case Op::Kind::GEOMETRIC: {
+      uintmax_t power = 1, base = step;
+      for (size_t exponent = idx; exponent != 0; exponent >>= 1) {
+        if (exponent & 1) {
+          power *= base;
+        }
+        base *= base;
       }
-    } else if (std::regex_match(piece, range)) {
-      Ty const leftNum = parseNum(piece);
+      return static_cast<Ty>(static_cast<UTy>(first * power));
+    }
 
-      // creating this variable so we can use `find_last_of` in the next stmt
-      std::string_view pieceView(piece);
+    case Op::Kind::GROUP: {
+      size_t const bodyIdx = idx % op.bodySize;
+      Op const &bodyOp = m_ops[op_containing(op.bodyBegin, op.bodyEnd, bodyIdx)];
+      return element(bodyOp, bodyIdx - bodyOp.offset);
+    }
 
-      char const *const pieceRight = piece + pieceView.find_last_of('.') + 1;
+    default:
+      return op.first;
+  }
+}
+
+template <typename Ty>
+requires std::integral<Ty> && (std::is_same<Ty, bool>::value == false)
+constexpr void Pattern<Ty>::write(
+  size_t const begin,
+  size_t const end,
+  size_t const first,
+  Ty *const out,
+  size_t const n
+) const noexcept {
+  size_t written = 0;
+  for (size_t opIdx = op_containing(begin, end, first); written < n; ++opIdx) {
+    Op const &op = m_ops[opIdx];
+    size_t const skip = first + written - op.offset;
+    size_t const count = std::min(op.count - skip, n - written);
+    Ty *const dest = out + written;
 
-      Ty const rightNum = parseNum(pieceRight);
+    switch (op.kind) {
+      case Op::Kind::LITERAL:
+      case Op::Kind::REPEAT:
+      case Op::Kind::RANGE:
+        detail::fill_progression(dest, count, element(op, skip), op.step);
+        break;
 
-      if (bool const ascending = leftNum < rightNum) {
-        for (Ty n = leftNum; n <= rightNum; ++n) {
-          out[pos++] = n;
+      case Op::Kind::GEOMETRIC: {
+        using UTy = std::make_unsigned_t<Ty>;
+        uintmax_t term = static_cast<UTy>(element(op, skip));
+        uintmax_t const ratio = static_cast<UTy>(op.step);
+        for (size_t i = 0; i < count; ++i) {
+          dest[i] = static_cast<Ty>(static_cast<UTy>(term));
+          term = static_cast<UTy>(term * ratio);
         }
-      } else { // descending
-        for (Ty n = leftNum; n >= rightNum; --n) {
-          out[pos++] = n;
+        break;
+      }
+
+      case Op::Kind::GROUP: {
+        // the rest of the current repetition, then a whole one which is
+        // copied (in doubling chunks) for the remaining repetitions
+        size_t const bodySkip = skip % op.bodySize;
+        size_t done = std::min(op.bodySize - bodySkip, count);
+        write(op.bodyBegin, op.bodyEnd, bodySkip, dest, done);
+        if (done == count) {
+          break;
         }
+        size_t const whole = done;
+        size_t const wholeSize = std::min(op.bodySize, count - done);
+        write(op.bodyBegin, op.bodyEnd, 0, dest + whole, wholeSize);
+        done += wholeSize;
+        while (done < count) {
+          size_t const chunk = std::min(count - done, done - whole);
+          std::copy_n(dest + whole, chunk, dest + done);
+          done += chunk;
+        }
+        break;
       }
-    } else {
-      std::stringstream err{};
-      err << "piece `" << piece << "` has invalid syntax";
-      throw std::runtime_error(err.str());
     }
 
-    // get next piece
-    piece = std::strtok(nullptr, ",");
+    written += count;
+  }
+}
+
+template <typename Ty>
+requires std::integral<Ty> && (std::is_same<Ty, bool>::value == false)
+void Pattern<Ty>::populate(Ty *const out, size_t const numThreads) const {
+  // below this, starting a thread costs more than generating its part
+  constexpr size_t MIN_PER_THREAD = 1 << 16;
+  // parts are multiples of this so threads don't write to the same cache line
+  constexpr size_t GRANULE = std::max<size_t>(64 / sizeof(Ty), 1);
+
+  size_t const usefulThreads = std::min(numThreads, m_size / MIN_PER_THREAD);
+  if (usefulThreads <= 1) {
+    populate(out);
+    return;
+  }
+
+  size_t const partSize = ((m_size + usefulThreads - 1) / usefulThreads + GRANULE - 1) / GRANULE * GRANULE;
+  auto const writePart = [this, out, partSize](size_t const part) {
+    size_t const first = part * partSize;
+    if (first < m_size) {
+      write(m_top, m_ops.size(), first, out + first, std::min(partSize, m_size - first));
+    }
+  };
+
+  std::vector<std::thread> helpers{};
+  helpers.reserve(usefulThreads - 1);
+  // also joins the helpers already started if starting another one throws
+  auto const joinHelpersOnScopeExit = make_on_scope_exit([&helpers]() {
+    for (auto &helper : helpers) {
+      helper.join();
+    }
+  });
+  for (size_t part = 1; part < usefulThreads; ++part) {
+    helpers.emplace_back(writePart, part);
   }
+  writePart(0);
+}
+
+// Populates a block of memory using a pattern. The caller is responsible in ensuring `out` has enough room for the sequence described by `pattern` (see `seqgen::length`). To populate several buffers from the same pattern, parse it once with `seqgen::Pattern` instead.
+template <typename Ty>
+requires std::integral<Ty> && (std::is_same<Ty, bool>::value == false)
+void populate(Ty *const out, char const *const pattern) {
+  Pattern<Ty>(pattern).populate(out);
+}
+
+// Like `populate`, but throws `std::runtime_error` (without writing anything) if `out` is too small for the sequence. Returns the number of elements written.
+template <typename Ty>
+requires std::integral<Ty> && (std::is_same<Ty, bool>::value == false)
+constexpr
+size_t populate(std::span<Ty> const out, char const *const pattern) {
+  return Pattern<Ty>(pattern).populate(out);
+}
+
+// Returns the number of elements in the sequence described by `pattern`, without generating it. Throws like `populate`.
+template <typename Ty>
+requires std::integral<Ty> && (std::is_same<Ty, bool>::value == false)
+constexpr
+size_t length(char const *const pattern) {
+  return Pattern<Ty>(pattern).size();
+}
+
+// Generates the sequence described by `pattern` at compile time, e.g. `constexpr std::array<int, 5> seq = seqgen::generate<int, "1..3,0{2}">();`. Syntax errors are compile errors.
+template <typename Ty, detail::Literal pattern>
+requires std::integral<Ty> && (std::is_same<Ty, bool>::value == false)
+consteval auto generate() {
+  std::array<Ty, Pattern<Ty>(pattern.chars).size()> out{};
+  Pattern<Ty>(pattern.chars).populate(out.data());
+  return out;
 }
 
 } // namespace seqgen
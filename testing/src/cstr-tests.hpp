@@ -1,7 +1,21 @@
 #ifndef CPPLIB_CSTR_TESTS_HPP
 #define CPPLIB_CSTR_TESTS_HPP
 
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
 #include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "config.hpp"
 
@@ -85,6 +99,513 @@ void cstr_tests() {
     testCase("   ", "");
   }
 
+  {
+    SETUP_SUITE("cstr (long strings)")
+
+    // Checked against the plain loops, for every length up to a few blocks and every alignment,
+    // with strings placed so their NUL is the last byte before a page boundary.
+    auto const refLen = [](char const *str) {
+      size_t i = 0;
+      while (str[i] != '\0') ++i;
+      return i;
+    };
+    auto const refCount = [](char const *str, char const c) {
+      size_t n = 0;
+      for (; *str != '\0'; ++str) n += *str == c;
+      return n;
+    };
+    auto const refCmp = [](char const *s1, char const *s2) {
+      while (*s1 && *s1 == *s2) { ++s1; ++s2; }
+      return *(unsigned char const *)s1 - *(unsigned char const *)s2;
+    };
+    auto const refRemoveSpaces = [](std::string str) {
+      std::string out{};
+      for (char const c : str) if (!std::isspace(static_cast<unsigned char>(c))) out += c;
+      return out;
+    };
+
+    size_t constexpr PAGE = 4096;
+    auto const storage = std::unique_ptr<char []>(new char[PAGE * 3]);
+    char *const page = reinterpret_cast<char *>(
+      (reinterpret_cast<uintptr_t>(storage.get()) + PAGE - 1) & ~static_cast<uintptr_t>(PAGE - 1));
+    char const alphabet[] = "ab \t\n\v\f\rxy\x80\xff";
+
+    bool lenOk = true, countOk = true, cmpOk = true, removeOk = true, kernelsOk = true;
+    for (size_t length = 0; length <= 100; ++length) {
+      for (size_t atEnd = 0; atEnd < 2; ++atEnd) {
+        for (size_t offset = 0; offset < 64; ++offset) {
+          char *const str = atEnd ? page + PAGE - 1 - length - offset : page + PAGE + offset;
+          for (size_t i = 0; i < length; ++i) {
+            str[i] = alphabet[(i * 7 + offset + length) % (sizeof(alphabet) - 1)];
+          }
+          str[length] = '\0';
+
+          lenOk = lenOk && cstr::len(str) == length;
+          countOk = countOk && cstr::count(str, 'a') == refCount(str, 'a')
+            && cstr::count(str, ' ') == refCount(str, ' ')
+            && cstr::count(str, '\xff') == refCount(str, '\xff');
+
+          std::string const copy(str);
+          cmpOk = cmpOk && cstr::cmp(str, copy.c_str()) == 0 && cstr::cmp(copy.c_str(), str) == 0;
+          if (length > 0) {
+            std::string changed = copy;
+            changed[(offset * 13) % length] = 'z';
+            cmpOk = cmpOk && cstr::cmp(str, changed.c_str()) == refCmp(str, changed.c_str())
+              && cstr::cmp(changed.c_str(), str) == refCmp(changed.c_str(), str);
+            std::string const shorter = copy.substr(0, length - 1);
+            cmpOk = cmpOk && cstr::cmp(str, shorter.c_str()) == refCmp(str, shorter.c_str())
+              && cstr::cmp(shorter.c_str(), str) == refCmp(shorter.c_str(), str);
+          }
+
+#if CSTR_X86
+          // `cstr` picks one of these at run time, make sure the other one is right too.
+          kernelsOk = kernelsOk && cstr::detail::len_sse2(str) == length
+            && cstr::detail::count_sse2(str, ' ') == refCount(str, ' ')
+            && cstr::detail::cmp_sse2(str, copy.c_str()) == 0;
+          if (cstr::detail::has_avx2()) {
+            kernelsOk = kernelsOk && cstr::detail::len_avx2(str) == length
+              && cstr::detail::count_avx2(str, ' ') == refCount(str, ' ')
+              && cstr::detail::cmp_avx2(str, copy.c_str()) == 0;
+          }
+          std::string sse2Copy = copy;
+          cstr::detail::remove_spaces_sse2(sse2Copy.data());
+          kernelsOk = kernelsOk && std::string(sse2Copy.c_str()) == refRemoveSpaces(copy);
+#endif
+
+          cstr::remove_spaces(str);
+          removeOk = removeOk && std::string(str) == refRemoveSpaces(copy);
+        }
+      }
+    }
+    s.assert("len", lenOk);
+    s.assert("count", countOk);
+    s.assert("cmp", cmpOk);
+    s.assert("remove_spaces", removeOk);
+    s.assert("SSE2 and AVX2 kernels", kernelsOk);
+
+    std::string longLine(100000, 'x');
+    for (size_t i = 0; i < longLine.size(); i += 7) longLine[i] = ' ';
+    std::string expected = refRemoveSpaces(longLine);
+    s.assert("len (long line)", cstr::len(longLine.c_str()) == refLen(longLine.c_str()));
+    s.assert("count (long line)", cstr::count(longLine.c_str(), ' ') == refCount(longLine.c_str(), ' '));
+    cstr::remove_spaces(longLine.data());
+    s.assert("remove_spaces (long line)", std::string(longLine.c_str()) == expected);
+    s.assert(CASE(cstr::count("abc", '\0') == 0));
+
+    constexpr auto removed = [] {
+      std::array<char, 8> buf{ ' ', 'a', '\t', 'b', ' ', 'c', '\n', '\0' };
+      cstr::remove_spaces(buf.data());
+      return buf;
+    }();
+    s.assert("remove_spaces (constexpr)", removed[0] == 'a' && removed[1] == 'b' && removed[2] == 'c' && removed[3] == '\0');
+    s.assert("cmp (constexpr)", std::integral_constant<int, cstr::cmp("abc", "abd")>::value == 'c' - 'd');
+    s.assert("count (constexpr)", std::integral_constant<size_t, cstr::count("a b a", 'a')>::value == 2);
+  }
+
+  {
+    SETUP_SUITE_USING(cstr::parse_int)
+
+    auto const parses = [](auto const result, auto const value, size_t const length) {
+      return result.error == cstr::ParseError::NONE && result.value == value && result.length == length;
+    };
+    auto const fails = [](auto const result, cstr::ParseError const error, size_t const length) {
+      return result.error == error && result.value == 0 && result.length == length;
+    };
+
+    s.assert(CASE(parses(parse_int<int>("0"), 0, 1)));
+    s.assert(CASE(parses(parse_int<int>("123abc"), 123, 3)));
+    s.assert(CASE(parses(parse_int<int>("-123"), -123, 4)));
+    s.assert(CASE(parses(parse_int<int>("007"), 7, 3)));
+    s.assert(CASE(parses(parse_int<uint64_t>("12345678"), 12345678u, 8)));
+    s.assert(CASE(parses(parse_int<uint64_t>("123456789 1"), 123456789u, 9)));
+    s.assert(CASE(parses(parse_int<uint64_t>("18446744073709551615"), UINT64_MAX, 20)));
+    s.assert(CASE(parses(parse_int<int64_t>("-9223372036854775808"), INT64_MIN, 20)));
+    s.assert(CASE(parses(parse_int<int8_t>("-128"), int8_t{-128}, 4)));
+    s.assert(CASE(parses(parse_int<uint64_t>("00000000000000000000000000000001"), 1u, 32)));
+    s.assert(CASE(fails(parse_int<int>(""), cstr::ParseError::NO_DIGITS, 0)));
+    s.assert(CASE(fails(parse_int<int>("-"), cstr::ParseError::NO_DIGITS, 0)));
+    s.assert(CASE(fails(parse_int<int>(" 1"), cstr::ParseError::NO_DIGITS, 0)));
+    s.assert(CASE(fails(parse_int<int>("+1"), cstr::ParseError::NO_DIGITS, 0)));
+    s.assert(CASE(fails(parse_int<unsigned>("-1"), cstr::ParseError::NO_DIGITS, 0)));
+    s.assert(CASE(fails(parse_int<uint8_t>("256"), cstr::ParseError::OUT_OF_RANGE, 3)));
+    s.assert(CASE(fails(parse_int<int8_t>("-129"), cstr::ParseError::OUT_OF_RANGE, 4)));
+    s.assert(CASE(fails(parse_int<uint64_t>("18446744073709551616"), cstr::ParseError::OUT_OF_RANGE, 20)));
+    s.assert(CASE(fails(parse_int<uint64_t>("99999999999999999999999999"), cstr::ParseError::OUT_OF_RANGE, 26)));
+    s.assert("constexpr", std::integral_constant<int, parse_int<int>("-42,").value>::value == -42);
+
+    // every prefix of a long run of digits, so each number of leading digits per 8 character chunk is covered
+    std::string const digits = "98765432109876543210";
+    bool prefixesOk = true;
+    for (size_t n = 1; n <= 19; ++n) {
+      std::string const text = digits.substr(0, n) + ";" + digits;
+      prefixesOk = prefixesOk && parses(parse_int<uint64_t>(text), std::stoull(digits.substr(0, n)), n);
+    }
+    s.assert("prefixes", prefixesOk);
+  }
+
+  {
+    SETUP_SUITE_USING(cstr::format_int)
+
+    auto const formats = [](auto const value, char const *const expected) {
+      char buffer[cstr::MAX_INT_CHARS<decltype(value)>] {};
+      char *const end = format_int(buffer, buffer + sizeof(buffer), value);
+      return end != nullptr && std::string(buffer, end) == expected;
+    };
+
+    s.assert(CASE(formats(0, "0")));
+    s.assert(CASE(formats(7, "7")));
+    s.assert(CASE(formats(42, "42")));
+    s.assert(CASE(formats(-42, "-42")));
+    s.assert(CASE(formats(100, "100")));
+    s.assert(CASE(formats(uint8_t{255}, "255")));
+    s.assert(CASE(formats(int8_t{-128}, "-128")));
+    s.assert(CASE(formats(1234567890, "1234567890")));
+    s.assert(CASE(formats(UINT64_MAX, "18446744073709551615")));
+    s.assert(CASE(formats(INT64_MIN, "-9223372036854775808")));
+
+    char small[3] {};
+    s.assert(CASE(format_int(small, small + 3, 999) == small + 3));
+    s.assert(CASE(format_int(small, small + 3, 1000) == nullptr));
+    s.assert(CASE(format_int(small, small + 3, -100) == nullptr));
+
+    bool powersOk = true;
+    for (uint64_t power = 1, i = 0; i < 20; ++i, power *= 10) {
+      powersOk = powersOk && formats(power, std::to_string(power).c_str())
+        && formats(power - 1, std::to_string(power - 1).c_str());
+    }
+    s.assert("powers of 10", powersOk);
+  }
+
+  {
+    SETUP_SUITE_USING(cstr::format_float)
+
+    auto const formats = [](auto const value, char const *const expected) {
+      char buffer[32] {};
+      char *const end = format_float(buffer, buffer + sizeof(buffer), value);
+      return end != nullptr && std::string(buffer, end) == expected;
+    };
+
+    s.assert(CASE(formats(0.0, "0")));
+    s.assert(CASE(formats(0.1, "0.1")));
+    s.assert(CASE(formats(-1.5f, "-1.5")));
+    s.assert(CASE(formats(1e100, "1e+100")));
+
+    char buffer[16] {};
+    char *const end = format_float(buffer, buffer + sizeof(buffer), 3.14159, std::chars_format::fixed, 2);
+    s.assert(CASE(end != nullptr && std::string(buffer, end) == "3.14"));
+    s.assert(CASE(format_float(buffer, buffer + 2, 0.125) == nullptr));
+  }
+
+  {
+    SETUP_SUITE("cstr::CharSet")
+
+    cstr::CharSet const few(" ,\t");
+    cstr::CharSet const many("abcdefghij,");
+    std::string const text = "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx\t,yy";
+
+    s.assert(CASE(few.size() == 3 && few.contains(',') && !few.contains('x')));
+    s.assert(CASE(cstr::CharSet("aab").size() == 2));
+    s.assert(CASE(cstr::CharSet("\x80\xff").contains('\xff')));
+    s.assert(CASE(few.find(text) == 36));
+    s.assert(CASE(few.find(text, 37) == 37));
+    s.assert(CASE(few.find(text, 38) == text.size()));
+    s.assert(CASE(many.find(text) == 37));
+    s.assert(CASE(cstr::CharSet().find(text) == text.size()));
+    s.assert(CASE(few.find_not(text, 36) == 38));
+  }
+
+  {
+    SETUP_SUITE_USING(cstr::split)
+
+    auto const splits = [](std::string_view const text, cstr::CharSet const &delimiters, std::vector<std::string_view> const &expected) {
+      std::vector<std::string_view> tokens{};
+      for (std::string_view const token : split(text, delimiters)) {
+        tokens.push_back(token);
+      }
+      return tokens == expected;
+    };
+
+    s.assert(CASE(splits("a,b,c", ",", { "a", "b", "c" })));
+    s.assert(CASE(splits("a,,b", ",", { "a", "", "b" })));
+    s.assert(CASE(splits(",a,", ",", { "", "a", "" })));
+    s.assert(CASE(splits("", ",", { "" })));
+    s.assert(CASE(splits("abc", "", { "abc" })));
+    s.assert(CASE(splits("a b\tc;d", " \t;", { "a", "b", "c", "d" })));
+    s.assert(CASE(splits("a1b2c3d", "0123456789", { "a", "b", "c", "d" })));
+    s.assert(CASE(splits("a very long line, longer than a single block, split in three", ",", { "a very long line", " longer than a single block", " split in three" })));
+  }
+
+  {
+    SETUP_SUITE_USING(cstr::tokenize)
+
+    auto const tokenizes = [](std::string_view const text, cstr::CharSet const &delimiters, std::vector<std::string_view> const &expected) {
+      std::vector<std::string_view> tokens{};
+      for (std::string_view const token : tokenize(text, delimiters)) {
+        tokens.push_back(token);
+      }
+      return tokens == expected;
+    };
+
+    s.assert(CASE(tokenizes("  a  b ", " ", { "a", "b" })));
+    s.assert(CASE(tokenizes("a,,b", ",", { "a", "b" })));
+    s.assert(CASE(tokenizes("", ",", {})));
+    s.assert(CASE(tokenizes(",,,", ",", {})));
+    s.assert(CASE(tokenizes("1 2\n3\r\n", " \t\n\v\f\r", { "1", "2", "3" })));
+
+    // each tokenizer has its own state, so they can be nested (which `std::strtok` can't do)
+    std::string_view const table = "1 2,3 4,5 6";
+    std::vector<std::string_view> cells{};
+    for (std::string_view const row : tokenize(table, ",")) {
+      for (std::string_view const cell : tokenize(row, " ")) {
+        cells.push_back(cell);
+      }
+    }
+    s.assert("nested", cells == std::vector<std::string_view>{ "1", "2", "3", "4", "5", "6" });
+  }
+
+  {
+    SETUP_SUITE_USING(cstr::split_csv)
+
+    auto const fields = [](std::string_view const record, char const delimiter, std::vector<std::string> const &expected) {
+      std::vector<std::string> out{};
+      for (cstr::CsvField const field : split_csv(record, delimiter)) {
+        std::string unescaped(field.text.size(), '\0');
+        unescaped.resize(static_cast<size_t>(field.unescape(unescaped.data()) - unescaped.data()));
+        out.push_back(unescaped);
+      }
+      return out == expected;
+    };
+
+    s.assert(CASE(fields("a,b,c", ',', { "a", "b", "c" })));
+    s.assert(CASE(fields("a,\"b,c\",d", ',', { "a", "b,c", "d" })));
+    s.assert(CASE(fields("\"say \"\"hi\"\"\",x", ',', { "say \"hi\"", "x" })));
+    s.assert(CASE(fields("\"\"", ',', { "" })));
+    s.assert(CASE(fields("", ',', { "" })));
+    s.assert(CASE(fields("a,", ',', { "a", "" })));
+    s.assert(CASE(fields(",,", ',', { "", "", "" })));
+    s.assert(CASE(fields("a;\"b;c\"", ';', { "a", "b;c" })));
+    s.assert(CASE(fields("\"open,x", ',', { "open,x" })));
+    s.assert(CASE(fields("a\"b,c", ',', { "a\"b", "c" })));
+
+    cstr::CsvField const field = *split_csv("\"x\"\"y\"").begin();
+    s.assert(CASE(field.quoted && field.escaped && field.text == "x\"\"y"));
+    cstr::CsvField const plain = *split_csv("xy").begin();
+    s.assert(CASE(!plain.quoted && !plain.escaped && plain.text == "xy"));
+  }
+
+  {
+    SETUP_SUITE_USING(cstr::find)
+
+    std::string const logText = std::string(100, '.') + "ERROR: disk full" + std::string(100, '.') + "ERROR: again";
+    std::string_view const log = logText;
+    size_t constexpr NPOS = std::string_view::npos;
+
+    s.assert(CASE(find("hello world", "world") == 6));
+    s.assert(CASE(find("hello world", "o") == 4));
+    s.assert(CASE(find("hello world", "o", 5) == 7));
+    s.assert(CASE(find("hello world", "") == 0));
+    s.assert(CASE(find("hello world", "", 11) == 11));
+    s.assert(CASE(find("hello world", "", 12) == NPOS));
+    s.assert(CASE(find("hello world", "worlds") == NPOS));
+    s.assert(CASE(find("hello", "hello world") == NPOS));
+    s.assert(CASE(find("aaab", "ab") == 2));
+    s.assert(CASE(find(log, "ERROR") == 100));
+    s.assert(CASE(find(log, "ERROR", 101) == 216));
+    s.assert(CASE(find(log, "ERROR: disk full") == 100));
+    s.assert(CASE(find(log, "again") == log.size() - 5));
+    s.assert(CASE(find(log, "ERROR: full") == NPOS));
+    s.assert("constexpr", std::integral_constant<size_t, find("abcabd", "abd")>::value == 3);
+
+    // every needle position and length around the block boundaries, against `std::string_view::find`
+    bool positionsOk = true;
+    for (size_t length = 2; length <= 40; ++length) {
+      for (size_t at = 0; at + length <= 100; ++at) {
+        std::string haystack(100, 'a');
+        std::string const needle = "b" + std::string(length - 2, 'a') + "c";
+        haystack.replace(at, length, needle);
+        positionsOk = positionsOk && cstr::find(haystack, needle) == at
+          && cstr::find(haystack, needle, at + 1) == NPOS
+          && cstr::find(std::string_view(haystack).substr(0, at + length - 1), needle) == NPOS;
+      }
+    }
+    s.assert("positions", positionsOk);
+  }
+
+  {
+    SETUP_SUITE_USING(cstr::find_icase)
+
+    std::string const log = std::string(100, '.') + "Error: Disk Full";
+    size_t constexpr NPOS = std::string_view::npos;
+
+    s.assert(CASE(find_icase("Hello World", "WORLD") == 6));
+    s.assert(CASE(find_icase("Hello World", "o w") == 4));
+    s.assert(CASE(find_icase("Hello World", "x") == NPOS));
+    s.assert(CASE(find_icase("Hello World", "") == 0));
+    s.assert(CASE(find_icase(log, "ERROR: DISK FULL") == 100));
+    s.assert(CASE(find_icase(log, "error: disk full") == 100));
+    s.assert(CASE(find_icase(log, "disk", 111) == NPOS));
+    // only letters are folded
+    s.assert(CASE(find_icase(std::string(40, '.') + "[x]", "{x}") == NPOS));
+    s.assert(CASE(find_icase(std::string(40, '.') + "[X]", "[x]") == 40));
+    s.assert("constexpr", std::integral_constant<size_t, find_icase("xxABC", "abc")>::value == 2);
+  }
+
+  {
+    SETUP_SUITE("cstr::NeedleSet")
+
+    using Match = cstr::NeedleSet::Match;
+    auto const all = [](cstr::NeedleSet const &set, std::string_view const haystack) {
+      std::vector<std::pair<size_t, size_t>> matches{};
+      set.find_all(haystack, [&matches](Match const match) {
+        matches.emplace_back(match.position, match.needle);
+        return true;
+      });
+      return matches;
+    };
+    using matches = std::vector<std::pair<size_t, size_t>>;
+
+    cstr::NeedleSet const set{ "he", "she", "his", "hers" };
+    s.assert("size", set.size() == 4);
+    s.assert("find_all, overlapping", all(set, "ushers") == matches{ { 1, 1 }, { 2, 0 }, { 2, 3 } });
+    s.assert("find_all, none", all(set, "xyz").empty());
+    s.assert("find_all, from", [&set] {
+      matches found{};
+      set.find_all("he she", [&found](Match const m) { found.emplace_back(m.position, m.needle); return true; }, 1);
+      return found == matches{ { 3, 1 }, { 4, 0 } };
+    }());
+
+    std::optional<Match> const first = set.find("this is hers");
+    s.assert("find", first.has_value() && first->position == 1 && first->needle == 2);
+    s.assert("find, none", !set.find("nothing").has_value());
+    s.assert("find, stops", [&set] {
+      size_t calls = 0;
+      set.find_all("hehehe", [&calls](Match) { return ++calls < 2; });
+      return calls == 2;
+    }());
+
+    cstr::NeedleSet const nested{ "abcd", "bc", "c", "" };
+    s.assert("nested needles", all(nested, "xabcdx") == matches{ { 2, 1 }, { 3, 2 }, { 1, 0 } });
+
+    cstr::NeedleSet const icase({ "error", "WARN" }, true);
+    s.assert("ignoreCase", all(icase, "Error, then warn, then ERROR") == matches{ { 0, 0 }, { 12, 1 }, { 23, 0 } });
+
+    std::vector<std::string> many{};
+    for (size_t i = 0; i < 1000; ++i) {
+      many.push_back("key" + std::to_string(i * 7919 % 100000) + ";");
+    }
+    std::vector<std::string_view> const views(many.begin(), many.end());
+    cstr::NeedleSet const big(views);
+    std::string const text = std::string(1000, ' ') + many[123] + many[999];
+    s.assert("1000 needles", all(big, text) == matches{ { 1000, 123 }, { 1000 + many[123].size(), 999 } });
+
+    s.assert("constexpr", [] {
+      constexpr size_t count = [] {
+        cstr::NeedleSet const set{ "a", "ab", "b" };
+        size_t n = 0;
+        set.find_all("abab", [&n](Match) { ++n; return true; });
+        return n;
+      }();
+      return count == 6;
+    }());
+  }
+
+  {
+    SETUP_SUITE_USING(cstr::fnv1a)
+
+    // reference values from the FNV authors' test suite
+    s.assert(CASE(fnv1a("") == 0xCBF29CE484222325));
+    s.assert(CASE(fnv1a("a") == 0xAF63DC4C8601EC8C));
+    s.assert(CASE(fnv1a("foobar") == 0x85944171F73967E8));
+    s.assert("constexpr", std::integral_constant<uint64_t, fnv1a("a")>::value == 0xAF63DC4C8601EC8C);
+  }
+
+  {
+    SETUP_SUITE_USING(cstr::hash)
+
+    static constexpr char TEXT[] = "The quick brown fox jumps over the lazy dog, then runs off into the woods";
+    // hashes of every prefix of `TEXT` (all the different length cases), computed at compile time
+    static constexpr auto PREFIX_HASHES = [] {
+      std::array<uint64_t, sizeof(TEXT)> hashes{};
+      for (size_t i = 0; i < hashes.size(); ++i) {
+        hashes[i] = hash(std::string_view(TEXT, i));
+      }
+      return hashes;
+    }();
+
+    bool sameAtRunTime = true;
+    std::vector<uint64_t> distinct{};
+    for (size_t i = 0; i < PREFIX_HASHES.size(); ++i) {
+      std::string const prefix(TEXT, i);
+      sameAtRunTime = sameAtRunTime && hash(prefix) == PREFIX_HASHES[i];
+      distinct.push_back(hash(prefix));
+    }
+    std::sort(distinct.begin(), distinct.end());
+    s.assert("same at compile and run time", sameAtRunTime);
+    s.assert("prefixes distinct", std::adjacent_find(distinct.begin(), distinct.end()) == distinct.end());
+    s.assert(CASE(hash("abc") != hash("abd")));
+    s.assert(CASE(hash("abc") != hash("abc", 1)));
+    s.assert(CASE(hash("") != hash(std::string_view("", 1))));
+  }
+
+  {
+    SETUP_SUITE("cstr::StaticMap")
+
+    enum class Command { NONE, HELP, OPEN, QUIT };
+    static constexpr auto COMMANDS = cstr::make_static_map<Command>({
+      { "help", Command::HELP },
+      { "open", Command::OPEN },
+      { "quit", Command::QUIT },
+      { "q", Command::QUIT },
+    });
+    auto const lookup = [](std::string_view const name, Command const expected) {
+      return COMMANDS.get(name, Command::NONE) == expected;
+    };
+
+    s.assert(CASE(COMMANDS.size() == 4));
+    s.assert(CASE(lookup("help", Command::HELP)));
+    s.assert(CASE(lookup("open", Command::OPEN)));
+    s.assert(CASE(lookup("quit", Command::QUIT)));
+    s.assert(CASE(lookup("q", Command::QUIT)));
+    s.assert(CASE(lookup("qu", Command::NONE)));
+    s.assert(CASE(lookup("Help", Command::NONE)));
+    s.assert(CASE(lookup("", Command::NONE)));
+    s.assert(CASE(COMMANDS.find("close") == nullptr));
+    s.assert("constexpr", COMMANDS.contains("open") && !COMMANDS.contains("opens"));
+
+    static constexpr auto EMPTY_KEY = cstr::make_static_map<int>({ { "", 1 } });
+    s.assert("empty key", EMPTY_KEY.get("", 0) == 1 && EMPTY_KEY.get("x", 0) == 0);
+
+    // keys over a small alphabet, so there are plenty of near misses
+    std::vector<std::string> keys{};
+    for (size_t i = 0; keys.size() < 500; ++i) {
+      std::string key{};
+      for (size_t n = i; n > 0; n /= 3) {
+        key += static_cast<char>('a' + n % 3);
+      }
+      keys.push_back(key);
+    }
+    std::vector<std::pair<std::string_view, int>> entries{};
+    for (size_t i = 0; i < keys.size(); i += 2) {
+      entries.emplace_back(keys[i], static_cast<int>(i));
+    }
+    cstr::StaticMap<int, 250> const map(std::span<std::pair<std::string_view, int> const, 250>(entries.data(), 250));
+    bool allFound = true;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      int const *const value = map.find(keys[i]);
+      allFound = allFound && (i % 2 == 0 ? value != nullptr && *value == static_cast<int>(i) : value == nullptr);
+    }
+    s.assert("250 keys", allFound);
+
+    bool threw = false;
+    try {
+      std::pair<std::string_view, int> const duplicates[] = { { "a", 1 }, { "b", 2 }, { "a", 3 } };
+      (void)cstr::make_static_map<int>(duplicates);
+    } catch (std::runtime_error const &) {
+      threw = true;
+    }
+    s.assert("duplicate keys throw", threw);
+  }
+
   {
     SETUP_SUITE_USING(cstr::ascii_digit_to_int)
 
@@ -5,9 +5,13 @@
 
 #if TEST_PGM8
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <filesystem>
 #include <memory>
+#include <new>
+#include <numeric>
 
 #include "../../include/pgm8.hpp"
 #include "../../include/test.hpp"
@@ -17,8 +21,11 @@ namespace fs = std::filesystem;
 
 void pgm8_tests(char const *const imgsDir) {
   using
+    pgm8::BufferPool,
     pgm8::Image,
+    pgm8::Filter,
     pgm8::Format,
+    pgm8::Order,
     pgm8::write;
 
   {
@@ -140,7 +147,7 @@ void pgm8_tests(char const *const imgsDir) {
   }
 
   // lambda for testing:
-  // - write_uncompressed (with both PLAIN and RAW image types)
+  // - write (with PLAIN, RAW and COMPRESSED image types)
   // - write_compressed
   // - Image::load
   // in an end-to-end fashion
@@ -174,6 +181,7 @@ void pgm8_tests(char const *const imgsDir) {
           switch (format) {
             case Format::PLAIN: return "-plain";
             case Format::RAW: return "-raw";
+            case Format::COMPRESSED: return "-compressed";
             default: throw std::runtime_error("bad `format`");
           }
         }()
@@ -183,14 +191,14 @@ void pgm8_tests(char const *const imgsDir) {
 
       // write
       {
-        std::ofstream file(fpathname);
+        std::ofstream file(fpathname, std::ios::binary);
         assert_file(&file, fpathname.string().c_str());
         write(file, width, height, maxval, pixels, format);
       }
 
       // read
       {
-        std::ifstream file(fpathname);
+        std::ifstream file(fpathname, std::ios::binary);
         assert_file(&file, fpathname.string().c_str());
         Image img(file);
         file.close();
@@ -199,6 +207,7 @@ void pgm8_tests(char const *const imgsDir) {
             switch (format) {
               case Format::PLAIN: return "write-plain";
               case Format::RAW: return "write-raw";
+              case Format::COMPRESSED: return "write-compressed";
               default: throw std::runtime_error("bad `format`");
             }
           }(),
@@ -212,6 +221,7 @@ void pgm8_tests(char const *const imgsDir) {
 
     typeTestCase(Format::PLAIN);
     typeTestCase(Format::RAW);
+    typeTestCase(Format::COMPRESSED);
   };
 
   {
@@ -267,6 +277,603 @@ void pgm8_tests(char const *const imgsDir) {
       homogPixels
     );
   }
+
+  {
+    SETUP_SUITE("pgm8 compressed format")
+
+    // a mix of smooth, flat and noisy areas
+    uint16_t const width = 301, height = 203;
+    std::vector<uint8_t> pixels(size_t{width} * height);
+    {
+      uint32_t state = 42;
+      for (size_t r = 0; r < height; ++r) {
+        for (size_t c = 0; c < width; ++c) {
+          state = state * 1664525 + 1013904223;
+          uint8_t &px = pixels[arr2d::get_1d_idx(width, c, r)];
+          if (r < height / 3) {
+            px = static_cast<uint8_t>(c + r);
+          } else if (r < 2 * height / 3) {
+            px = 77;
+          } else {
+            px = static_cast<uint8_t>(state >> 24);
+          }
+        }
+      }
+    }
+
+    std::string const fpathname = std::string(imgsDir) + "mixed-compressed.pgm";
+
+    for (auto const &[tileW, tileH] : {
+      std::pair<uint16_t, uint16_t>{ 64, 64 },
+      std::pair<uint16_t, uint16_t>{ 7, 5 },
+      std::pair<uint16_t, uint16_t>{ width, 16 },
+      std::pair<uint16_t, uint16_t>{ 1000, 1000 },
+    }) {
+      std::string const tiles =
+        std::to_string(tileW) + 'x' + std::to_string(tileH) + " tiles";
+      {
+        std::ofstream file(fpathname, std::ios::binary);
+        assert_file(&file, fpathname.c_str());
+        pgm8::write_compressed(file, width, height, 200, pixels.data(), tileW, tileH);
+      }
+
+      {
+        std::ifstream file(fpathname, std::ios::binary);
+        assert_file(&file, fpathname.c_str());
+        Image const img(file);
+        s.assert(
+          ("round trip, " + tiles).c_str(),
+          img.width() == width &&
+          img.height() == height &&
+          img.maxval() == 200 &&
+          arr2d::cmp(img.pixels(), pixels.data(), width, height)
+        );
+      }
+
+      s.assert(
+        ("probe, " + tiles).c_str(),
+        pgm8::probe(fpathname.c_str()).format == Format::COMPRESSED
+      );
+
+      {
+        uint16_t const x = 13, y = 60, w = 150, h = 100;
+        Image const region = pgm8::load_region(fpathname.c_str(), x, y, w, h);
+        bool correct = region.width() == w && region.height() == h;
+        for (size_t r = 0; r < h; ++r) {
+          for (size_t c = 0; c < w; ++c) {
+            correct = correct &&
+              region.pixels()[arr2d::get_1d_idx(w, c, r)] ==
+              pixels[arr2d::get_1d_idx(width, x + c, y + r)];
+          }
+        }
+        s.assert(("load_region, " + tiles).c_str(), correct);
+      }
+    }
+
+    // compresses the smooth and flat areas well
+    s.assert(
+      "compression ratio",
+      fs::file_size(fpathname) < pixels.size() * 2 / 3
+    );
+
+    for (char const *const name : { "noise-raw.pgm", "noise-plain.pgm" }) {
+      std::string const pathname = std::string(imgsDir) + name;
+      Image const region = pgm8::load_region(pathname.c_str(), 1, 2, 3, 2);
+      uint8_t const expected[3 * 2] {
+        243, 244, 106,
+        165, 210, 119,
+      };
+      s.assert(
+        (std::string("load_region ") + name).c_str(),
+        arr2d::cmp(region.pixels(), expected, 3, 2)
+      );
+    }
+
+    {
+      // flip a byte in the middle of a tile payload
+      std::string contents{};
+      {
+        std::ofstream file(fpathname, std::ios::binary);
+        pgm8::write_compressed(file, width, height, 200, pixels.data());
+      }
+      {
+        std::ifstream file(fpathname, std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(file), {});
+      }
+      contents[contents.size() - 100] ^= 0x5a;
+      contents[contents.size() - 101] ^= 0x33;
+      contents.resize(contents.size() - 50);
+      {
+        std::ofstream file(fpathname, std::ios::binary);
+        file << contents;
+      }
+
+      bool threw = false;
+      try {
+        std::ifstream file(fpathname, std::ios::binary);
+        Image const img(file);
+      } catch (std::runtime_error const &) {
+        threw = true;
+      }
+      s.assert("corrupt file throws", threw);
+    }
+
+    {
+      // corrupt the tile table or a payload without changing the file's length, the load must throw
+      // `std::runtime_error` (rather than e.g. `std::bad_alloc` from trusting a huge offset)
+      {
+        std::ofstream file(fpathname, std::ios::binary);
+        pgm8::write_compressed(file, width, height, 200, pixels.data(), 64, 64);
+      }
+      std::string original{};
+      {
+        std::ifstream file(fpathname, std::ios::binary);
+        original.assign(std::istreambuf_iterator<char>(file), {});
+      }
+      size_t const tableStart = pgm8::probe(fpathname.c_str()).rasterOffset;
+      size_t const numTiles = ((width + 63) / 64) * ((height + 63) / 64);
+      // position of the `i`th offset, and of the payloads
+      auto const offsetAt = [tableStart](size_t const i) { return tableStart + 4 + i * 8; };
+      size_t const payloadsStart = offsetAt(numTiles + 1);
+
+      auto const throwsWhen = [&](auto const &corrupt) {
+        std::string contents = original;
+        corrupt(contents);
+        {
+          std::ofstream file(fpathname, std::ios::binary);
+          file << contents;
+        }
+        bool loadThrew = false, regionThrew = false;
+        try {
+          std::ifstream file(fpathname, std::ios::binary);
+          Image const img(file);
+        } catch (std::runtime_error const &) {
+          loadThrew = true;
+        } catch (...) {}
+        try {
+          Image const region = pgm8::load_region(fpathname.c_str(), 0, 0, width, height);
+        } catch (std::runtime_error const &) {
+          regionThrew = true;
+        } catch (...) {}
+        return loadThrew && regionThrew;
+      };
+
+      s.assert("huge last offset throws", throwsWhen([&](std::string &contents) {
+        contents[offsetAt(numTiles) + 7] = '\x7f';
+      }));
+      s.assert("non-zero first offset throws", throwsWhen([&](std::string &contents) {
+        contents[offsetAt(0)] = '\x01';
+      }));
+      s.assert("decreasing offsets throw", throwsWhen([&](std::string &contents) {
+        contents[offsetAt(1) + 5] = '\x01';
+      }));
+      s.assert("too many tiles throws", throwsWhen([&](std::string &contents) {
+        // 1x1 tiles, the table would be much larger than the file
+        contents[tableStart] = '\x01';
+        contents[tableStart + 1] = '\x00';
+        contents[tableStart + 2] = '\x01';
+        contents[tableStart + 3] = '\x00';
+      }));
+      s.assert("corrupt payload throws", throwsWhen([&](std::string &contents) {
+        // the encoding of the first tile
+        contents[payloadsStart] = '\x7f';
+      }));
+      s.assert("corrupt payload of last tile throws", throwsWhen([&](std::string &contents) {
+        size_t const lastTileStart = payloadsStart +
+          static_cast<size_t>(static_cast<unsigned char>(contents[offsetAt(numTiles - 1)])) +
+          (static_cast<size_t>(static_cast<unsigned char>(contents[offsetAt(numTiles - 1) + 1])) << 8) +
+          (static_cast<size_t>(static_cast<unsigned char>(contents[offsetAt(numTiles - 1) + 2])) << 16);
+        contents[lastTileStart] = '\x7f';
+      }));
+    }
+  }
+
+  {
+    SETUP_SUITE_USING(pgm8::probe)
+
+    {
+      std::string const fpathname = std::string(imgsDir) + "ascending-plain.pgm";
+      pgm8::Header const header = probe(fpathname.c_str());
+      s.assert(
+        "ascending-plain.pgm",
+        header.format == Format::PLAIN &&
+        header.width == 4 &&
+        header.height == 4 &&
+        header.maxval == 16 &&
+        header.rasterOffset == 10
+      );
+    }
+
+    {
+      std::string const fpathname = std::string(imgsDir) + "noise-raw.pgm";
+      pgm8::Header const header = probe(fpathname.c_str());
+      s.assert(
+        "noise-raw.pgm",
+        header.format == Format::RAW &&
+        header.width == 4 &&
+        header.height == 4 &&
+        header.maxval == 255 &&
+        header.rasterOffset + 16 == fs::file_size(fpathname)
+      );
+    }
+
+    auto const parse = [](char const *const header) {
+      return probe(
+        reinterpret_cast<uint8_t const *>(header),
+        std::strlen(header)
+      );
+    };
+
+    {
+      pgm8::Header const header = parse(
+        "P5 # comment\n#another comment\r\n\t12\f#\n  345\v\n7 "
+      );
+      s.assert(
+        "comments and whitespace",
+        header.format == Format::RAW &&
+        header.width == 12 &&
+        header.height == 345 &&
+        header.maxval == 7 &&
+        header.rasterOffset == 46
+      );
+    }
+
+    {
+      // longer than the initial read
+      std::string const fpathname = std::string(imgsDir) + "long-comment.pgm";
+      {
+        std::ofstream file(fpathname, std::ios::binary);
+        assert_file(&file, fpathname.c_str());
+        file << "P5\n#" << std::string(2000, 'x') << "\n2 1\n255\n" << "ab";
+      }
+      pgm8::Header const header = probe(fpathname.c_str());
+      s.assert(
+        "long comment",
+        header.width == 2 &&
+        header.height == 1 &&
+        header.rasterOffset + 2 == fs::file_size(fpathname)
+      );
+    }
+
+    auto const throws = [&parse](char const *const header) {
+      try {
+        parse(header);
+        return false;
+      } catch (std::runtime_error const &) {
+        return true;
+      }
+    };
+
+    s.assert("bad magic", throws("P6\n1 1\n255\n"));
+    s.assert("incomplete", throws("P5\n1 1\n255"));
+    s.assert("maxval too large", throws("P5\n1 1\n256\n"));
+    s.assert("width too large", throws("P5\n65536 1\n255\n"));
+    s.assert("zero height", throws("P5\n1 0\n255\n"));
+    s.assert("missing whitespace", throws("P51 1\n255\n"));
+  }
+
+  {
+    SETUP_SUITE_USING(pgm8::BufferPool)
+
+    std::string const fpathname = std::string(imgsDir) + "noise-raw.pgm";
+    std::string const smallerFpathname = std::string(imgsDir) + "ascending-plain.pgm";
+
+    BufferPool pool{};
+
+    {
+      Image img(&pool);
+      std::ifstream file(fpathname);
+      assert_file(&file, fpathname.c_str());
+      img.load(file);
+      s.assert(
+        "aligned",
+        reinterpret_cast<uintptr_t>(img.pixels()) % BufferPool::ALIGNMENT == 0
+      );
+      s.assert("allocator", img.allocator() == &pool && Image(img).allocator() == &pool);
+    }
+    s.assert("cached after destruction", pool.cached() == 2);
+
+    {
+      Image img(&pool);
+      {
+        std::ifstream file(fpathname);
+        assert_file(&file, fpathname.c_str());
+        img.load(file);
+      }
+      uint8_t const *const buffer = img.pixels();
+      {
+        std::ifstream file(smallerFpathname);
+        assert_file(&file, smallerFpathname.c_str());
+        img.load(file);
+      }
+      s.assert("load reuses buffer", img.pixels() == buffer);
+    }
+
+    // load, copy and discard frames in a loop
+    {
+      size_t heapAllocationsAfterFirstFrame = 0;
+      for (size_t frame = 0; frame < 10; ++frame) {
+        std::ifstream file(frame % 2 == 0 ? fpathname : smallerFpathname);
+        Image img(file, &pool);
+        Image copy(img);
+        copy = img;
+        img.clear();
+        if (frame == 0) {
+          heapAllocationsAfterFirstFrame = pool.heap_allocations();
+        }
+      }
+      s.assert(
+        "zero steady-state allocations",
+        pool.heap_allocations() == heapAllocationsAfterFirstFrame
+      );
+    }
+
+    pool.release();
+    s.assert("release", pool.cached() == 0);
+    for (size_t const size : { size_t{1} << 60, (size_t{1} << 63) + 1, SIZE_MAX }) {
+      bool threw = false;
+      try {
+        pool.deallocate(pool.allocate(size), size);
+      } catch (std::bad_alloc const &) {
+        threw = true;
+      }
+      s.assert(("too large, size=" + std::to_string(size)).c_str(), threw);
+    }
+  }
+
+  {
+    SETUP_SUITE("pgm8::Image (failed allocation)")
+
+    // hands out buffers until `budget` runs out, then throws
+    struct LimitedAllocator : pgm8::Allocator {
+      size_t budget;
+      explicit LimitedAllocator(size_t const budget) : budget{budget} {}
+      uint8_t *allocate(size_t const size) override {
+        if (size > budget) {
+          throw std::bad_alloc();
+        }
+        budget -= size;
+        return new uint8_t[size];
+      }
+      void deallocate(uint8_t *const buffer, size_t) noexcept override {
+        delete[] buffer;
+      }
+    };
+
+    LimitedAllocator allocator(100);
+    Image img(10, 10, 255, &allocator);
+    std::memset(img.pixels(), 7, img.pixel_count());
+    Image const bigger(20, 20, 255);
+
+    bool threw = false;
+    try {
+      img = bigger;
+    } catch (std::bad_alloc const &) {
+      threw = true;
+    }
+    s.assert("throws", threw);
+    auto const unchanged = [&img] {
+      return img.width() == 10 && img.height() == 10 && img.maxval() == 255 && img.pixels() != nullptr &&
+        std::all_of(img.pixels(), img.pixels() + img.pixel_count(), [](uint8_t const p) { return p == 7; });
+    };
+    s.assert("image unchanged", unchanged());
+
+    std::string const fpathname = std::string(imgsDir) + "bigger-raw.pgm";
+    {
+      std::ofstream file(fpathname, std::ios::binary);
+      assert_file(&file, fpathname.c_str());
+      pgm8::write(file, bigger.width(), bigger.height(), 200, bigger.pixels(), Format::RAW);
+    }
+    threw = false;
+    try {
+      std::ifstream file(fpathname, std::ios::binary);
+      img.load(file);
+    } catch (std::bad_alloc const &) {
+      threw = true;
+    }
+    s.assert("load throws", threw);
+    s.assert("image unchanged by load", unchanged());
+  }
+
+  {
+    SETUP_SUITE("pgm8 image operations")
+
+    std::string const fpathname = std::string(imgsDir) + "ascending-plain.pgm";
+    std::ifstream file(fpathname);
+    assert_file(&file, fpathname.c_str());
+    Image const ascending(file);
+
+    {
+      auto const hist = pgm8::histogram(ascending);
+      bool correct = hist[0] == 0;
+      for (size_t v = 1; v < 256; ++v) {
+        correct = correct && hist[v] == (v <= 16 ? 1 : 0);
+      }
+      s.assert("histogram", correct);
+    }
+
+    {
+      Image img(ascending);
+      pgm8::threshold(img, 8);
+      uint8_t const expected[4 * 4] {
+        0,  0,  0,  0,
+        0,  0,  0,  0,
+        16, 16, 16, 16,
+        16, 16, 16, 16,
+      };
+      s.assert("threshold", arr2d::cmp(img.pixels(), expected, 4, 4));
+    }
+
+    {
+      Image img(ascending);
+      std::array<uint8_t, 256> lut{};
+      for (size_t v = 0; v < 256; ++v) {
+        lut[v] = static_cast<uint8_t>(255 - v);
+      }
+      pgm8::apply_lut(img, lut);
+      bool correct = true;
+      for (size_t i = 0; i < img.pixel_count(); ++i) {
+        correct = correct && img.pixels()[i] == 255 - ascending.pixels()[i];
+      }
+      s.assert("apply_lut", correct);
+    }
+
+    {
+      Image img(ascending);
+      pgm8::rescale(img, 255);
+      s.assert(
+        "rescale",
+        img.maxval() == 255 &&
+        img.pixels()[0] == 16 && // 1 * 255 / 16 = 15.94
+        img.pixels()[7] == 128 && // 8 * 255 / 16 = 127.5
+        img.pixels()[15] == 255
+      );
+    }
+
+    {
+      uint8_t const expected[2 * 2] {
+        4,  6,
+        12, 14,
+      };
+      for (Filter const filter : { Filter::BOX, Filter::BILINEAR }) {
+        Image const img = pgm8::downsample(ascending, 2, 2, filter);
+        s.assert(
+          filter == Filter::BOX ? "downsample box" : "downsample bilinear",
+          img.width() == 2 &&
+          img.height() == 2 &&
+          img.maxval() == 16 &&
+          arr2d::cmp(img.pixels(), expected, 2, 2)
+        );
+      }
+    }
+
+    // parallel variants must give the same results as the serial ones
+    {
+      uint16_t const width = 1000, height = 700;
+      Image big(width, height, 255);
+      uint32_t state = 12345;
+      for (size_t i = 0; i < big.pixel_count(); ++i) {
+        state = state * 1664525 + 1013904223;
+        big.pixels()[i] = static_cast<uint8_t>(state >> 24);
+      }
+
+      s.assert(
+        "histogram parallel",
+        pgm8::histogram(big, 1) == pgm8::histogram(big, 4)
+      );
+
+      {
+        Image serial(big), parallel(big);
+        pgm8::threshold(serial, 100, 1);
+        pgm8::threshold(parallel, 100, 4);
+        bool correct = serial == parallel;
+        for (size_t i = 0; i < big.pixel_count(); ++i) {
+          correct = correct &&
+            serial.pixels()[i] == (big.pixels()[i] > 100 ? 255 : 0);
+        }
+        s.assert("threshold parallel", correct);
+      }
+
+      {
+        Image serial(big), parallel(big);
+        pgm8::rescale(serial, 7, 1);
+        pgm8::rescale(parallel, 7, 4);
+        s.assert("rescale parallel", serial == parallel);
+      }
+
+      for (Filter const filter : { Filter::BOX, Filter::BILINEAR }) {
+        s.assert(
+          filter == Filter::BOX ? "downsample box parallel" : "downsample bilinear parallel",
+          pgm8::downsample(big, 333, 250, filter, 1) ==
+            pgm8::downsample(big, 333, 250, filter, 4)
+        );
+      }
+    }
+
+    {
+      bool threw = false;
+      try {
+        (void)pgm8::downsample(ascending, 5, 4, Filter::BOX);
+      } catch (std::runtime_error const &) {
+        threw = true;
+      }
+      s.assert("downsample to larger throws", threw);
+    }
+  }
+
+  {
+    SETUP_SUITE_USING(pgm8::load_batch)
+
+    std::vector<std::string> pathnames{};
+    for (char const *const name : {
+      "ascending-plain.pgm",
+      "noise-plain.pgm",
+      "noise-raw.pgm",
+      "gradient-plain.pgm",
+      "gradient-raw.pgm",
+      "homogenous-plain.pgm",
+      "homogenous-raw.pgm",
+    }) {
+      pathnames.emplace_back(std::string(imgsDir) + name);
+    }
+
+    std::vector<Image> expected{};
+    for (auto const &pathname : pathnames) {
+      std::ifstream file(pathname);
+      assert_file(&file, pathname.c_str());
+      expected.emplace_back(file);
+    }
+
+    auto const testCase = [&s, &pathnames, &expected](
+      char const *const name,
+      Order const order,
+      size_t const numThreads
+    ) {
+      std::vector<size_t> idxs{};
+      bool allEqual = true;
+      load_batch(
+        pathnames,
+        [&](size_t const idx, Image &img) {
+          idxs.push_back(idx);
+          allEqual = allEqual && img == expected[idx];
+        },
+        order,
+        numThreads
+      );
+
+      bool const allHandedOverOnce = [&idxs, &pathnames]() {
+        std::vector<size_t> sorted(idxs);
+        std::sort(sorted.begin(), sorted.end());
+        std::vector<size_t> all(pathnames.size());
+        std::iota(all.begin(), all.end(), 0);
+        return sorted == all;
+      }();
+
+      s.assert(
+        name,
+        allEqual && allHandedOverOnce &&
+        (order == Order::COMPLETION || std::is_sorted(idxs.begin(), idxs.end()))
+      );
+    };
+
+    testCase("submission order, 1 thread", Order::SUBMISSION, 1);
+    testCase("submission order, 4 threads", Order::SUBMISSION, 4);
+    testCase("completion order, 1 thread", Order::COMPLETION, 1);
+    testCase("completion order, 4 threads", Order::COMPLETION, 4);
+
+    {
+      bool threw = false;
+      try {
+        load_batch(
+          { std::string(imgsDir) + "does-not-exist.pgm" },
+          [](size_t, Image &) {}
+        );
+      } catch (std::runtime_error const &) {
+        threw = true;
+      }
+      s.assert("missing file throws", threw);
+    }
+  }
 }
 
 #endif // TEST_PGM8
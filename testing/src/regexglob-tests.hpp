@@ -22,6 +22,154 @@ void regexglob_tests(char const *const regexglobDir, char const *const resDir) {
   regexglob::set_ofstream(&outFile);
   regexglob::set_preferred_separator('/');
 
+  {
+    SETUP_SUITE("regexglob::Pattern")
+
+    using regexglob::Pattern;
+    using Engine = regexglob::Pattern::Engine;
+
+    auto const testCase = [&s](
+      char const *const regex,
+      Engine const expectedEngine,
+      std::vector<std::string> const &names
+    ) {
+      Pattern const pattern(regex);
+      std::regex const stdRegex(regex);
+
+      bool sameAsStdRegex = true;
+      for (auto const &name : names) {
+        sameAsStdRegex = sameAsStdRegex &&
+          pattern.matches(name) == std::regex_match(name, stdRegex);
+      }
+
+      s.assert(regex, pattern.engine() == expectedEngine && sameAsStdRegex);
+    };
+
+    std::vector<std::string> const names {
+      "", "a", "ab", "abc", "book.txt", "book.txt.bak", ".txt", "txt",
+      "cpp_book.txt", "advJava.txt", "python_book.md", "line\nbreak.txt",
+      "2023-01-01.log", "img001.pgm", "IMG001.PGM", "a b", "_", "\xe9t\xe9.txt",
+    };
+
+    testCase(".*", Engine::LITERAL, names);
+    testCase("book\\.txt", Engine::LITERAL, names);
+    testCase(".*\\.txt", Engine::LITERAL, names);
+    testCase("python_.*", Engine::LITERAL, names);
+    testCase(".*book.*", Engine::LITERAL, names);
+    testCase("^.*\\.pgm$", Engine::LITERAL, names);
+    testCase("", Engine::LITERAL, names);
+
+    testCase("book.txt", Engine::DFA, names);
+    testCase(".*\\.(txt|md)", Engine::DFA, names);
+    testCase("java.*[bB]ook\\..*", Engine::DFA, names);
+    testCase("adv(anced)?_?[c](pp)?\\..*", Engine::DFA, names);
+    testCase("\\d{4}-\\d\\d-\\d{2}\\.log", Engine::DFA, names);
+    testCase("img\\d+\\.pgm", Engine::DFA, names);
+    testCase("[^.]*", Engine::DFA, names);
+    testCase("(?:a|b)+c?", Engine::DFA, names);
+    testCase("\\w+\\s\\w+", Engine::DFA, names);
+    testCase("[a-c\\d_]{1,3}", Engine::DFA, names);
+    testCase("a*?b??", Engine::DFA, names);
+    testCase(".\\.txt|.*\\x2Etxt", Engine::DFA, names);
+
+    testCase("(a)\\1", Engine::STD_REGEX, names);
+    testCase("a(?=b)b", Engine::STD_REGEX, names);
+    testCase("\\bbook\\b.*", Engine::STD_REGEX, names);
+    testCase("[[:upper:]]+.*", Engine::STD_REGEX, names);
+
+    {
+      bool threw = false;
+      try {
+        Pattern const pattern("(unclosed");
+      } catch (std::regex_error const &) {
+        threw = true;
+      }
+      s.assert("invalid regex throws std::regex_error", threw);
+    }
+  }
+
+  {
+    SETUP_SUITE("regexglob::PatternSet")
+
+    std::vector<std::string> const regexes {
+      ".*\\.txt",
+      ".*\\.md",
+      "java.*[bB]ook\\..*",
+      "(a)\\1.*", // needs std::regex
+      ".*book.*",
+    };
+    regexglob::PatternSet const patterns(regexes);
+
+    s.assert("size", patterns.size() == regexes.size());
+    s.assert("num_separate", patterns.num_separate() == 1);
+
+    std::vector<std::string> const names {
+      "", "javaBook.txt", "javascriptBook.md", "aa_book.md", "cpp_book.txt",
+      "adv_python.md", "notes", "book.txt.bak",
+    };
+
+    bool sameAsStdRegex = true;
+    std::vector<size_t> matched{};
+    for (auto const &name : names) {
+      std::vector<size_t> expected{};
+      for (size_t i = 0; i < regexes.size(); ++i) {
+        if (std::regex_match(name, std::regex(regexes[i]))) {
+          expected.push_back(i);
+        }
+      }
+      patterns.matches(name, matched);
+      sameAsStdRegex = sameAsStdRegex && matched == expected;
+    }
+    s.assert("matches same as std::regex", sameAsStdRegex);
+
+    {
+      regexglob::PatternSet const empty(std::vector<std::string>{});
+      empty.matches("anything", matched);
+      s.assert("no patterns", empty.size() == 0 && matched.empty());
+    }
+  }
+
+  {
+    SETUP_SUITE("regexglob::PathList")
+
+    regexglob::PathList list{};
+    s.assert("starts empty", list.empty() && list.size() == 0);
+
+    list.push_back("root/a/b/", "x");
+    list.push_back("root/a/b/", "y");
+    list.push_back("root/a/", "b-c");
+    list.push_back("root/a/", "b");
+    list.push_back("root/a/b/", "z");
+
+    s.assert("size", list.size() == 5);
+    s.assert("dir", list.dir(2) == "root/a/");
+    s.assert("name", list.name(2) == "b-c");
+    s.assert("path", list.path(0) == "root/a/b/x");
+    s.assert("consecutive dirs are shared", list.dir(0).data() == list.dir(1).data());
+
+    regexglob::PathList other{};
+    other.push_back("other/", "0");
+    list.append(other);
+    s.assert("append", list.size() == 6 && list.path(5) == "other/0");
+
+    list.sort();
+    std::vector<std::string> expected {
+      "root/a/b/x", "root/a/b/y", "root/a/b-c", "root/a/b", "root/a/b/z", "other/0",
+    };
+    std::sort(expected.begin(), expected.end());
+    std::vector<std::string> sorted{};
+    for (size_t i = 0; i < list.size(); ++i) {
+      sorted.push_back(list.path(i));
+    }
+    s.assert("sort same as sorting full paths", sorted == expected);
+
+    std::vector<fs::path> const paths = list.to_paths();
+    s.assert("to_paths", paths.size() == 6 && paths[0] == fs::path(expected[0]));
+
+    list.clear();
+    s.assert("clear", list.empty());
+  }
+
   {
     SETUP_SUITE_USING(regexglob::fmatch)
 
@@ -122,6 +270,636 @@ void regexglob_tests(char const *const regexglobDir, char const *const resDir) {
       );
     }
   }
+
+  {
+    SETUP_SUITE("regexglob::fmatch (Options)")
+
+    fs::path const root = regexglobDir;
+    std::string const booksDir = std::string(regexglobDir) + "books";
+
+    std::vector<fs::path> expected {
+      root / "books/advanced/advJava.txt",
+      root / "books/advanced/adv_cpp.txt",
+      root / "books/cBook.txt",
+      root / "books/cpp_book.txt",
+      root / "books/javaBook.txt",
+    };
+    for (auto &path : expected) {
+      regexglob::homogenize_path_separators(path, '/');
+    }
+    std::sort(expected.begin(), expected.end());
+
+    for (size_t const numThreads : { 1, 2, 4, 16 }) {
+      regexglob::Options options{};
+      options.numThreads = numThreads;
+      options.sorted = true;
+
+      std::vector<fs::path> const result =
+        regexglob::fmatch(booksDir.c_str(), ".*\\.txt", options);
+
+      s.assert(
+        ("sorted, numThreads=" + std::to_string(numThreads)).c_str(),
+        vector_cmp(result, expected)
+      );
+    }
+
+    {
+      regexglob::Options options{};
+      options.numThreads = 4;
+
+      std::vector<fs::path> result =
+        regexglob::fmatch(booksDir.c_str(), ".*\\.txt", options);
+      std::sort(result.begin(), result.end());
+
+      s.assert("unsorted, numThreads=4", vector_cmp(result, expected));
+    }
+
+    {
+      regexglob::Options options{};
+      options.numThreads = 0; // treated as 1
+      options.sorted = true;
+
+      std::vector<fs::path> const result =
+        regexglob::fmatch(booksDir.c_str(), ".*\\.txt", options);
+
+      s.assert("numThreads=0", vector_cmp(result, expected));
+    }
+  }
+
+  {
+    SETUP_SUITE_USING(regexglob::fmatch_compact)
+
+    std::string const searchRoot = std::string(regexglobDir) + "books";
+
+    for (size_t const numThreads : { 1, 4 }) {
+      regexglob::Options options{};
+      options.numThreads = numThreads;
+      options.sorted = true;
+
+      regexglob::PathList const result =
+        fmatch_compact(searchRoot.c_str(), ".*\\.(txt|md)", options);
+
+      s.assert(
+        ("same as fmatch, numThreads=" + std::to_string(numThreads)).c_str(),
+        vector_cmp(
+          result.to_paths(),
+          regexglob::fmatch(searchRoot.c_str(), ".*\\.(txt|md)", options)
+        )
+      );
+    }
+  }
+
+  {
+    SETUP_SUITE("regexglob::fmatch (pruning)")
+
+    fs::path const root = regexglobDir;
+    std::string const booksDir = std::string(regexglobDir) + "books";
+
+    std::vector<fs::path> topLevel {
+      root / "books/cBook.txt",
+      root / "books/cpp_book.txt",
+      root / "books/javaBook.txt",
+      root / "books/javascriptBook.md",
+      root / "books/python_book.md",
+    };
+    std::vector<fs::path> advanced {
+      root / "books/advanced/advJava.txt",
+      root / "books/advanced/advJavascript.md",
+      root / "books/advanced/adv_cpp.txt",
+      root / "books/advanced/adv_python.md",
+      root / "books/advanced/advancedc.md",
+    };
+    for (auto *const paths : { &topLevel, &advanced }) {
+      for (auto &path : *paths) {
+        regexglob::homogenize_path_separators(path, '/');
+      }
+      std::sort(paths->begin(), paths->end());
+    }
+
+    auto const testCase = [&s](
+      char const *const name,
+      char const *const searchRoot,
+      char const *const filePattern,
+      regexglob::Options options,
+      std::vector<fs::path> const &expected
+    ) {
+      options.sorted = true;
+      s.assert(name, vector_cmp(
+        regexglob::fmatch(searchRoot, filePattern, options),
+        expected
+      ));
+    };
+
+    {
+      regexglob::Options options{};
+      options.maxDepth = 0;
+      testCase("maxDepth=0", booksDir.c_str(), ".*", options, topLevel);
+      options.maxDepth = 1;
+      testCase("maxDepth=1", regexglobDir, ".*", options, topLevel);
+    }
+    {
+      regexglob::Options options{};
+      options.excludeDirs = { "adv.*" };
+      testCase("excludeDirs", booksDir.c_str(), ".*", options, topLevel);
+      options.excludeDirs = { "nothing", "books" };
+      testCase("excludeDirs everything", regexglobDir, ".*", options, {});
+    }
+    {
+      regexglob::Options options{};
+      options.includeDirs = { "adv.*" };
+      testCase("includeDirs", booksDir.c_str(), ".*\\.txt", options, {
+        root / "books/advanced/advJava.txt",
+        root / "books/advanced/adv_cpp.txt",
+        root / "books/cBook.txt",
+        root / "books/cpp_book.txt",
+        root / "books/javaBook.txt",
+      });
+      // subdirectories of included directories are included too
+      options.includeDirs = { "books" };
+      options.numThreads = 4;
+      std::vector<fs::path> all = topLevel;
+      all.insert(all.end(), advanced.begin(), advanced.end());
+      std::sort(all.begin(), all.end());
+      testCase("includeDirs subtree", regexglobDir, ".*", options, all);
+      options.excludeDirs = { "advanced" };
+      testCase("includeDirs + excludeDirs", regexglobDir, ".*", options, topLevel);
+      // directories which don't match are still walked, to find matching ones below them
+      options.excludeDirs = {};
+      options.includeDirs = { "advanced" };
+      testCase("includeDirs nested", regexglobDir, ".*", options, advanced);
+      options.matchRelativePaths = true;
+      options.includeDirs = { "books/advanced" };
+      testCase("includeDirs nested relative path", regexglobDir, ".*", options, advanced);
+    }
+    {
+      regexglob::Options options{};
+      options.matchRelativePaths = true;
+      testCase("matchRelativePaths", booksDir.c_str(), "advanced/.*\\.md", options, {
+        root / "books/advanced/advJavascript.md",
+        root / "books/advanced/adv_python.md",
+        root / "books/advanced/advancedc.md",
+      });
+      testCase("matchRelativePaths top level", booksDir.c_str(), "[^/]*\\.md", options, {
+        root / "books/javascriptBook.md",
+        root / "books/python_book.md",
+      });
+      options.excludeDirs = { "books/advanced" };
+      testCase("matchRelativePaths excludeDirs", regexglobDir, ".*", options, topLevel);
+    }
+  }
+
+  {
+    SETUP_SUITE_USING(regexglob::Stats)
+
+    std::string const booksDir = std::string(regexglobDir) + "books";
+
+    for (size_t const numThreads : { 1, 4 }) {
+      std::string const suffix = ", numThreads=" + std::to_string(numThreads);
+      regexglob::Stats stats{};
+      regexglob::Options options{};
+      options.numThreads = numThreads;
+      options.stats = &stats;
+
+      size_t const numMatches = regexglob::fmatch(booksDir.c_str(), ".*\\.txt", options).size();
+      s.assert(("counters" + suffix).c_str(),
+        stats.dirsRead == 2 &&
+        stats.dirsSkipped == 0 &&
+        stats.dirsPruned == 0 &&
+        stats.filesChecked == 10 &&
+        stats.matches == numMatches && numMatches == 5);
+      s.assert(("times" + suffix).c_str(),
+        stats.readTime.count() > 0 && stats.matchTime.count() > 0);
+
+      options.excludeDirs = { "advanced" };
+      regexglob::fmatch(booksDir.c_str(), ".*\\.txt", options);
+      s.assert(("pruned" + suffix).c_str(),
+        stats.dirsRead == 1 && stats.dirsPruned == 1 &&
+        stats.filesChecked == 5 && stats.matches == 3);
+    }
+
+    {
+      regexglob::Stats stats{};
+      regexglob::Options options{};
+      options.stats = &stats;
+      regexglob::fmatch_multi(booksDir.c_str(), { ".*\\.txt", ".*[bB]ook.*" }, options);
+      s.assert("fmatch_multi sums matches over patterns",
+        stats.filesChecked == 10 && stats.matches == 5 + 5);
+    }
+  }
+
+  {
+    SETUP_SUITE_USING(regexglob::fmatch_multi)
+
+    std::string const booksDir = std::string(regexglobDir) + "books";
+    std::vector<std::string> const filePatterns {
+      ".*\\.txt",
+      "java.*[bB]ook\\..*",
+      "adv(anced)?_?[c](pp)?\\..*",
+      "python_.*",
+      "nothing matches this",
+    };
+
+    for (size_t const numThreads : { 1, 4 }) {
+      regexglob::Options options{};
+      options.numThreads = numThreads;
+      options.sorted = true;
+
+      auto const result = fmatch_multi(booksDir.c_str(), filePatterns, options);
+
+      bool sameAsFmatch = result.size() == filePatterns.size();
+      for (size_t i = 0; sameAsFmatch && i < filePatterns.size(); ++i) {
+        sameAsFmatch = vector_cmp(
+          result[i],
+          regexglob::fmatch(booksDir.c_str(), filePatterns[i].c_str(), options)
+        );
+      }
+
+      s.assert(
+        ("same as fmatch, numThreads=" + std::to_string(numThreads)).c_str(),
+        sameAsFmatch
+      );
+    }
+
+    {
+      regexglob::Options options{};
+      options.maxMatches = 1;
+      auto const result = fmatch_multi(
+        booksDir.c_str(),
+        { ".*\\.txt", ".*\\.md" },
+        options
+      );
+      s.assert("maxMatches",
+        result.size() == 2 && result[0].size() == 1 && result[1].size() == 1);
+    }
+  }
+
+  {
+    SETUP_SUITE("regexglob::Index")
+
+    fs::path const indexRoot = fs::path(resDir) / "regexglob-index";
+    fs::remove_all(indexRoot);
+    fs::create_directories(indexRoot / "sub/deep");
+    std::ofstream(indexRoot / "a.txt");
+    std::ofstream(indexRoot / "sub/b.txt");
+    std::ofstream(indexRoot / "sub/deep/c.md");
+
+    // directories modified within the last couple of seconds are always re-read
+    auto const age = [](fs::path const &dir, int const hours) {
+      fs::last_write_time(dir, fs::file_time_type::clock::now() - std::chrono::hours(hours));
+    };
+    age(indexRoot, 2);
+    age(indexRoot / "sub", 2);
+    age(indexRoot / "sub/deep", 2);
+
+    std::string const rootStr = indexRoot.string();
+    std::string const indexFile = (fs::path(resDir) / "regexglob-index.bin").string();
+
+    auto const matches = [](regexglob::Index const &index, char const *const pattern) {
+      regexglob::Options options{};
+      options.sorted = true;
+      std::vector<std::string> names{};
+      for (auto const &path : index.fmatch(pattern, options)) {
+        names.push_back(path.filename().string());
+      }
+      return names;
+    };
+
+    regexglob::Index index(rootStr.c_str());
+    s.assert("starts empty", index.num_dirs() == 0 && matches(index, ".*").empty());
+    s.assert("cold refresh reads every directory", index.refresh() == 3);
+    s.assert("num_dirs", index.num_dirs() == 3);
+    s.assert("num_files", index.num_files() == 3);
+    s.assert("warm refresh reads nothing", index.refresh() == 0);
+    s.assert("fmatch", matches(index, ".*\\.txt") == std::vector<std::string>{ "a.txt", "b.txt" });
+
+    {
+      regexglob::Options options{};
+      options.sorted = true;
+      options.excludeDirs = { "deep" };
+      s.assert("fmatch same as regexglob::fmatch", vector_cmp(
+        index.fmatch(".*", options),
+        regexglob::fmatch(rootStr.c_str(), ".*", options)
+      ));
+      options.excludeDirs = {};
+      options.includeDirs = { "deep" };
+      s.assert("fmatch includeDirs nested", vector_cmp(
+        index.fmatch(".*", options),
+        std::vector<fs::path>{ indexRoot / "a.txt", indexRoot / "sub/deep/c.md" }
+      ));
+      {
+        regexglob::Stats indexStats{}, walkStats{};
+        regexglob::Options statsOptions = options;
+        statsOptions.excludeDirs = { "deep" };
+        statsOptions.includeDirs = {};
+        statsOptions.maxDepth = 1;
+        statsOptions.stats = &indexStats;
+        (void)index.fmatch(".*\\.txt", statsOptions);
+        statsOptions.stats = &walkStats;
+        (void)regexglob::fmatch(rootStr.c_str(), ".*\\.txt", statsOptions);
+        s.assert("fmatch stats same as regexglob::fmatch",
+          indexStats.dirsRead == 0 &&
+          indexStats.dirsPruned == walkStats.dirsPruned &&
+          indexStats.dirsPruned == 1 &&
+          indexStats.filesChecked == walkStats.filesChecked &&
+          indexStats.matches == walkStats.matches &&
+          indexStats.matches == 2);
+      }
+    }
+
+    index.save(indexFile.c_str());
+    {
+      regexglob::Index loaded(rootStr.c_str());
+      s.assert("load", loaded.load(indexFile.c_str()));
+      s.assert("loaded matches", matches(loaded, ".*") == matches(index, ".*"));
+      s.assert("refresh after load reads nothing", loaded.refresh() == 0);
+    }
+    {
+      regexglob::Index other((std::string(regexglobDir) + "books").c_str());
+      s.assert("load for other root fails", !other.load(indexFile.c_str()));
+      s.assert("load of missing file fails", !other.load((indexFile + ".missing").c_str()));
+    }
+    {
+      // an index for `rootStr` with the given dir count, followed by `dirs` (already serialized)
+      auto const writeIndex = [&](uint32_t const numDirs, std::string const &dirs) {
+        std::string buffer = "RGIX";
+        auto const put = [&buffer](uint32_t const value) {
+          buffer.append(reinterpret_cast<char const *>(&value), sizeof(value));
+        };
+        put(1);
+        put(static_cast<uint32_t>(rootStr.size()));
+        buffer += rootStr;
+        put(numDirs);
+        buffer += dirs;
+        std::ofstream(indexFile, std::ios::binary).write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+      };
+      // a directory with no name, files or mtime, and the given subdirectories
+      auto const dir = [](std::vector<uint32_t> const &subdirs) {
+        std::string bytes(4 + 8 + 4, '\0');
+        uint32_t const numSubdirs = static_cast<uint32_t>(subdirs.size());
+        bytes.append(reinterpret_cast<char const *>(&numSubdirs), sizeof(numSubdirs));
+        for (uint32_t const subdir : subdirs) {
+          bytes.append(reinterpret_cast<char const *>(&subdir), sizeof(subdir));
+        }
+        return bytes;
+      };
+
+      regexglob::Index corrupt(rootStr.c_str());
+      writeIndex(2, dir({ 1 }) + dir({}));
+      s.assert("load of hand-written index", corrupt.load(indexFile.c_str()) && corrupt.num_dirs() == 2);
+      writeIndex(UINT32_MAX, dir({ 1 }) + dir({}));
+      s.assert("load with huge dir count fails", !corrupt.load(indexFile.c_str()) && corrupt.num_dirs() == 0);
+      writeIndex(3, dir({ 1, 2 }) + dir({ 2 }) + dir({}));
+      s.assert("load with shared subdir fails", !corrupt.load(indexFile.c_str()) && corrupt.num_dirs() == 0);
+    }
+
+    // add a file to `sub` and remove `deep`
+    std::ofstream(indexRoot / "sub/d.txt");
+    fs::remove_all(indexRoot / "sub/deep");
+    age(indexRoot / "sub", 1);
+
+    s.assert("refresh reads changed directory only", index.refresh() == 1);
+    s.assert("refresh picks up changes",
+      matches(index, ".*") == std::vector<std::string>{ "a.txt", "b.txt", "d.txt" } &&
+      index.num_dirs() == 2);
+  }
+
+  {
+    SETUP_SUITE_USING(regexglob::fsearch)
+
+    fs::path const searchRoot = fs::path(resDir) / "regexglob-search";
+    fs::remove_all(searchRoot);
+    fs::create_directories(searchRoot / "sub");
+    std::ofstream(searchRoot / "a.txt", std::ios::binary)
+      << "int main() {\n  return 0;\n}\n";
+    std::ofstream(searchRoot / "sub/b.txt", std::ios::binary)
+      << "return 1\r\nreturn 2\r\nnothing\r\n  return 3";
+    std::ofstream(searchRoot / "sub/c.md", std::ios::binary)
+      << "return 4\n";
+    std::string const rootStr = searchRoot.string();
+
+    regexglob::Options options{};
+    options.sorted = true;
+
+    auto const lines = [](std::vector<regexglob::LineMatch> const &matches) {
+      std::vector<std::string> result{};
+      for (auto const &match : matches) {
+        result.push_back(
+          match.path.filename().string() + ':' +
+          std::to_string(match.lineNumber) + ':' +
+          std::to_string(match.offset) + ':' +
+          match.line
+        );
+      }
+      return result;
+    };
+
+    s.assert("literal", lines(fsearch(rootStr.c_str(), ".*\\.txt", "return", options)) ==
+      std::vector<std::string>{
+        "a.txt:2:13:  return 0;",
+        "b.txt:1:0:return 1",
+        "b.txt:2:10:return 2",
+        "b.txt:4:29:  return 3",
+      });
+    s.assert("anchored", lines(fsearch(rootStr.c_str(), ".*", "^return [0-9]$", options)) ==
+      std::vector<std::string>{
+        "b.txt:1:0:return 1",
+        "b.txt:2:10:return 2",
+        "c.md:1:0:return 4",
+      });
+    s.assert("no literal", lines(fsearch(rootStr.c_str(), ".*", "[{}]", options)) ==
+      std::vector<std::string>{
+        "a.txt:1:0:int main() {",
+        "a.txt:3:25:}",
+      });
+    s.assert("maxMatchesPerFile", lines(fsearch(rootStr.c_str(), ".*\\.txt", "return", options, 1)) ==
+      std::vector<std::string>{
+        "a.txt:2:13:  return 0;",
+        "b.txt:1:0:return 1",
+      });
+
+    {
+      regexglob::Options limited = options;
+      limited.maxMatches = 2;
+      limited.numThreads = 4;
+      s.assert("maxMatches", fsearch(rootStr.c_str(), ".*", "return", limited).size() == 2);
+    }
+    s.assert("no matches", fsearch(rootStr.c_str(), ".*", "nowhere to be found").empty());
+
+    {
+      // files are read 1 MiB at a time, check lines straddling chunks and a line longer than a chunk
+      fs::path const bigRoot = fs::path(resDir) / "regexglob-search-big";
+      fs::remove_all(bigRoot);
+      fs::create_directories(bigRoot);
+      std::string contents{};
+      std::vector<std::string> expected{};
+      for (size_t i = 0; contents.size() < 3 * 1024 * 1024; ++i) {
+        std::string const line = i % 1000 == 0
+          ? "match " + std::to_string(i) + std::string(i == 2000 ? 1500 * 1024 : 0, 'x')
+          : "line " + std::to_string(i) + " of filler text";
+        if (i % 1000 == 0) {
+          expected.push_back("big.txt:" + std::to_string(i + 1) + ':' + std::to_string(contents.size()) + ':' + line);
+        }
+        contents += line;
+        contents += '\n';
+      }
+      std::ofstream(bigRoot / "big.txt", std::ios::binary) << contents;
+      s.assert("chunked", lines(fsearch(bigRoot.string().c_str(), ".*", "^match", options)) == expected);
+    }
+
+    {
+      // many files in one directory, searched by every thread
+      fs::path const flatRoot = fs::path(resDir) / "regexglob-search-flat";
+      fs::remove_all(flatRoot);
+      fs::create_directories(flatRoot);
+      for (size_t i = 0; i < 500; ++i) {
+        std::ofstream(flatRoot / ("f" + std::to_string(i) + ".txt"), std::ios::binary)
+          << "one\n" << (i % 3 == 0 ? "two\n" : "") << "three\n";
+      }
+      regexglob::Options threaded = options;
+      threaded.numThreads = 4;
+      auto const single = lines(fsearch(flatRoot.string().c_str(), ".*", "two", options));
+      s.assert("many files, numThreads=4",
+        single.size() == 167 && lines(fsearch(flatRoot.string().c_str(), ".*", "two", threaded)) == single);
+      threaded.maxMatches = 10;
+      s.assert("many files, maxMatches", fsearch(flatRoot.string().c_str(), ".*", "t", threaded).size() == 10);
+    }
+  }
+
+  {
+    SETUP_SUITE_USING(regexglob::fmatch_each)
+
+    fs::path const root = regexglobDir;
+    std::string const booksDir = std::string(regexglobDir) + "books";
+
+    std::vector<fs::path> expected {
+      root / "books/advanced/advJava.txt",
+      root / "books/advanced/adv_cpp.txt",
+      root / "books/cBook.txt",
+      root / "books/cpp_book.txt",
+      root / "books/javaBook.txt",
+    };
+    for (auto &path : expected) {
+      regexglob::homogenize_path_separators(path, '/');
+    }
+    std::sort(expected.begin(), expected.end());
+
+    auto const is_expected = [&expected](fs::path const &path) {
+      return std::find(expected.begin(), expected.end(), path) != expected.end();
+    };
+
+    for (size_t const numThreads : { 1, 4 }) {
+      std::string const suffix = ", numThreads=" + std::to_string(numThreads);
+      regexglob::Options options{};
+      options.numThreads = numThreads;
+
+      {
+        std::vector<fs::path> result{};
+        size_t const count = fmatch_each(
+          booksDir.c_str(),
+          ".*\\.txt",
+          [&result](fs::path const &path) {
+            result.push_back(path);
+            return true;
+          },
+          options
+        );
+        std::sort(result.begin(), result.end());
+        s.assert(("all" + suffix).c_str(),
+          count == expected.size() && vector_cmp(result, expected));
+      }
+
+      {
+        std::vector<fs::path> result{};
+        size_t const count = fmatch_each(
+          booksDir.c_str(),
+          ".*\\.txt",
+          [&result](fs::path const &path) {
+            result.push_back(path);
+            return result.size() < 2;
+          },
+          options
+        );
+        s.assert(("stop from callback" + suffix).c_str(),
+          count == 2 && result.size() == 2 &&
+          is_expected(result[0]) && is_expected(result[1]));
+      }
+
+      {
+        regexglob::Options limited = options;
+        limited.maxMatches = 3;
+        size_t calls = 0;
+        size_t const count = fmatch_each(
+          booksDir.c_str(),
+          ".*\\.txt",
+          [&](fs::path const &path) {
+            calls += is_expected(path);
+            return true;
+          },
+          limited
+        );
+        s.assert(("maxMatches" + suffix).c_str(), count == 3 && calls == 3);
+
+        std::vector<fs::path> const result =
+          regexglob::fmatch(booksDir.c_str(), ".*\\.txt", limited);
+        s.assert(("fmatch maxMatches" + suffix).c_str(),
+          result.size() == 3 && std::all_of(result.begin(), result.end(), is_expected));
+      }
+    }
+
+    {
+      size_t const count = fmatch_each(
+        booksDir.c_str(),
+        "nothing matches this",
+        [](fs::path const &) { return true; }
+      );
+      s.assert("no matches", count == 0);
+    }
+  }
+  {
+    SETUP_SUITE_USING(regexglob::fmatch_info)
+
+    fs::path const infoRoot = fs::path(resDir) / "regexglob-info";
+    fs::remove_all(infoRoot);
+    fs::create_directories(infoRoot / "sub");
+    std::ofstream(infoRoot / "empty.txt", std::ios::binary);
+    std::ofstream(infoRoot / "a.txt", std::ios::binary) << "hello";
+    std::ofstream(infoRoot / "sub/b.txt", std::ios::binary) << std::string(70000, 'x');
+    std::ofstream(infoRoot / "sub/c.md", std::ios::binary) << "ignored";
+    std::string const rootStr = infoRoot.string();
+
+    regexglob::Options options{};
+    options.sorted = true;
+
+    using regexglob::StatMethod;
+    for (auto const method : { StatMethod::AUTO, StatMethod::IO_URING, StatMethod::THREADS }) {
+      std::string const suffix = ", method=" + std::to_string(static_cast<int>(method));
+      std::vector<regexglob::FileInfo> const infos =
+        fmatch_info(rootStr.c_str(), ".*\\.txt", options, method);
+
+      std::vector<fs::path> paths{};
+      for (auto const &info : infos) {
+        paths.push_back(info.path);
+      }
+      s.assert(("same paths as fmatch" + suffix).c_str(),
+        vector_cmp(paths, regexglob::fmatch(rootStr.c_str(), ".*\\.txt", options)));
+
+      s.assert(("metadata" + suffix).c_str(),
+        infos.size() == 3 && std::all_of(infos.begin(), infos.end(), [](regexglob::FileInfo const &info) {
+          return
+            info.type == fs::file_type::regular &&
+            info.size == fs::file_size(info.path) &&
+            info.lastWriteTime == fs::last_write_time(info.path);
+        }));
+      s.assert(("sizes" + suffix).c_str(),
+        infos.size() == 3 && infos[0].size == 5 && infos[1].size == 0 && infos[2].size == 70000);
+    }
+
+    options.numThreads = 4;
+    s.assert("threads",
+      fmatch_info(rootStr.c_str(), ".*", options, StatMethod::THREADS).size() == 4);
+    s.assert("no matches",
+      fmatch_info(rootStr.c_str(), "nothing matches this", options).empty());
+  }
 }
 
 #endif // TEST_REGEXGLOB
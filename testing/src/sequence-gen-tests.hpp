@@ -10,40 +10,329 @@
 #include "../../include/test.hpp"
 
 void seqgen_tests() {
-  SETUP_SUITE_USING(seqgen::populate);
-
-  auto const testCase = [&s](
-    char const *const pattern,
-    std::initializer_list<int> expected
-  ) {
-    size_t const len = expected.size();
-    auto const output = std::unique_ptr<int []>(new int[len]);
-    populate<int>(output.get(), pattern);
-    s.assert(pattern, std::memcmp(output.get(), expected.begin(), len) == 0);
-  };
-
-  // single num(s)
-  testCase("1", { 1 });
-  testCase("1,2,3", { 1,2,3 });
-  testCase("-1,-2,-3", { -1,-2,-3 });
-  testCase("-1,7,9", { -1,7,9 });
-  testCase("2345", { 2345 });
-  testCase("-2345", { -2345 });
-
-  // repeated num(s)
-  testCase("1{3}", { 1,1,1 });
-  testCase("-1{3}", { -1,-1,-1 });
-  testCase("1{3},2{4}", { 1,1,1, 2,2,2,2 });
-
-  // range(s)
-  testCase("1..3", { 1,2,3 });
-  testCase("-1..3", { -1,0,1,2,3 });
-  testCase("-1..-3", { -1,-2,-3 });
-  testCase("1..-3", { 1,0,-1,-2,-3 });
-  testCase("-111..-113", { -111,-112,-113 });
-
-  // all together
-  testCase("-1{2}, 0..3, 9, 4..6", { -1,-1, 0,1,2,3, 9, 4,5,6 });
+  {
+    SETUP_SUITE_USING(seqgen::populate);
+
+    auto const testCase = [&s](
+      char const *const pattern,
+      std::initializer_list<int> expected
+    ) {
+      size_t const len = expected.size();
+      auto const output = std::unique_ptr<int []>(new int[len]);
+      populate<int>(output.get(), pattern);
+      s.assert(pattern, std::memcmp(output.get(), expected.begin(), len) == 0);
+    };
+
+    // single num(s)
+    testCase("1", { 1 });
+    testCase("1,2,3", { 1,2,3 });
+    testCase("-1,-2,-3", { -1,-2,-3 });
+    testCase("-1,7,9", { -1,7,9 });
+    testCase("2345", { 2345 });
+    testCase("-2345", { -2345 });
+
+    // repeated num(s)
+    testCase("1{3}", { 1,1,1 });
+    testCase("-1{3}", { -1,-1,-1 });
+    testCase("1{3},2{4}", { 1,1,1, 2,2,2,2 });
+
+    // range(s)
+    testCase("1..3", { 1,2,3 });
+    testCase("-1..3", { -1,0,1,2,3 });
+    testCase("-1..-3", { -1,-2,-3 });
+    testCase("1..-3", { 1,0,-1,-2,-3 });
+    testCase("-111..-113", { -111,-112,-113 });
+
+    // all together
+    testCase("-1{2}, 0..3, 9, 4..6", { -1,-1, 0,1,2,3, 9, 4,5,6 });
+  }
+
+  {
+    SETUP_SUITE_USING(seqgen::Pattern);
+
+    auto const throws = [](char const *const pattern) {
+      try {
+        Pattern<int> const p(pattern);
+        return false;
+      } catch (std::runtime_error const &) {
+        return true;
+      }
+    };
+
+    Pattern<int> const p("-1{2}, 0..3, 9, 4..6");
+    s.assert("size", p.size() == 10);
+
+    std::vector<int> const expected{ -1,-1, 0,1,2,3, 9, 4,5,6 };
+    std::vector<int> first(p.size()), second(p.size());
+    p.populate(first.data());
+    p.populate(second.data());
+    s.assert("populate", first == expected);
+    s.assert("populate again", second == expected);
+
+    s.assert("empty pieces skipped", Pattern<int>(",1,,2,").size() == 2);
+    s.assert("spaces removed", Pattern<int>(" 1 2 { 3 } ").size() == 3);
+    s.assert("unsigned range", Pattern<uint8_t>("250..255").size() == 6);
+    s.assert("full range", Pattern<int8_t>("-128..127").size() == 256);
+
+    s.assert("empty", throws("") && throws("  "));
+    s.assert("invalid piece", throws("1,x"));
+    s.assert("missing number", throws("-") && throws("{3}") && throws("..3"));
+    s.assert("invalid repeat", throws("1{0}") && throws("1{03}") && throws("1{3") && throws("1{3}4"));
+    s.assert("invalid range", throws("1..") && throws("1...3") && throws("1..3..5"));
+    s.assert("out of range", throws("99999999999999999999"));
+
+    // long enough for the vectorized kernels, written at every alignment
+    auto const kernelCase = [&s]<typename Ty>(Ty, char const *const name) {
+      std::vector<Ty> expected(1000, static_cast<Ty>(-5));
+      for (int n = 3; n >= -120; --n) {
+        expected.push_back(static_cast<Ty>(n));
+      }
+      expected.push_back(7);
+      for (int n = -100; n <= 100; ++n) {
+        expected.push_back(static_cast<Ty>(n));
+      }
+
+      Pattern<Ty> const p("-5{1000}, 3..-120, 7, -100..100");
+      bool matches = p.size() == expected.size();
+      for (size_t offset = 0; offset < 4; ++offset) {
+        std::vector<Ty> out(offset + p.size() + 1, Ty(42));
+        p.populate(out.data() + offset);
+        matches = matches &&
+          std::equal(expected.begin(), expected.end(), out.begin() + static_cast<ptrdiff_t>(offset)) &&
+          std::count(out.begin(), out.begin() + static_cast<ptrdiff_t>(offset), Ty(42)) == static_cast<ptrdiff_t>(offset) &&
+          out.back() == Ty(42);
+      }
+      s.assert(name, matches);
+    };
+    kernelCase(int8_t{}, "kernels int8_t");
+    kernelCase(int16_t{}, "kernels int16_t");
+    kernelCase(int32_t{}, "kernels int32_t");
+    kernelCase(int64_t{}, "kernels int64_t");
+
+    {
+      std::vector<uint16_t> out(70000);
+      Pattern<uint16_t>("65530..65535, 0..65535").populate(out.data());
+      bool matches = true;
+      for (size_t i = 0; i < 6; ++i) {
+        matches = matches && out[i] == 65530 + i;
+      }
+      for (size_t i = 6; i < 6 + 65536; ++i) {
+        matches = matches && out[i] == i - 6;
+      }
+      s.assert("kernels uint16_t", matches);
+    }
+
+    {
+      // large enough to bypass the cache
+      std::vector<int32_t> out(10'000'001);
+      Pattern<int32_t>("0..9999999, 9").populate(out.data());
+      bool matches = out.back() == 9;
+      for (size_t i = 0; i + 1 < out.size(); ++i) {
+        matches = matches && out[i] == static_cast<int32_t>(i);
+      }
+      s.assert("kernels streaming", matches);
+    }
+  }
+
+  {
+    SETUP_SUITE_USING(seqgen::length);
+
+    s.assert("single", length<int>("7") == 1);
+    s.assert("mixed", length<int>("-1{2}, 0..3, 9, 4..6") == 10);
+    s.assert("depends on type", length<int>("0..300") == 301 && length<int8_t>("0..300") == 45);
+    s.assert("huge", length<int64_t>("0..4000000000, 1{4000000000}") == 8000000001);
+    static_assert(length<int>("1..100") == 100);
+
+    bool threw = false;
+    try {
+      (void)length<int>("1,x");
+    } catch (std::runtime_error const &) {
+      threw = true;
+    }
+    s.assert("invalid", threw);
+  }
+
+  {
+    SETUP_SUITE("seqgen::populate (span)");
+
+    std::vector<int> out(12, 42);
+    size_t const written = seqgen::populate<int>(out, "-1{2}, 0..3, 9, 4..6");
+    s.assert("written", written == 10);
+    s.assert("output", out == std::vector<int>{ -1,-1, 0,1,2,3, 9, 4,5,6, 42,42 });
+
+    std::vector<int> tooSmall(9, 42);
+    bool threw = false;
+    try {
+      (void)seqgen::populate<int>(tooSmall, "-1{2}, 0..3, 9, 4..6");
+    } catch (std::runtime_error const &) {
+      threw = true;
+    }
+    s.assert("too small", threw && tooSmall == std::vector<int>(9, 42));
+
+    s.assert("exact", seqgen::Pattern<int>("1..3").populate(std::span<int>(out.data(), 3)) == 3);
+  }
+
+  {
+    SETUP_SUITE("seqgen::Pattern (lazy)");
+
+    using seqgen::Pattern;
+    static_assert(std::ranges::random_access_range<Pattern<int>>);
+    static_assert(std::ranges::sized_range<Pattern<int>>);
+
+    Pattern<int> const p("-1{2}, 0..3, 9, 4..6");
+    std::vector<int> const expected{ -1,-1, 0,1,2,3, 9, 4,5,6 };
+
+    s.assert("iterate", std::vector<int>(p.begin(), p.end()) == expected);
+    s.assert("reverse", std::equal(
+      std::make_reverse_iterator(p.end()), std::make_reverse_iterator(p.begin()),
+      expected.rbegin(), expected.rend()
+    ));
+
+    bool randomAccess = p.end() - p.begin() == 10;
+    for (size_t i = 0; i < expected.size(); ++i) {
+      auto const offset = static_cast<ptrdiff_t>(i);
+      randomAccess = randomAccess &&
+        p[i] == expected[i] &&
+        p.begin()[offset] == expected[i] &&
+        *(p.end() - (10 - offset)) == expected[i];
+    }
+    s.assert("random access", randomAccess);
+
+    bool chunks = true;
+    for (size_t chunkSize = 1; chunkSize <= 11; ++chunkSize) {
+      std::vector<int> chunk(chunkSize), out{};
+      size_t pos = 0;
+      while (size_t const n = p.extract(pos, chunk)) {
+        out.insert(out.end(), chunk.begin(), chunk.begin() + static_cast<ptrdiff_t>(n));
+        pos += n;
+      }
+      chunks = chunks && out == expected;
+    }
+    s.assert("extract", chunks);
+    std::vector<int> tail(4);
+    s.assert("extract tail", p.extract(8, tail) == 2 && tail[0] == 5 && tail[1] == 6);
+    s.assert("extract past end", p.extract(10, tail) == 0);
+
+    Pattern<int64_t> const huge("0..4000000000, -7{4000000000}, 10..0");
+    s.assert("huge", huge.size() == 8'000'000'012 &&
+      huge[0] == 0 && huge[4'000'000'000] == 4'000'000'000 &&
+      huge[4'000'000'001] == -7 && huge[8'000'000'000] == -7 &&
+      huge[8'000'000'001] == 10 && huge[8'000'000'011] == 0);
+    s.assert("huge iterator", *(huge.begin() + 4'000'000'001) == -7 &&
+      *(huge.end() - 1) == 0 && *(huge.end() - 11) == 10 && *(huge.end() - 12) == -7);
+
+    Pattern<uint8_t> const wrapping("250..255, 3..0");
+    s.assert("wrapping", std::vector<uint8_t>(wrapping.begin(), wrapping.end()) ==
+      std::vector<uint8_t>{ 250,251,252,253,254,255, 3,2,1,0 });
+  }
+
+  {
+    SETUP_SUITE("seqgen::Pattern (grammar)");
+
+    auto const testCase = [&s](char const *const pattern, std::vector<int> const &expected) {
+      seqgen::Pattern<int> const p(pattern);
+      std::vector<int> out(p.size());
+      p.populate(out.data());
+      s.assert(pattern, out == expected);
+    };
+    auto const throws = [](char const *const pattern) {
+      try {
+        seqgen::Pattern<int> const p(pattern);
+        return false;
+      } catch (std::runtime_error const &) {
+        return true;
+      }
+    };
+
+    // step ranges
+    testCase("0..10:5", { 0,5,10 });
+    testCase("0..11:5", { 0,5,10 });
+    testCase("10..0:3", { 10,7,4,1 });
+    testCase("-1..-1:4", { -1 });
+
+    // arithmetic and geometric progressions
+    testCase("5+3{4}", { 5,8,11,14 });
+    testCase("5-3{4}", { 5,2,-1,-4 });
+    testCase("-1-2{3}", { -1,-3,-5 });
+    testCase("1*2{5}", { 1,2,4,8,16 });
+    testCase("3*-1{4}", { 3,-3,3,-3 });
+    testCase("7*0{3}", { 7,0,0 });
+
+    // groups
+    testCase("(1,2,3){3}", { 1,2,3, 1,2,3, 1,2,3 });
+    testCase("((1,2){2},0){2}", { 1,2,1,2,0, 1,2,1,2,0 });
+    testCase("9, (0..2, 4{2}){2}, 9", { 9, 0,1,2,4,4, 0,1,2,4,4, 9 });
+    testCase("( 1 , , 2 ){ 1 }", { 1,2 });
+
+    {
+      seqgen::Pattern<uint8_t> const p("1*2{10}, 250+3{3}");
+      std::vector<uint8_t> out(p.size());
+      p.populate(out.data());
+      s.assert("wrapping", out == std::vector<uint8_t>{ 1,2,4,8,16,32,64,128,0,0, 250,253,0 });
+    }
+
+    s.assert("invalid groups", throws("()") && throws("(1,2)") && throws("(1,2){0}") &&
+      throws("(1,2") && throws("1,2)") && throws("(,){2}") && throws("(1)x{2}"));
+    s.assert("invalid progressions", throws("0..10:0") && throws("0..10:") &&
+      throws("1+2") && throws("1+{3}") && throws("1*{3}") && throws("1*2") && throws("1+-2{3}"));
+    s.assert("nested too deeply",
+      throws("((((((((((((((((((((((((((((((((((1){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}){1}"));
+
+    seqgen::Pattern<int64_t> const p("-5, (0..1000:7, (1*3{30}){3}, 2+5{2}){50}, 100..0:9, (4{1000}, 5){20}");
+    std::vector<int64_t> expected(p.size());
+    p.populate(expected.data());
+
+    bool lazy = std::vector<int64_t>(p.begin(), p.end()) == expected;
+    for (size_t i = 0; i < expected.size(); i += 13) {
+      lazy = lazy && p[i] == expected[i];
+    }
+    s.assert("random access", lazy);
+
+    bool chunks = true;
+    for (size_t const chunkSize : { 1, 7, 64, 1000, 100000 }) {
+      std::vector<int64_t> chunk(chunkSize), out{};
+      for (size_t pos = 0; size_t const n = p.extract(pos, chunk); pos += n) {
+        out.insert(out.end(), chunk.begin(), chunk.begin() + static_cast<ptrdiff_t>(n));
+      }
+      chunks = chunks && out == expected;
+    }
+    s.assert("extract", chunks);
+
+    seqgen::Pattern<int32_t> const big("(0..99999, -1{50000}){20}, 5..-1000000, 1*3{100000}");
+    std::vector<int32_t> serial(big.size()), parallel(big.size());
+    big.populate(serial.data());
+    for (size_t const numThreads : { 2, 3, 8 }) {
+      std::fill(parallel.begin(), parallel.end(), 0);
+      big.populate(parallel.data(), numThreads);
+      s.assert(("parallel, numThreads=" + std::to_string(numThreads)).c_str(), parallel == serial);
+    }
+  }
+
+  {
+    SETUP_SUITE_USING(seqgen::generate);
+
+    constexpr auto mixed = generate<int, "-1{2}, 0..3, 9, 4..6">();
+    static_assert(mixed.size() == 10);
+    s.assert("mixed", mixed == std::array<int, 10>{ -1,-1, 0,1,2,3, 9, 4,5,6 });
+
+    constexpr auto single = generate<long long, "-9223372036854775808">();
+    s.assert("single", single.size() == 1 && single[0] == INT64_MIN);
+
+    constexpr auto wrapping = generate<uint8_t, "254..255, 256, -1">();
+    s.assert("wrapping", wrapping == std::array<uint8_t, 4>{ 254,255, 0, 255 });
+
+    constexpr auto grouped = generate<int, "(0..4:2, 1*2{3}){2}">();
+    s.assert("grouped", grouped == std::array<int, 12>{ 0,2,4, 1,2,4, 0,2,4, 1,2,4 });
+
+    constexpr auto repeated = generate<short, "7{1000}">();
+    s.assert("repeated", repeated.size() == 1000 &&
+      std::all_of(repeated.begin(), repeated.end(), [](short const n) { return n == 7; }));
+
+    seqgen::Pattern<int> const runtime("-1{2}, 0..3, 9, 4..6");
+    std::array<int, 10> runtimeOut{};
+    runtime.populate(runtimeOut.data());
+    s.assert("same as runtime", runtimeOut == mixed);
+  }
 }
 
 #endif // TEST_SEQUENCEGEN